@@ -0,0 +1,1567 @@
+// Benchmarks.cpp : timing harness for the MediaConverter dll.
+// usage: Benchmarks <benchmark> [args...]
+//
+#include "pch.h"
+#include "../MediaConverter/MediaConverter.h"
+#include "../MediaConverter/ThumbnailEngine.h"
+#include "../MediaConverter/SliceScaler.h"
+#include "../MediaConverter/ColorConverter.h"
+#include "../MediaConverter/DecoderPool.h"
+#include "../MediaConverter/MappedFile.h"
+#include "../MediaConverter/MediaInput.h"
+#include "../MediaConverter/MediaProbe.h"
+#include "../MediaConverter/SegmentTranscoder.h"
+#include "../MediaConverter/SessionManager.h"
+#include "../MediaConverter/StageTimings.h"
+#include "../MediaConverter/StreamingOutput.h"
+#include "../MediaConverter/ThreadBudget.h"
+#include "../MediaConverter/Transcoder.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double elapsedMs(BenchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+static bool hasFlag(int argc, char** argv, const char* flag)
+{
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], flag) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+* decodes every audio frame of the file through readAudioFrame and reports frames/sec.
+* --rebuild-resampler throws the cached SwrContext away before every frame which is
+* what outputToAudioBuffer used to do, so both numbers can be taken from the same build
+*/
+static int benchAudio(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        printf("usage: Benchmarks audio <file> [--rebuild-resampler]\n");
+        return 1;
+    }
+
+    bool rebuild = hasFlag(argc, argv, "--rebuild-resampler");
+    CMediaConverter converter;
+    MediaReaderState& state = converter.MRState();
+    if (converter.openVideoReader(argv[0]) != ErrorCode::SUCCESS || !state.HasAudioStream())
+    {
+        printf("unable to open audio stream in %s\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> audioBuffer;
+    int64_t frames = 0;
+    auto start = BenchClock::now();
+    while (1)
+    {
+        if (rebuild)
+            state.ResetResampler();
+
+        ErrorCode ret = converter.readAudioFrame(audioBuffer);
+        if (ret == ErrorCode::FILE_EOF || (int)ret < 0)
+            break;
+        if (ret == ErrorCode::SUCCESS)
+            ++frames;
+    }
+    double ms = elapsedMs(start);
+
+    printf("audio decode (%s): %lld frames in %.1f ms, %.1f frames/sec, %d resampler builds\n",
+        rebuild ? "rebuild per frame" : "cached resampler", (long long)frames, ms,
+        ms > 0 ? frames * 1000.0 / ms : 0.0, state.ResamplerBuilds());
+
+    converter.closeVideoReader();
+    return 0;
+}
+
+/*
+* runs the batch thumbnail engine over every file given, one thumbnail per listed timestamp
+* usage: Benchmarks thumbnails <sec,sec,...> [--exact] <file> [file...]
+*/
+static int benchThumbnails(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: Benchmarks thumbnails <sec,sec,...> [--exact] <file> [file...]\n");
+        return 1;
+    }
+
+    std::vector<double> seconds;
+    for (char* tok = argv[0]; *tok; )
+    {
+        seconds.push_back(atof(tok));
+        char* comma = strchr(tok, ',');
+        if (!comma)
+            break;
+        tok = comma + 1;
+    }
+
+    ThumbnailOptions options;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--exact") == 0)
+            options.keyframes_only = false;
+        else
+            files.push_back(argv[i]);
+    }
+
+    ThumbnailEngine engine(options);
+    ThumbnailStats stats = engine.Run(files, seconds, ThumbnailEngine::ThumbnailCallback());
+
+    printf("thumbnails (%s): %zu files (%zu failed), %zu thumbnails in %.1f ms, %.1f thumbs/sec, file latency avg %.1f ms p95 %.1f ms max %.1f ms\n",
+        options.keyframes_only ? "keyframes" : "exact", stats.files, stats.failed_files, stats.thumbnails, stats.wall_ms,
+        stats.thumbnails_per_sec, stats.avg_file_ms, stats.p95_file_ms, stats.max_file_ms);
+    return 0;
+}
+
+/*
+* open, read one frame, close - over and over, the pattern a service handling lots of short clips sees.
+* --no-pool opens a fresh decoder every time. --metadata opens with lazy decoders and only asks for
+* duration/codec/fps instead of reading a frame, --no-probe skips avformat_find_stream_info and
+* --video-only leaves the audio stream out
+* usage: Benchmarks open <file> [iterations] [--no-pool] [--metadata] [--no-probe] [--video-only]
+*/
+static int benchOpen(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        printf("usage: Benchmarks open <file> [iterations] [--no-pool] [--metadata] [--no-probe] [--video-only]\n");
+        return 1;
+    }
+
+    int iterations = argc > 1 && argv[1][0] != '-' ? atoi(argv[1]) : 200;
+    if (iterations <= 0)
+        iterations = 200;
+
+    bool metadata = hasFlag(argc, argv, "--metadata");
+    OpenOptions options;
+    options.pool_decoders = !hasFlag(argc, argv, "--no-pool");
+    options.lazy_decoders = metadata;
+    options.find_stream_info = !hasFlag(argc, argv, "--no-probe");
+    if (hasFlag(argc, argv, "--video-only"))
+        options.streams = StreamSelection::Video;
+
+    CMediaConverter converter;
+    FrameHandle frame;
+    double totalMs = 0.0, maxMs = 0.0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        MediaReaderState state;
+        auto start = BenchClock::now();
+        if (converter.openVideoReader(&state, argv[0], options) != ErrorCode::SUCCESS)
+        {
+            printf("unable to open %s\n", argv[0]);
+            return 1;
+        }
+        if (metadata)
+        {
+            volatile int64_t duration = state.VideoDuration();
+            volatile int fps = state.FPS();
+            const char* volatile codec = state.CodecName();
+        }
+        else
+            converter.readVideoFrame(&state, frame);
+        double ms = elapsedMs(start);
+        totalMs += ms;
+        maxMs = (std::max)(maxMs, ms);
+
+        frame.Reset();
+        converter.closeVideoReader(&state);
+    }
+
+    printf("open+%s (%s%s): %d iterations, avg %.3f ms, max %.3f ms\n", metadata ? "metadata" : "first frame",
+        options.pool_decoders ? "pooled" : "unpooled", options.find_stream_info ? "" : ", no probe", iterations, totalMs / iterations, maxMs);
+
+    DecoderPoolStats stats = DecoderPool::Instance().Stats();
+    printf("decoder pool: %lld hits (avg %.3f ms), %lld misses (avg %.3f ms), max %.3f ms, %zu idle, %lld evictions\n",
+        (long long)stats.hits, stats.hit_open_ms, (long long)stats.misses, stats.miss_open_ms, stats.max_open_ms,
+        stats.idle, (long long)stats.evictions);
+    return 0;
+}
+
+/*
+* opens every file (repeated --copies times) as its own session and decodes them all to the end
+* concurrently on the session manager's pool
+* usage: Benchmarks sessions [--copies N] [--threads N] <file> [file...]
+*/
+static int benchSessions(int argc, char** argv)
+{
+    int copies = 1;
+    size_t threads = 0;
+    std::vector<std::string> files;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--copies") == 0 && i + 1 < argc)
+            copies = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = (size_t)atoi(argv[++i]);
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        printf("usage: Benchmarks sessions [--copies N] [--threads N] <file> [file...]\n");
+        return 1;
+    }
+
+    SessionManager manager(threads);
+    std::vector<SessionHandle> handles;
+    for (int c = 0; c < (std::max)(1, copies); ++c)
+    {
+        for (auto& file : files)
+        {
+            SessionHandle handle;
+            if (manager.Open(file.c_str(), handle) == ErrorCode::SUCCESS)
+                handles.push_back(handle);
+            else
+                printf("unable to open %s\n", file.c_str());
+        }
+    }
+
+    std::atomic<int64_t> frames(0);
+    auto start = BenchClock::now();
+    manager.RunAll(handles, [&frames](SessionHandle, CMediaConverter& converter, MediaReaderState& state)
+    {
+        FrameHandle frame;
+        while (converter.readVideoFrame(&state, frame) == ErrorCode::SUCCESS)
+            ++frames;
+        return ErrorCode::SUCCESS;
+    });
+    double ms = elapsedMs(start);
+
+    printf("sessions: %zu sessions on %zu threads, %lld frames in %.1f ms, %.1f frames/sec\n", handles.size(),
+        manager.ThreadCount(), (long long)frames.load(), ms, ms > 0 ? frames * 1000.0 / ms : 0.0);
+    return 0;
+}
+
+/*
+* transcodes a file once with the default encoders and prints throughput for the whole pipeline
+* usage: Benchmarks transcode [--crf N] [--preset P] [--threads N] [--remux] <in> <out>
+*/
+static int benchTranscode(int argc, char** argv)
+{
+    TranscodeOptions options;
+    bool remux = false;
+    std::vector<const char*> files;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--crf") == 0 && i + 1 < argc)
+            options.crf = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--preset") == 0 && i + 1 < argc)
+            options.preset = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            options.encoder_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--remux") == 0)
+            remux = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.size() != 2)
+    {
+        printf("usage: Benchmarks transcode [--crf N] [--preset P] [--threads N] [--remux] <in> <out>\n");
+        return 1;
+    }
+
+    CMediaConverter converter;
+    auto start = BenchClock::now();
+    if (remux)
+    {
+        MediaReaderState state;
+        ErrorCode ret = converter.encodeMedia(files[0], files[1], &state);
+        printf("remux: %s in %.1f ms (error %d)\n", files[0], elapsedMs(start), (int)ret);
+        return ret == ErrorCode::SUCCESS ? 0 : 1;
+    }
+
+    TranscodeStats stats;
+    ErrorCode ret = converter.encodeMedia(files[0], files[1], options, &stats);
+    double ms = elapsedMs(start);
+    printf("transcode: %s -> %s with %s/%s, %lld video + %lld audio frames in %.1f ms, %.1f video frames/sec (error %d)\n",
+        files[0], files[1], stats.video_encoder ? stats.video_encoder : "-", stats.audio_encoder ? stats.audio_encoder : "-",
+        (long long)stats.video_frames, (long long)stats.audio_frames, ms, ms > 0 ? stats.video_frames * 1000.0 / ms : 0.0, (int)ret);
+    return ret == ErrorCode::SUCCESS ? 0 : 1;
+}
+
+/*
+* cuts [start, start + duration) out of a file with the remuxing encodeMedia and reports how much of the input
+* had to be read for it
+* usage: Benchmarks trim [--exact] <in> <out> <start seconds> <duration seconds>
+*/
+static int benchTrim(int argc, char** argv)
+{
+    TrimOptions trim;
+    std::vector<const char*> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--exact") == 0)
+            trim.exact = true;
+        else
+            args.push_back(argv[i]);
+    }
+    if (args.size() != 4)
+    {
+        printf("usage: Benchmarks trim [--exact] <in> <out> <start seconds> <duration seconds>\n");
+        return 1;
+    }
+
+    trim.start_time = (int64_t)(atof(args[2]) * AV_TIME_BASE);
+    trim.end_time = trim.start_time + (int64_t)(atof(args[3]) * AV_TIME_BASE);
+
+    std::ifstream file(args[0], std::ios::binary | std::ios::ate);
+    int64_t file_size = file ? (int64_t)file.tellg() : 0;
+
+    CMediaConverter converter;
+    MediaReaderState state;
+    TrimStats stats;
+    auto start = BenchClock::now();
+    ErrorCode ret = converter.encodeMedia(args[0], args[1], trim, &state, &stats);
+    double ms = elapsedMs(start);
+
+    printf("trim%s: %s [%ss, +%ss) in %.1f ms, read %.2f MB of %.2f MB, %lld packets, %lld re-encoded frames (error %d)\n",
+        trim.exact ? " exact" : "", args[0], args[2], args[3], ms, stats.bytes_read / 1048576.0, file_size / 1048576.0,
+        (long long)stats.packets_written, (long long)stats.head_frames, (int)ret);
+    return ret == ErrorCode::SUCCESS ? 0 : 1;
+}
+
+/*
+* remuxes a file into fragmented mp4 (or mpeg-ts with --ts) in memory and reports when the first fragment
+* was ready compared to the whole job, which is how long a file based encodeMedia makes a consumer wait
+* usage: Benchmarks stream [--ts] [--fragment seconds] <in>
+*/
+static int benchStream(int argc, char** argv)
+{
+    StreamingOptions options;
+    const char* file = nullptr;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--ts") == 0)
+            options.format = StreamFormat::MPEGTS;
+        else if (strcmp(argv[i], "--fragment") == 0 && i + 1 < argc)
+            options.fragment_duration = (int64_t)(atof(argv[++i]) * AV_TIME_BASE);
+        else
+            file = argv[i];
+    }
+    if (!file)
+    {
+        printf("usage: Benchmarks stream [--ts] [--fragment seconds] <in>\n");
+        return 1;
+    }
+
+    auto start = BenchClock::now();
+    double first_ms = -1.0;
+    int fragments = 0;
+    size_t bytes = 0;
+    size_t largest = 0;
+    options.on_fragment = [&](const uint8_t*, size_t size, const FragmentInfo& info)
+    {
+        if (!info.init && first_ms < 0 && size > 0)
+            first_ms = elapsedMs(start);
+        fragments += info.init ? 0 : 1;
+        bytes += size;
+        largest = (std::max)(largest, size);
+        return true;
+    };
+
+    CMediaConverter converter;
+    MediaReaderState state;
+    ErrorCode ret = converter.encodeMedia(file, options, &state);
+    double ms = elapsedMs(start);
+
+    printf("stream %s: %s, %d fragments, %.2f MB (largest %.1f KB), first fragment after %.1f ms, done in %.1f ms (error %d)\n",
+        options.format == StreamFormat::MPEGTS ? "mpegts" : "fmp4", file, fragments, bytes / 1048576.0, largest / 1024.0,
+        first_ms, ms, (int)ret);
+    return ret == ErrorCode::SUCCESS ? 0 : 1;
+}
+
+/*
+* remuxes the same file through ffmpeg's file protocol and through a memory mapping, alternating so both see
+* the same page cache, and reports throughput with the process' read calls and page faults for each
+* usage: Benchmarks mmap <in> <out> [iterations]
+*/
+static int benchMmap(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: Benchmarks mmap <in> <out> [iterations]\n");
+        return 1;
+    }
+    const char* in = argv[0];
+    const char* out = argv[1];
+    int iterations = argc > 2 ? (std::max)(1, atoi(argv[2])) : 5;
+
+    std::ifstream file(in, std::ios::binary | std::ios::ate);
+    double file_mb = file ? (int64_t)file.tellg() / 1048576.0 : 0.0;
+
+    struct Totals
+    {
+        double ms = 0.0;
+        int64_t read_syscalls = 0;
+        int64_t page_faults = 0;
+    } totals[2];
+
+    CMediaConverter converter;
+    MediaInput mapped = MediaInput::FromMappedFile(in);
+    for (int i = 0; i < iterations; ++i)
+    {
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            MediaReaderState state;
+            ProcessIoCounters before = ProcessIoCounters::Sample();
+            auto start = BenchClock::now();
+            ErrorCode ret = mode == 0 ? converter.encodeMedia(in, out, TrimOptions(), &state) : converter.encodeMedia(mapped, out, TrimOptions(), &state);
+            totals[mode].ms += elapsedMs(start);
+            ProcessIoCounters after = ProcessIoCounters::Sample();
+            if (ret != ErrorCode::SUCCESS)
+            {
+                printf("%s remux failed (error %d)\n", mode == 0 ? "file" : "mmap", (int)ret);
+                return 1;
+            }
+            totals[mode].read_syscalls += after.read_syscalls - before.read_syscalls;
+            totals[mode].page_faults += after.page_faults - before.page_faults;
+        }
+    }
+
+    //the read calls include the ones the output makes, mmap's difference is what the input no longer does
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        double ms = totals[mode].ms / iterations;
+        printf("%s: %.2f MB in %.1f ms (%.1f MB/s), %lld read calls, %lld page faults per remux\n",
+            mode == 0 ? "file" : "mmap", file_mb, ms, ms > 0 ? file_mb / (ms / 1000.0) : 0.0,
+            (long long)(totals[mode].read_syscalls / iterations), (long long)(totals[mode].page_faults / iterations));
+    }
+
+    InputStats stats = mapped.Stats();
+    printf("mmap input: %lld reads, %lld seeks (%lld far), %lld advise calls over %d remuxes\n",
+        (long long)stats.reads, (long long)stats.seeks, (long long)stats.far_seeks, (long long)stats.advise_calls, iterations);
+    return 0;
+}
+
+/*
+* metadata for a list of files, probed on the worker pool and then again to show what a re-scan costs once
+* everything is cached. --cache keeps the cache on disk so the next run starts warm, --stream-info also runs
+* avformat_find_stream_info per file
+* usage: Benchmarks probe [--cache file] [--threads N] [--stream-info] <file> [file...]
+*/
+static int benchProbe(int argc, char** argv)
+{
+    ProbeOptions options;
+    std::vector<std::string> files;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            options.cache_path = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            options.threads = (size_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stream-info") == 0)
+            options.find_stream_info = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        printf("usage: Benchmarks probe [--cache file] [--threads N] [--stream-info] <file> [file...]\n");
+        return 1;
+    }
+
+    MediaProbe probe(options);
+    std::vector<MediaInfo> results;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        ProbeStats stats = probe.Run(files, results);
+        printf("pass %d: %zu files in %.2f ms (%.3f ms/file), %zu cached, %zu probed, %zu failed\n", pass + 1, stats.files,
+            stats.wall_ms, stats.files ? stats.wall_ms / stats.files : 0.0, stats.cached, stats.probed, stats.failed);
+    }
+
+    const MediaInfo& first = results.front();
+    printf("%s: %s, %.2f s, %dx%d %s @ %.3f fps, %s %d Hz %d ch, %lld kb/s (error %d)\n", first.path.c_str(),
+        first.format_name.c_str(), first.duration / (double)AV_TIME_BASE, first.width, first.height, first.video_codec.c_str(),
+        first.fps, first.audio_codec.c_str(), first.sample_rate, first.channels, (long long)(first.bit_rate / 1000), (int)first.error);
+    return 0;
+}
+
+/*
+* runs R readers at once, each on its own thread decoding up to N frames of the file, for every R and
+* per-decoder thread count t in powers of two, and prints the aggregate frames/sec grid. the last column
+* is the same readers taking their threads from ThreadBudget instead of a fixed count.
+* --low-latency and --slice set the tuning and threading type every reader opens with
+* usage: Benchmarks threads [--max-readers N] [--frames N] [--low-latency] [--slice] <file>
+*/
+static int benchThreads(int argc, char** argv)
+{
+    int maxReaders = 32;
+    int frames = 300;
+    const char* file = nullptr;
+    DecodeThreading threading;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--max-readers") == 0 && i + 1 < argc)
+            maxReaders = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--low-latency") == 0)
+            threading.tuning = DecodeTuning::LowLatency;
+        else if (strcmp(argv[i], "--slice") == 0)
+            threading.type = ThreadType::Slice;
+        else
+            file = argv[i];
+    }
+    if (!file)
+    {
+        printf("usage: Benchmarks threads [--max-readers N] [--frames N] [--low-latency] [--slice] <file>\n");
+        return 1;
+    }
+
+    int hardware = (std::max)(1, (int)std::thread::hardware_concurrency());
+    //0 threads = use the budget
+    auto run = [&](int readers, int threads)
+    {
+        OpenOptions options;
+        options.streams = StreamSelection::Video;
+        options.pool_decoders = false;
+        options.threading = threading;
+        options.threading.threads = threads;
+        options.threading.use_budget = threads == 0;
+        ThreadBudget::Instance().SetExpectedDecoders(readers);
+
+        std::atomic<int64_t> decoded(0);
+        std::vector<std::thread> workers;
+        auto start = BenchClock::now();
+        for (int r = 0; r < readers; ++r)
+        {
+            workers.emplace_back([&]()
+            {
+                CMediaConverter converter;
+                MediaReaderState state;
+                if (converter.openVideoReader(&state, file, options) != ErrorCode::SUCCESS)
+                    return;
+                FrameHandle frame;
+                for (int f = 0; f < frames && converter.readVideoFrame(&state, frame) == ErrorCode::SUCCESS; ++f)
+                    ++decoded;
+                frame.Reset();
+                converter.closeVideoReader(&state);
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        double ms = elapsedMs(start);
+        ThreadBudget::Instance().SetExpectedDecoders(1);
+        return ms > 0 ? decoded * 1000.0 / ms : 0.0;
+    };
+
+    printf("aggregate frames/sec, %s, %s threading\n", threading.tuning == DecodeTuning::LowLatency ? "low latency" : "throughput",
+        threading.type == ThreadType::Slice ? "slice" : "auto");
+    printf("readers");
+    for (int t = 1; t <= hardware; t *= 2)
+        printf("  %6dt", t);
+    printf("   budget\n");
+
+    for (int readers = 1; readers <= (std::max)(1, maxReaders); readers *= 2)
+    {
+        printf("%7d", readers);
+        for (int t = 1; t <= hardware; t *= 2)
+            printf("  %7.1f", run(readers, t));
+        printf("  %7.1f\n", run(readers, 0));
+    }
+
+    ThreadBudgetStats stats = ThreadBudget::Instance().Stats();
+    printf("budget: %d threads, %lld grants, %lld reduced\n", stats.total, (long long)stats.grants, (long long)stats.reduced);
+    return 0;
+}
+
+/*
+* decodes the whole file through readVideoFrame (and readAudioFrame with --audio) and prints count, mean,
+* p50/p95/p99 and max for every decode stage. needs a dll built with MEDIACONVERTER_STAGE_TIMING=1
+* usage: Benchmarks stages [--audio] <file>
+*/
+static int benchStages(int argc, char** argv)
+{
+    bool audio = hasFlag(argc, argv, "--audio");
+    const char* file = nullptr;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            file = argv[i];
+    }
+    if (!file)
+    {
+        printf("usage: Benchmarks stages [--audio] <file>\n");
+        return 1;
+    }
+    if (!StageTimings::Enabled())
+    {
+        printf("stage timing is compiled out, rebuild MediaConverter with MEDIACONVERTER_STAGE_TIMING=1\n");
+        return 1;
+    }
+
+    CMediaConverter converter;
+    MediaReaderState state;
+    if (converter.openVideoReader(&state, file) != ErrorCode::SUCCESS)
+    {
+        printf("unable to open %s\n", file);
+        return 1;
+    }
+
+    std::vector<uint8_t> video;
+    std::vector<uint8_t> samples;
+    int64_t frames = 0;
+    auto start = BenchClock::now();
+    while (converter.readVideoFrame(&state, video) == ErrorCode::SUCCESS)
+        ++frames;
+    if (audio && state.HasAudioStream())
+    {
+        converter.seekToAudioStart(&state);
+        while (converter.readAudioFrame(&state, samples) == ErrorCode::SUCCESS)
+            ++frames;
+    }
+    double ms = elapsedMs(start);
+
+    printf("%lld frames in %.1f ms\n", (long long)frames, ms);
+    printf("%-20s %10s %10s %10s %10s %10s %10s %8s\n", "stage", "count", "mean us", "p50 us", "p95 us", "p99 us", "max us", "share");
+    const StageTimings* timings = state.Timings();
+    for (int i = 0; i < (int)Stage::Count; ++i)
+    {
+        StageStats stats = timings->Stats((Stage)i);
+        if (stats.count == 0)
+            continue;
+        printf("%-20s %10lld %10.1f %10.1f %10.1f %10.1f %10.1f %7.1f%%\n", StageTimings::Name((Stage)i), (long long)stats.count,
+            stats.MeanNs() / 1000.0, stats.p50_ns / 1000.0, stats.p95_ns / 1000.0, stats.p99_ns / 1000.0, stats.max_ns / 1000.0,
+            ms > 0 ? stats.total_ns / 1e4 / ms : 0.0);
+    }
+
+    converter.closeVideoReader(&state);
+    return 0;
+}
+
+//yuv420p/nv12 test frame with gradients in every plane so the conversion isn't working on flat color
+static AVFrame* makeTestFrame(int width, int height, AVPixelFormat format = AV_PIX_FMT_YUV420P)
+{
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 32) < 0)
+    {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+            frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y * 3);
+    }
+    for (int y = 0; y < height / 2; ++y)
+    {
+        for (int x = 0; x < width / 2; ++x)
+        {
+            uint8_t u = (uint8_t)(128 + y + x * 2);
+            uint8_t v = (uint8_t)(64 + x + y * 5);
+            if (format == AV_PIX_FMT_NV12)
+            {
+                frame->data[1][y * frame->linesize[1] + x * 2] = u;
+                frame->data[1][y * frame->linesize[1] + x * 2 + 1] = v;
+            }
+            else
+            {
+                frame->data[1][y * frame->linesize[1] + x] = u;
+                frame->data[2][y * frame->linesize[2] + x] = v;
+            }
+        }
+    }
+    return frame;
+}
+
+/*
+* same-size yuv420p -> RGB0 conversion at 1080p/4k/8k for 1..N slice threads
+* usage: Benchmarks slices [frames]
+*/
+static int benchSlices(int argc, char** argv)
+{
+    int frames = argc > 0 ? atoi(argv[0]) : 30;
+    if (frames <= 0)
+        frames = 30;
+
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 } };
+    size_t maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+
+    for (auto& size : sizes)
+    {
+        AVFrame* frame = makeTestFrame(size[0], size[1]);
+        if (!frame)
+            return 1;
+
+        ScalerKey key;
+        key.src_width = key.dst_width = size[0];
+        key.src_height = key.dst_height = size[1];
+        key.src_fmt = AV_PIX_FMT_YUV420P;
+        key.dst_fmt = AV_PIX_FMT_RGB0;
+        key.flags = SWS_BILINEAR;
+
+        std::vector<uint8_t> reference((size_t)size[0] * size[1] * 4);
+        std::vector<uint8_t> output(reference.size());
+        int linesize[4] = { size[0] * 4, 0, 0, 0 };
+        uint8_t* ref_planes[4] = { reference.data(), nullptr, nullptr, nullptr };
+        uint8_t* out_planes[4] = { output.data(), nullptr, nullptr, nullptr };
+
+        double baseline = 0.0;
+        for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            SliceScaler scaler(threads);
+            scaler.Scale(frame, threads == 1 ? ref_planes : out_planes, linesize, key); //warm up + exactness check
+
+            auto start = BenchClock::now();
+            for (int i = 0; i < frames; ++i)
+                scaler.Scale(frame, threads == 1 ? ref_planes : out_planes, linesize, key);
+            double perFrame = elapsedMs(start) / frames;
+            if (threads == 1)
+                baseline = perFrame;
+
+            bool identical = threads == 1 || memcmp(reference.data(), output.data(), reference.size()) == 0;
+            printf("slices %dx%d threads %zu: %.2f ms/frame, %.2fx, %s, %s\n", size[0], size[1], threads, perFrame,
+                perFrame > 0 ? baseline / perFrame : 0.0, scaler.SlicedFrames() > 0 ? "sliced" : "serial",
+                identical ? "identical" : "MISMATCH");
+        }
+        av_frame_free(&frame);
+    }
+    return 0;
+}
+
+/*
+* same-size yuv420p/nv12 -> RGB0 throughput for swscale and each ColorConverter kernel the cpu supports
+* usage: Benchmarks color [frames]
+*/
+static int benchColor(int argc, char** argv)
+{
+    int frames = argc > 0 ? atoi(argv[0]) : 100;
+    if (frames <= 0)
+        frames = 100;
+
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    const AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+    const ColorKernel kernels[] = { ColorKernel::Scalar, ColorKernel::SSE2, ColorKernel::AVX2 };
+
+    for (auto& size : sizes)
+    {
+        for (AVPixelFormat format : formats)
+        {
+            AVFrame* frame = makeTestFrame(size[0], size[1], format);
+            if (!frame)
+                return 1;
+
+            std::vector<uint8_t> output((size_t)size[0] * size[1] * 4);
+            double pixels = (double)size[0] * size[1] * frames;
+            const char* name = format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p";
+
+            ScalerKey key;
+            key.src_width = key.dst_width = size[0];
+            key.src_height = key.dst_height = size[1];
+            key.src_fmt = format;
+            key.dst_fmt = AV_PIX_FMT_RGB0;
+            key.flags = SWS_BILINEAR;
+
+            ScalerCache cache;
+            SwsContext* ctx = cache.Get(key);
+            uint8_t* planes[4] = { output.data(), nullptr, nullptr, nullptr };
+            int linesize[4] = { size[0] * 4, 0, 0, 0 };
+
+            auto start = BenchClock::now();
+            for (int i = 0; i < frames && ctx; ++i)
+                sws_scale(ctx, frame->data, frame->linesize, 0, size[1], planes, linesize);
+            double ms = elapsedMs(start);
+            printf("color %dx%d %s swscale: %.1f Mpixels/s\n", size[0], size[1], name, ms > 0 ? pixels / ms / 1000.0 : 0.0);
+
+            for (ColorKernel kernel : kernels)
+            {
+                if (!ColorConverter::KernelSupported(kernel))
+                    continue;
+
+                start = BenchClock::now();
+                for (int i = 0; i < frames; ++i)
+                    ColorConverter::ToRGB0(frame, output.data(), size[0] * 4, ColorMatrix::BT601, ColorRange::Limited, kernel);
+                ms = elapsedMs(start);
+                printf("color %dx%d %s %s: %.1f Mpixels/s\n", size[0], size[1], name, ColorConverter::KernelName(kernel),
+                    ms > 0 ? pixels / ms / 1000.0 : 0.0);
+            }
+            av_frame_free(&frame);
+        }
+    }
+    return 0;
+}
+
+//sends frame (null flushes) and writes whatever the encoder hands back
+static bool encodeAndWrite(AVFormatContext* out_ctx, AVCodecContext* enc, AVStream* stream, AVFrame* frame)
+{
+    if (avcodec_send_frame(enc, frame) < 0)
+        return false;
+
+    AVPacket* pkt = av_packet_alloc();
+    while (avcodec_receive_packet(enc, pkt) >= 0)
+    {
+        av_packet_rescale_ts(pkt, enc->time_base, stream->time_base);
+        pkt->stream_index = stream->index;
+        av_interleaved_write_frame(out_ctx, pkt);
+    }
+    av_packet_free(&pkt);
+    return true;
+}
+
+//what generateTestAsset writes, every field is fixed per asset so two runs produce the same file
+struct TestAssetSpec
+{
+    int seconds = 10;
+    int width = 320;
+    int height = 180;
+    int fps = 25;
+    int gop = 50; //frames between keyframes, 1 for intra only
+    AVCodecID video_codec = AV_CODEC_ID_MPEG4;
+    int64_t video_bit_rate = 1000000;
+    AVCodecID audio_codec = AV_CODEC_ID_AAC; //AV_CODEC_ID_NONE for a silent clip
+    int sample_rate = 48000;
+    int channels = 2;
+};
+
+//sample n of a 440hz tone in whatever layout the encoder wants
+static void fillTone(AVFrame* frame, int64_t firstSample, int sampleRate)
+{
+    AVSampleFormat format = (AVSampleFormat)frame->format;
+    bool planar = av_sample_fmt_is_planar(format) != 0;
+    int channels = frame->channels;
+    for (int i = 0; i < frame->nb_samples; ++i)
+    {
+        double value = 0.25 * sin(2.0 * 3.14159265358979 * 440.0 * (firstSample + i) / sampleRate);
+        for (int c = 0; c < channels; ++c)
+        {
+            uint8_t* plane = frame->data[planar ? c : 0];
+            int index = planar ? i : i * channels + c;
+            switch (av_get_packed_sample_fmt(format))
+            {
+            case AV_SAMPLE_FMT_FLT: ((float*)plane)[index] = (float)value; break;
+            case AV_SAMPLE_FMT_DBL: ((double*)plane)[index] = value; break;
+            case AV_SAMPLE_FMT_S16: ((int16_t*)plane)[index] = (int16_t)(value * INT16_MAX); break;
+            case AV_SAMPLE_FMT_S32: ((int32_t*)plane)[index] = (int32_t)(value * INT32_MAX); break;
+            default: plane[index] = (uint8_t)(128 + value * 127); break;
+            }
+        }
+    }
+}
+
+/*
+* writes a synthetic clip so the long running benchmarks don't need test media checked in: a scrolling
+* gradient and a 440hz tone. encoders run single threaded with the bitexact flags so the same spec always
+* gives the same bytes for a given ffmpeg build
+*/
+static bool generateTestAsset(const char* path, const TestAssetSpec& spec)
+{
+    AVFormatContext* out_ctx = nullptr;
+    avformat_alloc_output_context2(&out_ctx, nullptr, nullptr, path);
+    AVCodec* video_codec = avcodec_find_encoder(spec.video_codec);
+    AVCodec* audio_codec = spec.audio_codec != AV_CODEC_ID_NONE ? avcodec_find_encoder(spec.audio_codec) : nullptr;
+    if (!out_ctx || !video_codec || (spec.audio_codec != AV_CODEC_ID_NONE && !audio_codec))
+    {
+        avformat_free_context(out_ctx);
+        return false;
+    }
+    out_ctx->flags |= AVFMT_FLAG_BITEXACT;
+
+    AVCodecContext* venc = avcodec_alloc_context3(video_codec);
+    venc->width = spec.width;
+    venc->height = spec.height;
+    venc->pix_fmt = video_codec->pix_fmts ? video_codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    venc->time_base = AVRational{ 1, spec.fps };
+    venc->framerate = AVRational{ spec.fps, 1 };
+    venc->gop_size = spec.gop;
+    if (spec.gop <= 1)
+        venc->max_b_frames = 0;
+    venc->bit_rate = spec.video_bit_rate;
+    venc->thread_count = 1;
+    venc->flags |= AV_CODEC_FLAG_BITEXACT;
+
+    AVCodecContext* aenc = audio_codec ? avcodec_alloc_context3(audio_codec) : nullptr;
+    if (aenc)
+    {
+        aenc->sample_fmt = audio_codec->sample_fmts ? audio_codec->sample_fmts[0] : AV_SAMPLE_FMT_S16;
+        aenc->sample_rate = spec.sample_rate;
+        aenc->channels = spec.channels;
+        aenc->channel_layout = av_get_default_channel_layout(spec.channels);
+        aenc->bit_rate = 64000 * spec.channels;
+        aenc->time_base = AVRational{ 1, aenc->sample_rate };
+        aenc->thread_count = 1;
+        aenc->flags |= AV_CODEC_FLAG_BITEXACT;
+    }
+
+    if (out_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        venc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        if (aenc)
+            aenc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    bool ok = avcodec_open2(venc, video_codec, nullptr) >= 0 && (!aenc || avcodec_open2(aenc, audio_codec, nullptr) >= 0);
+    AVStream* vstream = ok ? avformat_new_stream(out_ctx, nullptr) : nullptr;
+    AVStream* astream = ok && aenc ? avformat_new_stream(out_ctx, nullptr) : nullptr;
+    ok = vstream && (!aenc || astream) && avcodec_parameters_from_context(vstream->codecpar, venc) >= 0 &&
+        (!aenc || avcodec_parameters_from_context(astream->codecpar, aenc) >= 0);
+    if (ok)
+    {
+        vstream->time_base = venc->time_base;
+        if (astream)
+            astream->time_base = aenc->time_base;
+        ok = avio_open(&out_ctx->pb, path, AVIO_FLAG_WRITE) >= 0 && avformat_write_header(out_ctx, nullptr) >= 0;
+    }
+
+    AVFrame* picture = ok ? makeTestFrame(spec.width, spec.height, venc->pix_fmt) : nullptr;
+    AVFrame* samples = av_frame_alloc();
+    if (aenc)
+    {
+        samples->format = aenc->sample_fmt;
+        samples->channel_layout = aenc->channel_layout;
+        samples->channels = aenc->channels;
+        samples->sample_rate = aenc->sample_rate;
+        //pcm encoders take any frame size
+        samples->nb_samples = aenc->frame_size > 0 ? aenc->frame_size : 1024;
+        ok = ok && av_frame_get_buffer(samples, 0) >= 0;
+    }
+    ok = ok && picture;
+
+    int64_t video_frames = (int64_t)spec.seconds * spec.fps;
+    int64_t audio_samples = aenc ? (int64_t)spec.seconds * aenc->sample_rate : 0;
+    int64_t next_video = 0;
+    int64_t next_sample = 0;
+    while (ok && (next_video < video_frames || next_sample < audio_samples))
+    {
+        //keep the two streams roughly in step so the muxer doesn't have to buffer much
+        bool video_turn = next_sample >= audio_samples ||
+            (next_video < video_frames && av_compare_ts(next_video, venc->time_base, next_sample, aenc->time_base) <= 0);
+        if (video_turn)
+        {
+            ok = av_frame_make_writable(picture) >= 0;
+            for (int y = 0; ok && y < spec.height; ++y)
+            {
+                for (int x = 0; x < spec.width; ++x)
+                    picture->data[0][y * picture->linesize[0] + x] = (uint8_t)(x + y * 3 + next_video * 2);
+            }
+            picture->pts = next_video++;
+            ok = ok && encodeAndWrite(out_ctx, venc, vstream, picture);
+        }
+        else
+        {
+            ok = av_frame_make_writable(samples) >= 0;
+            if (ok)
+                fillTone(samples, next_sample, aenc->sample_rate);
+            samples->pts = next_sample;
+            next_sample += samples->nb_samples;
+            ok = ok && encodeAndWrite(out_ctx, aenc, astream, samples);
+        }
+    }
+
+    if (ok)
+    {
+        encodeAndWrite(out_ctx, venc, vstream, nullptr);
+        if (aenc)
+            encodeAndWrite(out_ctx, aenc, astream, nullptr);
+        av_write_trailer(out_ctx);
+    }
+
+    av_frame_free(&picture);
+    av_frame_free(&samples);
+    avcodec_free_context(&venc);
+    avcodec_free_context(&aenc);
+    avio_closep(&out_ctx->pb);
+    avformat_free_context(out_ctx);
+    return ok;
+}
+
+//mpeg4 with a keyframe every 2 seconds and aac, what the single file benchmarks use
+static bool generateTestAsset(const char* path, int seconds, int width, int height, int fps)
+{
+    TestAssetSpec spec;
+    spec.seconds = seconds;
+    spec.width = width;
+    spec.height = height;
+    spec.fps = fps;
+    spec.gop = fps * 2;
+    return generateTestAsset(path, spec);
+}
+
+//one generated clip in the suite, the name doubles as the file name and the key in the results
+struct SuiteAsset
+{
+    const char* name;
+    TestAssetSpec spec;
+};
+
+struct SuiteResult
+{
+    std::string name;
+    std::string error; //empty when every measurement ran
+    int64_t file_bytes = 0;
+    double open_avg_ms = 0.0;
+    double open_p50_ms = 0.0;
+    double open_max_ms = 0.0;
+    double first_frame_avg_ms = 0.0; //read of the first frame after the open
+    int64_t decoded_frames = 0;
+    double decode_fps = 0.0;
+    int seeks = 0;
+    double seek_avg_ms = 0.0;
+    double seek_p50_ms = 0.0;
+    double seek_p95_ms = 0.0;
+    double seek_max_ms = 0.0;
+    int64_t audio_samples = 0;
+    double audio_realtime = 0.0; //seconds of audio decoded per second
+    double remux_ms = 0.0;
+    double remux_mb_s = 0.0;
+};
+
+static std::vector<SuiteAsset> suiteAssets(int seconds)
+{
+    std::vector<SuiteAsset> assets;
+    auto add = [&](const char* name, int width, int height, int fps, int gop, AVCodecID video, int64_t bitRate,
+        AVCodecID audio, int sampleRate, int channels)
+    {
+        SuiteAsset asset;
+        asset.name = name;
+        asset.spec.seconds = seconds;
+        asset.spec.width = width;
+        asset.spec.height = height;
+        asset.spec.fps = fps;
+        asset.spec.gop = gop;
+        asset.spec.video_codec = video;
+        asset.spec.video_bit_rate = bitRate;
+        asset.spec.audio_codec = audio;
+        asset.spec.sample_rate = sampleRate;
+        asset.spec.channels = channels;
+        assets.push_back(asset);
+    };
+    add("mpeg4_360p_gop50_aac", 640, 360, 25, 50, AV_CODEC_ID_MPEG4, 1000000, AV_CODEC_ID_AAC, 48000, 2);
+    add("mpeg4_720p_gop250_ac3", 1280, 720, 30, 250, AV_CODEC_ID_MPEG4, 3000000, AV_CODEC_ID_AC3, 44100, 2);
+    add("mpeg2_1080p_gop15_mp2", 1920, 1080, 25, 15, AV_CODEC_ID_MPEG2VIDEO, 8000000, AV_CODEC_ID_MP2, 44100, 2);
+    add("mjpeg_480p_intra_pcm", 848, 480, 25, 1, AV_CODEC_ID_MJPEG, 8000000, AV_CODEC_ID_PCM_S16LE, 48000, 1);
+    //only with an ffmpeg built with an h264 encoder, skipped otherwise
+    add("h264_720p_gop60_aac", 1280, 720, 30, 60, AV_CODEC_ID_H264, 3000000, AV_CODEC_ID_AAC, 48000, 2);
+    return assets;
+}
+
+static double percentile(std::vector<double> values, double rank)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(rank * (values.size() - 1) + 0.5);
+    return values[(std::min)(index, values.size() - 1)];
+}
+
+static double average(const std::vector<double>& values)
+{
+    double total = 0.0;
+    for (double value : values)
+        total += value;
+    return values.empty() ? 0.0 : total / values.size();
+}
+
+static void measureAsset(const SuiteAsset& asset, const std::string& path, const std::string& remuxPath,
+    int iterations, int seekCount, SuiteResult& result)
+{
+    CMediaConverter converter;
+    result.name = asset.name;
+    std::ifstream sizeCheck(path, std::ios::binary | std::ios::ate);
+    result.file_bytes = sizeCheck ? (int64_t)sizeCheck.tellg() : 0;
+
+    //open latency, fresh decoders every time so it's the cold open a new file pays
+    OpenOptions options;
+    options.pool_decoders = false;
+    std::vector<double> opens, firstFrames;
+    for (int i = 0; i < iterations; ++i)
+    {
+        MediaReaderState state;
+        FrameHandle frame;
+        auto start = BenchClock::now();
+        if (converter.openVideoReader(&state, path.c_str(), options) != ErrorCode::SUCCESS)
+        {
+            result.error = "open failed";
+            return;
+        }
+        opens.push_back(elapsedMs(start));
+        start = BenchClock::now();
+        converter.readVideoFrame(&state, frame);
+        firstFrames.push_back(elapsedMs(start));
+        frame.Reset();
+        converter.closeVideoReader(&state);
+    }
+    result.open_avg_ms = average(opens);
+    result.open_p50_ms = percentile(opens, 0.5);
+    result.open_max_ms = percentile(opens, 1.0);
+    result.first_frame_avg_ms = average(firstFrames);
+
+    //sequential decode, no conversion
+    {
+        MediaReaderState state;
+        converter.openVideoReader(&state, path.c_str());
+        FrameHandle frame;
+        auto start = BenchClock::now();
+        while (converter.readVideoFrame(&state, frame) == ErrorCode::SUCCESS)
+            ++result.decoded_frames;
+        double ms = elapsedMs(start);
+        result.decode_fps = ms > 0 ? result.decoded_frames * 1000.0 / ms : 0.0;
+        frame.Reset();
+        converter.closeVideoReader(&state);
+    }
+
+    //random access, the same targets every run
+    {
+        MediaReaderState state;
+        converter.openVideoReader(&state, path.c_str());
+        int64_t frames = (int64_t)asset.spec.seconds * asset.spec.fps;
+        int64_t first = state.VideoStartTime() != AV_NOPTS_VALUE ? state.VideoStartTime() : 0;
+        uint32_t seed = 12345;
+        std::vector<double> seeks;
+        for (int i = 0; i < seekCount && frames > 0; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int64_t target = first + (int64_t)(seed % (uint32_t)frames) * state.VideoFrameInterval();
+            auto start = BenchClock::now();
+            converter.trackToFrame(&state, target);
+            seeks.push_back(elapsedMs(start));
+        }
+        result.seeks = (int)seeks.size();
+        result.seek_avg_ms = average(seeks);
+        result.seek_p50_ms = percentile(seeks, 0.5);
+        result.seek_p95_ms = percentile(seeks, 0.95);
+        result.seek_max_ms = percentile(seeks, 1.0);
+        converter.closeVideoReader(&state);
+    }
+
+    //audio decode + resample to the reader's output format
+    if (asset.spec.audio_codec != AV_CODEC_ID_NONE)
+    {
+        MediaReaderState state;
+        converter.openVideoReader(&state, path.c_str());
+        std::vector<uint8_t> samples;
+        auto start = BenchClock::now();
+        while (state.HasAudioStream() && converter.readAudioFrame(&state, samples) == ErrorCode::SUCCESS)
+            result.audio_samples += state.NumSamples();
+        double ms = elapsedMs(start);
+        if (ms > 0 && asset.spec.sample_rate > 0)
+            result.audio_realtime = result.audio_samples / (double)asset.spec.sample_rate / (ms / 1000.0);
+        converter.closeVideoReader(&state);
+    }
+
+    //remux throughput, input bytes over wall time
+    {
+        auto start = BenchClock::now();
+        ErrorCode ret = converter.encodeMedia(path.c_str(), remuxPath.c_str());
+        result.remux_ms = elapsedMs(start);
+        if (ret != ErrorCode::SUCCESS)
+            result.error = "remux failed";
+        else if (result.remux_ms > 0)
+            result.remux_mb_s = result.file_bytes / 1e6 / (result.remux_ms / 1000.0);
+        std::remove(remuxPath.c_str());
+    }
+}
+
+static void writeSuiteJson(FILE* out, const std::vector<SuiteResult>& results, int seconds, int iterations, int seeks)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"suite_version\": 2,\n");
+    fprintf(out, "  \"ffmpeg\": \"%s\",\n", av_version_info());
+    fprintf(out, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(out, "  \"seconds\": %d,\n", seconds);
+    fprintf(out, "  \"iterations\": %d,\n", iterations);
+    fprintf(out, "  \"seek_targets\": %d,\n", seeks);
+    //the high water mark is process wide and never goes down, per asset it would only ever show the worst asset so far
+    fprintf(out, "  \"peak_rss_bytes\": %lld,\n", (long long)ProcessIoCounters::Sample().peak_rss);
+    fprintf(out, "  \"assets\": [");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SuiteResult& r = results[i];
+        fprintf(out, "%s\n    {\n", i > 0 ? "," : "");
+        fprintf(out, "      \"name\": \"%s\",\n", r.name.c_str());
+        fprintf(out, "      \"error\": \"%s\",\n", r.error.c_str());
+        fprintf(out, "      \"file_bytes\": %lld,\n", (long long)r.file_bytes);
+        fprintf(out, "      \"open_ms\": { \"avg\": %.3f, \"p50\": %.3f, \"max\": %.3f },\n", r.open_avg_ms, r.open_p50_ms, r.open_max_ms);
+        fprintf(out, "      \"first_frame_ms\": %.3f,\n", r.first_frame_avg_ms);
+        fprintf(out, "      \"decode\": { \"frames\": %lld, \"fps\": %.1f },\n", (long long)r.decoded_frames, r.decode_fps);
+        fprintf(out, "      \"seek_ms\": { \"count\": %d, \"avg\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f },\n",
+            r.seeks, r.seek_avg_ms, r.seek_p50_ms, r.seek_p95_ms, r.seek_max_ms);
+        fprintf(out, "      \"audio\": { \"samples\": %lld, \"realtime\": %.1f },\n", (long long)r.audio_samples, r.audio_realtime);
+        fprintf(out, "      \"remux\": { \"ms\": %.1f, \"mb_per_s\": %.1f }\n", r.remux_ms, r.remux_mb_s);
+        fprintf(out, "    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+/*
+* the regression suite: generates a fixed set of clips (codecs, resolutions, gop lengths and audio formats)
+* into --dir the first time, then measures open latency, sequential decode fps, trackToFrame latency on
+* fixed random targets, audio decode speed, remux MB/s for each, plus the run's peak RSS, and writes it all as JSON.
+* keys and targets don't change between runs so two result files can be diffed directly. --dir has to exist
+* usage: Benchmarks suite [--dir D] [--json file] [--seconds N] [--iterations N] [--seeks N] [--regenerate]
+*/
+static int benchSuite(int argc, char** argv)
+{
+    std::string dir = "bench_media";
+    const char* json = "bench_results.json";
+    int seconds = 10;
+    int iterations = 20;
+    int seeks = 50;
+    bool regenerate = false;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = (std::max)(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = (std::max)(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seeks") == 0 && i + 1 < argc)
+            seeks = (std::max)(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--regenerate") == 0)
+            regenerate = true;
+        else
+        {
+            printf("usage: Benchmarks suite [--dir D] [--json file] [--seconds N] [--iterations N] [--seeks N] [--regenerate]\n");
+            return 1;
+        }
+    }
+
+    std::vector<SuiteResult> results;
+    for (const SuiteAsset& asset : suiteAssets(seconds))
+    {
+        //the clip length is part of the name on disk so changing --seconds doesn't reuse a stale file
+        std::string path = dir + "/" + asset.name + "_" + std::to_string(seconds) + "s.mkv";
+        std::string remuxPath = dir + "/" + asset.name + "_remux.mkv";
+        SuiteResult result;
+        result.name = asset.name;
+
+        if (!avcodec_find_encoder(asset.spec.video_codec) ||
+            (asset.spec.audio_codec != AV_CODEC_ID_NONE && !avcodec_find_encoder(asset.spec.audio_codec)))
+        {
+            printf("%-24s skipped, no encoder in this ffmpeg build\n", asset.name);
+            continue;
+        }
+        if (regenerate || !std::ifstream(path))
+        {
+            printf("%-24s generating %s\n", asset.name, path.c_str());
+            if (!generateTestAsset(path.c_str(), asset.spec))
+            {
+                result.error = "generate failed";
+                results.push_back(result);
+                continue;
+            }
+        }
+
+        measureAsset(asset, path, remuxPath, iterations, seeks, result);
+        printf("%-24s open %.2f ms, decode %.1f fps, seek p50 %.2f ms, audio %.1fx, remux %.1f MB/s%s%s\n", asset.name,
+            result.open_avg_ms, result.decode_fps, result.seek_p50_ms, result.audio_realtime, result.remux_mb_s,
+            result.error.empty() ? "" : ", ", result.error.c_str());
+        results.push_back(result);
+    }
+
+    FILE* out = fopen(json, "w");
+    if (!out)
+    {
+        printf("unable to write %s\n", json);
+        return 1;
+    }
+    writeSuiteJson(out, results, seconds, iterations, seeks);
+    fclose(out);
+    printf("results written to %s\n", json);
+    return 0;
+}
+
+/*
+* the same fixed random targets through trackToFrame and seekExact (converted to RGB0 both ways), with the
+* frames seekExact had to decode and throw away per target. --index builds the frame index first so both
+* start from the right keyframe
+* usage: Benchmarks seek [--count N] [--skip-nonref] [--skip-loop-filter] [--index] <file>
+*/
+static int benchSeek(int argc, char** argv)
+{
+    int count = 100;
+    const char* file = nullptr;
+    ExactSeekOptions seekOptions;
+    OpenOptions openOptions;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = (std::max)(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--skip-nonref") == 0)
+            seekOptions.skip_nonref = true;
+        else if (strcmp(argv[i], "--skip-loop-filter") == 0)
+            seekOptions.skip_loop_filter = true;
+        else if (strcmp(argv[i], "--index") == 0)
+            openOptions.build_index = true;
+        else
+            file = argv[i];
+    }
+    if (!file)
+    {
+        printf("usage: Benchmarks seek [--count N] [--skip-nonref] [--skip-loop-filter] [--index] <file>\n");
+        return 1;
+    }
+
+    CMediaConverter converter;
+    MediaReaderState state;
+    if (converter.openVideoReader(&state, file, openOptions) != ErrorCode::SUCCESS)
+    {
+        printf("unable to open %s\n", file);
+        return 1;
+    }
+
+    int64_t interval = (std::max)((int64_t)1, state.VideoFrameInterval());
+    int64_t frames = state.VideoDuration() / interval;
+    int64_t first = state.VideoStartTime() != AV_NOPTS_VALUE ? state.VideoStartTime() : 0;
+    if (frames <= 0)
+    {
+        printf("%s doesn't report a duration\n", file);
+        return 1;
+    }
+    std::vector<int64_t> targets;
+    uint32_t seed = 12345;
+    for (int i = 0; i < count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        targets.push_back(first + (int64_t)(seed % (uint32_t)frames) * interval);
+    }
+
+    std::vector<uint8_t> buffer;
+    std::vector<double> tracked;
+    for (int64_t target : targets)
+    {
+        auto start = BenchClock::now();
+        if (converter.trackToFrame(&state, target) == ErrorCode::SUCCESS)
+            converter.outputToBuffer(&state, buffer);
+        tracked.push_back(elapsedMs(start));
+    }
+
+    std::vector<double> exact;
+    int64_t decoded = 0, discarded = 0;
+    double seekMs = 0.0, decodeMs = 0.0, convertMs = 0.0;
+    for (int64_t target : targets)
+    {
+        ExactSeekStats stats;
+        auto start = BenchClock::now();
+        converter.seekExact(&state, target, buffer, seekOptions, &stats);
+        exact.push_back(elapsedMs(start));
+        decoded += stats.frames_decoded;
+        discarded += stats.frames_discarded;
+        seekMs += stats.seek_ms;
+        decodeMs += stats.decode_ms;
+        convertMs += stats.convert_ms;
+    }
+
+    printf("trackToFrame: avg %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", average(tracked),
+        percentile(tracked, 0.5), percentile(tracked, 0.95), percentile(tracked, 1.0));
+    printf("seekExact:    avg %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", average(exact),
+        percentile(exact, 0.5), percentile(exact, 0.95), percentile(exact, 1.0));
+    printf("seekExact per target: %.1f frames decoded, %.1f discarded, seek %.2f ms, decode %.2f ms, convert %.2f ms\n",
+        decoded / (double)count, discarded / (double)count, seekMs / count, decodeMs / count, convertMs / count);
+
+    converter.closeVideoReader(&state);
+    return 0;
+}
+
+/*
+* seekToFrameNumber on fixed random frame numbers, once with the frame index and once on the rational
+* frame rate alone. the indexed pts are the packets' own, so every frame the model version lands on
+* somewhere else is a frame it would have got wrong (variable frame rate, bad avg_frame_rate)
+* usage: Benchmarks framenumbers [--count N] <file>
+*/
+static int benchFrameNumbers(int argc, char** argv)
+{
+    int count = 100;
+    const char* file = nullptr;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = (std::max)(1, atoi(argv[++i]));
+        else
+            file = argv[i];
+    }
+    if (!file)
+    {
+        printf("usage: Benchmarks framenumbers [--count N] <file>\n");
+        return 1;
+    }
+
+    CMediaConverter converter;
+    MediaReaderState indexed, modeled;
+    OpenOptions options;
+    options.build_index = true;
+    if (converter.openVideoReader(&indexed, file, options) != ErrorCode::SUCCESS ||
+        converter.openVideoReader(&modeled, file) != ErrorCode::SUCCESS || !indexed.HasFrameIndex())
+    {
+        printf("unable to open and index %s\n", file);
+        return 1;
+    }
+
+    int64_t frames = (int64_t)indexed.GetFrameIndex()->FrameCount();
+    AVRational rate = modeled.VideoFrameRate();
+    printf("%lld frames, %d/%d fps, %s frame rate\n", (long long)frames, rate.num, rate.den,
+        indexed.IsVariableFrameRate() ? "variable" : "constant");
+
+    std::vector<double> indexedMs, modeledMs;
+    int64_t indexedMisses = 0, modeledMisses = 0, discarded = 0;
+    uint32_t seed = 12345;
+    FrameHandle frame;
+    for (int i = 0; i < count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int64_t n = (int64_t)(seed % (uint32_t)frames);
+        int64_t expected = indexed.FramePts(n);
+
+        ExactSeekStats stats;
+        auto start = BenchClock::now();
+        converter.seekToFrameNumber(&indexed, n, frame, ExactSeekOptions(), &stats);
+        indexedMs.push_back(elapsedMs(start));
+        indexedMisses += stats.frame_pts != expected;
+        discarded += stats.frames_discarded;
+
+        start = BenchClock::now();
+        converter.seekToFrameNumber(&modeled, n, frame, ExactSeekOptions(), &stats);
+        modeledMs.push_back(elapsedMs(start));
+        modeledMisses += stats.frame_pts != expected;
+    }
+
+    printf("indexed: avg %.2f ms, p95 %.2f ms, %lld/%d wrong frames, %.1f frames discarded per seek\n", average(indexedMs),
+        percentile(indexedMs, 0.95), (long long)indexedMisses, count, discarded / (double)count);
+    printf("modeled: avg %.2f ms, p95 %.2f ms, %lld/%d wrong frames\n", average(modeledMs),
+        percentile(modeledMs, 0.95), (long long)modeledMisses, count);
+
+    frame.Reset();
+    converter.closeVideoReader(&indexed);
+    converter.closeVideoReader(&modeled);
+    return 0;
+}
+
+/*
+* segment parallel transcoding of one long file for 1, 2, 4 .. N workers (one segment each, single threaded
+* encoders so the scaling comes from the segments). the input is generated first when it doesn't exist,
+* an hour long by default, and its keyframe index is kept next to it so only the first run pays for the scan
+* usage: Benchmarks segments [--seconds N] [--max-threads N] [--remux] <in> <out>
+*/
+static int benchSegments(int argc, char** argv)
+{
+    int seconds = 3600;
+    size_t max_threads = std::thread::hardware_concurrency();
+    bool remux = false;
+    std::vector<const char*> files;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+            max_threads = (size_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--remux") == 0)
+            remux = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.size() != 2)
+    {
+        printf("usage: Benchmarks segments [--seconds N] [--max-threads N] [--remux] <in> <out>\n");
+        return 1;
+    }
+
+    FILE* existing = fopen(files[0], "rb");
+    if (existing)
+        fclose(existing);
+    else
+    {
+        printf("generating %d second test asset %s\n", seconds, files[0]);
+        auto start = BenchClock::now();
+        if (!generateTestAsset(files[0], seconds, 320, 180, 25))
+        {
+            printf("unable to generate %s\n", files[0]);
+            return 1;
+        }
+        printf("generated in %.1f ms\n", elapsedMs(start));
+    }
+
+    std::string index_path = std::string(files[0]) + ".idx";
+    double baseline = 0.0;
+    for (size_t threads = 1; threads <= (std::max)((size_t)1, max_threads); threads *= 2)
+    {
+        SegmentOptions options;
+        options.threads = threads;
+        options.segments = (int)threads;
+        options.transcode = !remux;
+        options.transcode_options.encoder_threads = 1;
+        options.transcode_options.decoder_threads = 1;
+        options.index_path = index_path.c_str();
+
+        SegmentTranscoder transcoder(options);
+        ErrorCode ret = transcoder.Run(files[0], files[1]);
+        const SegmentStats& stats = transcoder.Stats();
+        if (threads == 1)
+            baseline = stats.wall_ms;
+        printf("segments %s: %zu threads, %d segments, %.1f ms (index %.1f, encode %.1f, concat %.1f), %.2fx, %lld packets, %lld dropped (error %d)\n",
+            remux ? "remux" : "transcode", threads, stats.segments, stats.wall_ms, stats.index_ms, stats.encode_ms, stats.concat_ms,
+            stats.wall_ms > 0 ? baseline / stats.wall_ms : 0.0, (long long)stats.packets_written, (long long)stats.packets_dropped, (int)ret);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: Benchmarks <audio|thumbnails|slices|color|open|sessions|transcode|segments|trim|stream|mmap|probe|threads|stages|suite|seek|framenumbers> [args...]\n");
+        return 1;
+    }
+
+    if (strcmp(argv[1], "audio") == 0)
+        return benchAudio(argc - 2, argv + 2);
+    if (strcmp(argv[1], "thumbnails") == 0)
+        return benchThumbnails(argc - 2, argv + 2);
+    if (strcmp(argv[1], "slices") == 0)
+        return benchSlices(argc - 2, argv + 2);
+    if (strcmp(argv[1], "color") == 0)
+        return benchColor(argc - 2, argv + 2);
+    if (strcmp(argv[1], "open") == 0)
+        return benchOpen(argc - 2, argv + 2);
+    if (strcmp(argv[1], "sessions") == 0)
+        return benchSessions(argc - 2, argv + 2);
+    if (strcmp(argv[1], "transcode") == 0)
+        return benchTranscode(argc - 2, argv + 2);
+    if (strcmp(argv[1], "segments") == 0)
+        return benchSegments(argc - 2, argv + 2);
+    if (strcmp(argv[1], "trim") == 0)
+        return benchTrim(argc - 2, argv + 2);
+    if (strcmp(argv[1], "stream") == 0)
+        return benchStream(argc - 2, argv + 2);
+    if (strcmp(argv[1], "mmap") == 0)
+        return benchMmap(argc - 2, argv + 2);
+    if (strcmp(argv[1], "probe") == 0)
+        return benchProbe(argc - 2, argv + 2);
+    if (strcmp(argv[1], "threads") == 0)
+        return benchThreads(argc - 2, argv + 2);
+    if (strcmp(argv[1], "stages") == 0)
+        return benchStages(argc - 2, argv + 2);
+    if (strcmp(argv[1], "suite") == 0)
+        return benchSuite(argc - 2, argv + 2);
+    if (strcmp(argv[1], "seek") == 0)
+        return benchSeek(argc - 2, argv + 2);
+    if (strcmp(argv[1], "framenumbers") == 0)
+        return benchFrameNumbers(argc - 2, argv + 2);
+
+    printf("unknown benchmark %s\n", argv[1]);
+    return 1;
+}
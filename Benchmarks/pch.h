@@ -0,0 +1,12 @@
+//
+// pch.h
+// Header for standard system include files.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
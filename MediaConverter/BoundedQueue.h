@@ -0,0 +1,144 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+* fixed capacity blocking queue shared between a producer and consumer thread.
+* Push blocks while the queue is full, Pop blocks while it is empty.
+* Close() lets the consumer drain what is left, Abort() wakes everybody up immediately
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity = 32) : max_size(capacity > 0 ? capacity : 1) {}
+
+	bool Push(T item)
+	{
+		return Offer(item);
+	}
+
+	//same as Push, but the item is only moved from when it went in
+	bool Offer(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		not_full.wait(lock, [this]() { return items.size() < max_size || closed || aborted; });
+		if (closed || aborted)
+			return false;
+		items.push_back(std::move(item));
+		if (items.size() > high_water)
+			high_water = items.size();
+		not_empty.notify_one();
+		return true;
+	}
+
+	//returns false once the queue is closed and drained, or aborted
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		not_empty.wait(lock, [this]() { return !items.empty() || closed || aborted; });
+		if (aborted || items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	//same as Pop, but gives up after timeout, false doesn't tell a timeout from a drained queue
+	template<typename Rep, typename Period>
+	bool PopFor(T& item, const std::chrono::duration<Rep, Period>& timeout)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		not_empty.wait_for(lock, timeout, [this]() { return !items.empty() || closed || aborted; });
+		if (aborted || items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	bool TryPop(T& item)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (aborted || items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+	void Abort()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		aborted = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+	//hands back whatever is still queued so the caller can release it, and reopens the queue
+	std::deque<T> Reset()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		std::deque<T> remaining;
+		remaining.swap(items);
+		closed = false;
+		aborted = false;
+		not_full.notify_all();
+		return remaining;
+	}
+
+	//reopens after Abort and keeps what is queued
+	void Reopen()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		closed = false;
+		aborted = false;
+		not_full.notify_all();
+	}
+
+	size_t Size() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return items.size();
+	}
+
+	size_t Capacity() const { return max_size; }
+	size_t HighWater() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return high_water;
+	}
+	bool IsClosed() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return closed;
+	}
+	bool IsAborted() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return aborted;
+	}
+
+private:
+	mutable std::mutex mtx;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<T> items;
+	size_t max_size;
+	size_t high_water = 0;
+	bool closed = false;
+	bool aborted = false;
+};
@@ -0,0 +1,407 @@
+#include "pch.h"
+#include "framework.h"
+#include "ColorConverter.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define COLOR_CONVERTER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//msvc emits avx2 intrinsics without /arch, gcc/clang need the function marked
+#if defined(COLOR_CONVERTER_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	/*
+	* Q13 coefficients. every term is computed as ((x << 7) * coef) >> 16 to match _mm_mulhi_epi16,
+	* which leaves the sum with 4 fractional bits
+	*/
+	struct Coefficients
+	{
+		int16_t y_offset;
+		int16_t y;
+		int16_t v_r;
+		int16_t u_g;
+		int16_t v_g;
+		int16_t u_b;
+	};
+
+	Coefficients makeCoefficients(ColorMatrix matrix, ColorRange range)
+	{
+		double kr = matrix == ColorMatrix::BT709 ? 0.2126 : 0.299;
+		double kb = matrix == ColorMatrix::BT709 ? 0.0722 : 0.114;
+		double kg = 1.0 - kr - kb;
+		bool full = range == ColorRange::Full;
+		double y_scale = full ? 1.0 : 255.0 / 219.0;
+		double c_scale = full ? 1.0 : 255.0 / 224.0;
+
+		Coefficients c;
+		c.y_offset = full ? 0 : 16;
+		c.y = (int16_t)lrint(y_scale * 8192);
+		c.v_r = (int16_t)lrint(2 * (1 - kr) * c_scale * 8192);
+		c.u_g = (int16_t)lrint(-2 * (1 - kb) * kb / kg * c_scale * 8192);
+		c.v_g = (int16_t)lrint(-2 * (1 - kr) * kr / kg * c_scale * 8192);
+		c.u_b = (int16_t)lrint(2 * (1 - kb) * c_scale * 8192);
+		return c;
+	}
+
+	inline int mulhi(int a, int b)
+	{
+		return (a * b) >> 16;
+	}
+
+	inline uint8_t clampPixel(int value)
+	{
+		value = (value + 8) >> 4;
+		return (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+	}
+
+	//converts pixels [start, width) of one row. uv_step is 1 for planar chroma and 2 for nv12
+	void rowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, int uv_step, uint8_t* dst, int start, int width, const Coefficients& c)
+	{
+		for (int x = start; x < width; ++x)
+		{
+			int cx = (x >> 1) * uv_step;
+			int yd = mulhi((y[x] - c.y_offset) * 128, c.y);
+			int ud = (u[cx] - 128) * 128;
+			int vd = (v[cx] - 128) * 128;
+
+			uint8_t* out = dst + x * 4;
+			out[0] = clampPixel(yd + mulhi(vd, c.v_r));
+			out[1] = clampPixel(yd + mulhi(ud, c.u_g) + mulhi(vd, c.v_g));
+			out[2] = clampPixel(yd + mulhi(ud, c.u_b));
+			out[3] = 255;
+		}
+	}
+
+#ifdef COLOR_CONVERTER_X86
+	//16 pixels per iteration, returns the first pixel left for the scalar tail
+	template <bool Interleaved>
+	int rowSSE2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width, const Coefficients& c)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i y_offset = _mm_set1_epi16(c.y_offset);
+		const __m128i chroma_offset = _mm_set1_epi16(128);
+		const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+		const __m128i round = _mm_set1_epi16(8);
+		const __m128i alpha = _mm_set1_epi8((char)0xff);
+		const __m128i cy = _mm_set1_epi16(c.y);
+		const __m128i cvr = _mm_set1_epi16(c.v_r);
+		const __m128i cug = _mm_set1_epi16(c.u_g);
+		const __m128i cvg = _mm_set1_epi16(c.v_g);
+		const __m128i cub = _mm_set1_epi16(c.u_b);
+
+		int x = 0;
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i luma = _mm_loadu_si128((const __m128i*)(y + x));
+			__m128i y_lo = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), y_offset), 7), cy);
+			__m128i y_hi = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), y_offset), 7), cy);
+
+			__m128i cb, cr;
+			if (Interleaved)
+			{
+				__m128i uv = _mm_loadu_si128((const __m128i*)(u + x));
+				cb = _mm_and_si128(uv, low_bytes);
+				cr = _mm_srli_epi16(uv, 8);
+			}
+			else
+			{
+				cb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x / 2)), zero);
+				cr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(v + x / 2)), zero);
+			}
+			cb = _mm_slli_epi16(_mm_sub_epi16(cb, chroma_offset), 7);
+			cr = _mm_slli_epi16(_mm_sub_epi16(cr, chroma_offset), 7);
+
+			//chroma terms for 8 samples, then each one is doubled up across its pixel pair
+			__m128i r_c = _mm_mulhi_epi16(cr, cvr);
+			__m128i g_c = _mm_add_epi16(_mm_mulhi_epi16(cb, cug), _mm_mulhi_epi16(cr, cvg));
+			__m128i b_c = _mm_mulhi_epi16(cb, cub);
+
+			__m128i r_lo = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(r_c, r_c)), round), 4);
+			__m128i r_hi = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_hi, _mm_unpackhi_epi16(r_c, r_c)), round), 4);
+			__m128i g_lo = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(g_c, g_c)), round), 4);
+			__m128i g_hi = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_hi, _mm_unpackhi_epi16(g_c, g_c)), round), 4);
+			__m128i b_lo = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(b_c, b_c)), round), 4);
+			__m128i b_hi = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y_hi, _mm_unpackhi_epi16(b_c, b_c)), round), 4);
+
+			__m128i r = _mm_packus_epi16(r_lo, r_hi);
+			__m128i g = _mm_packus_epi16(g_lo, g_hi);
+			__m128i b = _mm_packus_epi16(b_lo, b_hi);
+
+			__m128i rg_lo = _mm_unpacklo_epi8(r, g);
+			__m128i rg_hi = _mm_unpackhi_epi8(r, g);
+			__m128i ba_lo = _mm_unpacklo_epi8(b, alpha);
+			__m128i ba_hi = _mm_unpackhi_epi8(b, alpha);
+
+			__m128i* out = (__m128i*)(dst + x * 4);
+			_mm_storeu_si128(out, _mm_unpacklo_epi16(rg_lo, ba_lo));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+			_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+			_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+		}
+		return x;
+	}
+
+	//32 pixels per iteration. avx2 unpacks stay inside 128 bit lanes so the results get permuted back into pixel order
+	template <bool Interleaved>
+	TARGET_AVX2 int rowAVX2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width, const Coefficients& c)
+	{
+		const __m256i y_offset = _mm256_set1_epi16(c.y_offset);
+		const __m256i chroma_offset = _mm256_set1_epi16(128);
+		const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+		const __m256i round = _mm256_set1_epi16(8);
+		const __m256i alpha = _mm256_set1_epi8((char)0xff);
+		const __m256i cy = _mm256_set1_epi16(c.y);
+		const __m256i cvr = _mm256_set1_epi16(c.v_r);
+		const __m256i cug = _mm256_set1_epi16(c.u_g);
+		const __m256i cvg = _mm256_set1_epi16(c.v_g);
+		const __m256i cub = _mm256_set1_epi16(c.u_b);
+
+		int x = 0;
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i y_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x)));
+			__m256i y_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x + 16)));
+			y_lo = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y_lo, y_offset), 7), cy);
+			y_hi = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y_hi, y_offset), 7), cy);
+
+			__m256i cb, cr;
+			if (Interleaved)
+			{
+				__m256i uv = _mm256_loadu_si256((const __m256i*)(u + x));
+				cb = _mm256_and_si256(uv, low_bytes);
+				cr = _mm256_srli_epi16(uv, 8);
+			}
+			else
+			{
+				cb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(u + x / 2)));
+				cr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(v + x / 2)));
+			}
+			cb = _mm256_slli_epi16(_mm256_sub_epi16(cb, chroma_offset), 7);
+			cr = _mm256_slli_epi16(_mm256_sub_epi16(cr, chroma_offset), 7);
+
+			__m256i r_c = _mm256_mulhi_epi16(cr, cvr);
+			__m256i g_c = _mm256_add_epi16(_mm256_mulhi_epi16(cb, cug), _mm256_mulhi_epi16(cr, cvg));
+			__m256i b_c = _mm256_mulhi_epi16(cb, cub);
+
+			//doubling up in lane gives [0-3|8-11] and [4-7|12-15], recombine into samples 0-7 and 8-15
+			__m256i dup_lo, dup_hi;
+#define DUPLICATE_CHROMA(term, lo, hi) \
+			dup_lo = _mm256_unpacklo_epi16(term, term); \
+			dup_hi = _mm256_unpackhi_epi16(term, term); \
+			lo = _mm256_permute2x128_si256(dup_lo, dup_hi, 0x20); \
+			hi = _mm256_permute2x128_si256(dup_lo, dup_hi, 0x31);
+
+			__m256i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+			DUPLICATE_CHROMA(r_c, r_lo, r_hi)
+			DUPLICATE_CHROMA(g_c, g_lo, g_hi)
+			DUPLICATE_CHROMA(b_c, b_lo, b_hi)
+#undef DUPLICATE_CHROMA
+
+			r_lo = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_lo, r_lo), round), 4);
+			r_hi = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_hi, r_hi), round), 4);
+			g_lo = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_lo, g_lo), round), 4);
+			g_hi = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_hi, g_hi), round), 4);
+			b_lo = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_lo, b_lo), round), 4);
+			b_hi = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y_hi, b_hi), round), 4);
+
+			//in lane pack leaves the quarters as [0-7, 16-23 | 8-15, 24-31]
+			__m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r_lo, r_hi), 0xD8);
+			__m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g_lo, g_hi), 0xD8);
+			__m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b_lo, b_hi), 0xD8);
+
+			__m256i rg_lo = _mm256_unpacklo_epi8(r, g); //pixels 0-7 | 16-23
+			__m256i rg_hi = _mm256_unpackhi_epi8(r, g); //pixels 8-15 | 24-31
+			__m256i ba_lo = _mm256_unpacklo_epi8(b, alpha);
+			__m256i ba_hi = _mm256_unpackhi_epi8(b, alpha);
+
+			__m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo); //0-3 | 16-19
+			__m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo); //4-7 | 20-23
+			__m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi); //8-11 | 24-27
+			__m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi); //12-15 | 28-31
+
+			__m256i* out = (__m256i*)(dst + x * 4);
+			_mm256_storeu_si256(out, _mm256_permute2x128_si256(p0, p1, 0x20));
+			_mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+			_mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+			_mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+		}
+		return x;
+	}
+
+	void cpuid(int regs[4], int leaf, int subleaf)
+	{
+#ifdef _MSC_VER
+		__cpuidex(regs, leaf, subleaf);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, subleaf, a, b, c, d);
+		regs[0] = (int)a;
+		regs[1] = (int)b;
+		regs[2] = (int)c;
+		regs[3] = (int)d;
+#endif
+	}
+
+	//avx2 needs the cpu flag plus the os saving ymm state
+	bool detectAVX2()
+	{
+		int regs[4];
+		cpuid(regs, 0, 0);
+		if (regs[0] < 7)
+			return false;
+
+		cpuid(regs, 1, 0);
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx)
+			return false;
+
+#ifdef _MSC_VER
+		unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int xcr_lo, xcr_hi;
+		__asm__("xgetbv" : "=a"(xcr_lo), "=d"(xcr_hi) : "c"(0));
+		unsigned long long xcr0 = ((unsigned long long)xcr_hi << 32) | xcr_lo;
+#endif
+		if ((xcr0 & 0x6) != 0x6)
+			return false;
+
+		cpuid(regs, 7, 0);
+		return (regs[1] & (1 << 5)) != 0;
+	}
+
+	bool detectSSE2()
+	{
+		int regs[4];
+		cpuid(regs, 1, 0);
+		return (regs[3] & (1 << 26)) != 0;
+	}
+#endif
+}
+
+ColorKernel ColorConverter::BestKernel()
+{
+	static const ColorKernel best = KernelSupported(ColorKernel::AVX2) ? ColorKernel::AVX2 :
+		KernelSupported(ColorKernel::SSE2) ? ColorKernel::SSE2 : ColorKernel::Scalar;
+	return best;
+}
+
+bool ColorConverter::KernelSupported(ColorKernel kernel)
+{
+#ifdef COLOR_CONVERTER_X86
+	static const bool sse2 = detectSSE2();
+	static const bool avx2 = detectAVX2();
+	switch (kernel)
+	{
+	case ColorKernel::AVX2:
+		return avx2;
+	case ColorKernel::SSE2:
+		return sse2;
+	default:
+		return true;
+	}
+#else
+	return kernel == ColorKernel::Scalar;
+#endif
+}
+
+const char* ColorConverter::KernelName(ColorKernel kernel)
+{
+	switch (kernel)
+	{
+	case ColorKernel::AVX2:
+		return "avx2";
+	case ColorKernel::SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+bool ColorConverter::Supports(const AVFrame* frame, int width, int height, AVPixelFormat dst_fmt)
+{
+	if (!frame || dst_fmt != AV_PIX_FMT_RGB0 || frame->width != width || frame->height != height)
+		return false;
+
+	if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P && frame->format != AV_PIX_FMT_NV12)
+		return false;
+
+	//anything tagged with another matrix (bt2020 etc) is left to swscale
+	switch (frame->colorspace)
+	{
+	case AVCOL_SPC_UNSPECIFIED:
+	case AVCOL_SPC_BT709:
+	case AVCOL_SPC_BT470BG:
+	case AVCOL_SPC_SMPTE170M:
+		return true;
+	default:
+		return false;
+	}
+}
+
+ColorMatrix ColorConverter::MatrixFor(const AVFrame* frame)
+{
+	return frame->colorspace == AVCOL_SPC_BT709 ? ColorMatrix::BT709 : ColorMatrix::BT601;
+}
+
+ColorRange ColorConverter::RangeFor(const AVFrame* frame)
+{
+	if (frame->format == AV_PIX_FMT_YUVJ420P || frame->color_range == AVCOL_RANGE_JPEG)
+		return ColorRange::Full;
+	return ColorRange::Limited;
+}
+
+int ColorConverter::ToRGB0(const AVFrame* frame, uint8_t* dest, int destLinesize)
+{
+	return ToRGB0(frame, dest, destLinesize, MatrixFor(frame), RangeFor(frame), BestKernel());
+}
+
+int ColorConverter::ToRGB0(const AVFrame* frame, uint8_t* dest, int destLinesize, ColorMatrix matrix, ColorRange range, ColorKernel kernel)
+{
+	if (!frame || !dest || !frame->data[0] || !frame->data[1])
+		return AVERROR(EINVAL);
+
+	bool interleaved = frame->format == AV_PIX_FMT_NV12;
+	if (!interleaved && frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P)
+		return AVERROR(EINVAL);
+	if (!interleaved && !frame->data[2])
+		return AVERROR(EINVAL);
+
+	if (!KernelSupported(kernel))
+		kernel = ColorKernel::Scalar;
+
+	Coefficients c = makeCoefficients(matrix, range);
+	int uv_step = interleaved ? 2 : 1;
+
+	for (int row = 0; row < frame->height; ++row)
+	{
+		const uint8_t* y = frame->data[0] + row * frame->linesize[0];
+		const uint8_t* u = frame->data[1] + (row >> 1) * frame->linesize[1];
+		const uint8_t* v = interleaved ? u + 1 : frame->data[2] + (row >> 1) * frame->linesize[2];
+		uint8_t* dst = dest + row * destLinesize;
+
+		int x = 0;
+#ifdef COLOR_CONVERTER_X86
+		if (kernel == ColorKernel::AVX2)
+			x = interleaved ? rowAVX2<true>(y, u, v, dst, frame->width, c) : rowAVX2<false>(y, u, v, dst, frame->width, c);
+		else if (kernel == ColorKernel::SSE2)
+			x = interleaved ? rowSSE2<true>(y, u, v, dst, frame->width, c) : rowSSE2<false>(y, u, v, dst, frame->width, c);
+#endif
+		rowScalar(y, u, v, uv_step, dst, x, frame->width, c);
+	}
+
+	return 0;
+}
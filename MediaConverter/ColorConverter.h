@@ -0,0 +1,55 @@
+#pragma once
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+#include <cstdint>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+enum class ColorMatrix
+{
+	BT601,
+	BT709
+};
+
+enum class ColorRange
+{
+	Limited,
+	Full
+};
+
+enum class ColorKernel
+{
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+/*
+* hand written yuv420p/nv12 -> RGB0 conversion for the same size case, which is most of what we decode.
+* all kernels share the same fixed point math so scalar, sse2 and avx2 produce identical output.
+* chroma is replicated over each 2x2 block rather than interpolated, so results are within a few
+* levels of swscale's bilinear output rather than byte exact
+*/
+class MEDIACONVERTER_API ColorConverter
+{
+public:
+	static ColorKernel BestKernel();
+	static bool KernelSupported(ColorKernel kernel);
+	static const char* KernelName(ColorKernel kernel);
+
+	//true when the frame can go through ToRGB0 for the requested output
+	static bool Supports(const AVFrame* frame, int width, int height, AVPixelFormat dst_fmt);
+	static ColorMatrix MatrixFor(const AVFrame* frame);
+	static ColorRange RangeFor(const AVFrame* frame);
+
+	//uses the frame's colorspace tags and the best kernel for this cpu
+	static int ToRGB0(const AVFrame* frame, uint8_t* dest, int destLinesize);
+	static int ToRGB0(const AVFrame* frame, uint8_t* dest, int destLinesize, ColorMatrix matrix, ColorRange range, ColorKernel kernel);
+};
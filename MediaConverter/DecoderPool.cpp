@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "framework.h"
+#include "DecoderPool.h"
+
+//never destroyed: states that are statics themselves release into it from their destructors at exit,
+//in whatever order the runtime picks. the parked contexts go with the process
+DecoderPool& DecoderPool::Instance()
+{
+	static DecoderPool* pool = new DecoderPool();
+	return *pool;
+}
+
+DecoderPool::DecoderPool(size_t capacity, int64_t idleTimeoutMs) : capacity(capacity), idle_timeout(idleTimeoutMs)
+{
+}
+
+DecoderPool::~DecoderPool()
+{
+	Clear();
+}
+
+bool DecoderPool::Key::operator==(const Key& other) const
+{
+	return codec_id == other.codec_id && codec_type == other.codec_type && codec_tag == other.codec_tag &&
+		format == other.format && width == other.width && height == other.height &&
+		profile == other.profile && level == other.level && bits_per_coded_sample == other.bits_per_coded_sample &&
+		sample_rate == other.sample_rate && channels == other.channels && channel_layout == other.channel_layout &&
+		block_align == other.block_align && threading == other.threading && extradata == other.extradata;
+}
+
+DecoderPool::Key DecoderPool::makeKey(const AVCodecParameters* params, const DecodeThreading& threading)
+{
+	Key key;
+	key.codec_id = params->codec_id;
+	key.codec_type = params->codec_type;
+	key.codec_tag = params->codec_tag;
+	key.format = params->format;
+	key.width = params->width;
+	key.height = params->height;
+	key.profile = params->profile;
+	key.level = params->level;
+	key.bits_per_coded_sample = params->bits_per_coded_sample;
+	key.sample_rate = params->sample_rate;
+	key.channels = params->channels;
+	key.channel_layout = params->channel_layout;
+	key.block_align = params->block_align;
+	key.threading = threading;
+	if (params->extradata && params->extradata_size > 0)
+		key.extradata.assign(params->extradata, params->extradata + params->extradata_size);
+	return key;
+}
+
+ErrorCode DecoderPool::Acquire(const AVCodecParameters* params, const DecodeThreading& threading, AVCodecContext** ctx)
+{
+	auto start = Clock::now();
+	Key key = makeKey(params, threading);
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		trimLocked(start);
+		for (auto it = idle.begin(); it != idle.end(); ++it)
+		{
+			if (it->key == key)
+			{
+				*ctx = it->ctx;
+				outstanding[it->ctx] = std::move(it->key);
+				idle.erase(it);
+				++hits;
+				recordOpen(true, start);
+				return ErrorCode::SUCCESS;
+			}
+		}
+	}
+
+	//nothing warm, open one outside the lock since this is the slow part
+	AVCodec* codec = avcodec_find_decoder(params->codec_id);
+	if (!codec)
+		return ErrorCode::NO_CODEC;
+
+	AVCodecContext* opened = avcodec_alloc_context3(codec);
+	if (!opened)
+		return ErrorCode::NO_CODEC_CTX;
+
+	threading.Apply(opened);
+
+	if (avcodec_parameters_to_context(opened, params) < 0)
+	{
+		avcodec_free_context(&opened);
+		return ErrorCode::CODEC_CTX_UNINIT;
+	}
+
+	if (avcodec_open2(opened, codec, NULL) < 0)
+	{
+		avcodec_free_context(&opened);
+		return ErrorCode::CODEC_UNOPENED;
+	}
+
+	std::lock_guard<std::mutex> lock(mtx);
+	outstanding[opened] = std::move(key);
+	++misses;
+	recordOpen(false, start);
+	*ctx = opened;
+	return ErrorCode::SUCCESS;
+}
+
+bool DecoderPool::Release(AVCodecContext*& ctx)
+{
+	if (!ctx)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = outstanding.find(ctx);
+	if (it == outstanding.end())
+		return false;
+
+	//back to the state avcodec_open2 left it in, minus anything the last reader changed
+	avcodec_flush_buffers(ctx);
+	ctx->skip_frame = AVDISCARD_DEFAULT;
+
+	Entry entry = { std::move(it->second), ctx, Clock::now() };
+	outstanding.erase(it);
+	idle.push_front(std::move(entry));
+	trimLocked(idle.front().last_used);
+
+	ctx = nullptr;
+	return true;
+}
+
+void DecoderPool::EvictIdle()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	trimLocked(Clock::now());
+}
+
+void DecoderPool::Clear()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& entry : idle)
+		avcodec_free_context(&entry.ctx);
+	idle.clear();
+}
+
+void DecoderPool::SetCapacity(size_t newCapacity)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	capacity = newCapacity;
+	trimLocked(Clock::now());
+}
+
+void DecoderPool::SetIdleTimeout(int64_t idleTimeoutMs)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	idle_timeout = std::chrono::milliseconds(idleTimeoutMs);
+	trimLocked(Clock::now());
+}
+
+DecoderPoolStats DecoderPool::Stats() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	DecoderPoolStats stats;
+	stats.idle = idle.size();
+	stats.outstanding = outstanding.size();
+	stats.capacity = capacity;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	stats.hit_open_ms = hits > 0 ? hit_ms_total / hits : 0.0;
+	stats.miss_open_ms = misses > 0 ? miss_ms_total / misses : 0.0;
+	stats.max_open_ms = max_open_ms;
+	return stats;
+}
+
+//least recently released contexts sit at the back, so both limits trim from there
+void DecoderPool::trimLocked(Clock::time_point now)
+{
+	while (!idle.empty() && (idle.size() > capacity || now - idle.back().last_used > idle_timeout))
+	{
+		avcodec_free_context(&idle.back().ctx);
+		idle.pop_back();
+		++evictions;
+	}
+}
+
+void DecoderPool::recordOpen(bool hit, Clock::time_point start)
+{
+	double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	if (hit)
+		hit_ms_total += ms;
+	else
+		miss_ms_total += ms;
+	max_open_ms = (std::max)(max_open_ms, ms);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "MediaConverter.h"
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct DecoderPoolStats
+{
+	size_t idle = 0; //warm contexts waiting in the pool
+	size_t outstanding = 0; //contexts currently handed out
+	size_t capacity = 0;
+	int64_t hits = 0;
+	int64_t misses = 0;
+	int64_t evictions = 0; //dropped for being idle too long or to stay under the cap
+	double hit_open_ms = 0.0; //average time Acquire took when a warm context was reused
+	double miss_open_ms = 0.0; //average time Acquire took when a decoder had to be opened
+	double max_open_ms = 0.0;
+};
+
+/*
+* process wide pool of opened decoder contexts. contexts are keyed on everything avcodec_open2 looks at
+* (codec, stream parameters, extradata, threading) so a context handed back out behaves exactly like a
+* freshly opened one. Release flushes the decoder and parks it, Acquire reuses a parked one when the key
+* matches, which skips the decoder init and thread creation that dominate opening short clips
+*/
+class MEDIACONVERTER_API DecoderPool
+{
+public:
+	static DecoderPool& Instance();
+
+	explicit DecoderPool(size_t capacity = 16, int64_t idleTimeoutMs = 30000);
+	~DecoderPool();
+	DecoderPool(const DecoderPool&) = delete;
+	DecoderPool& operator=(const DecoderPool&) = delete;
+
+	ErrorCode Acquire(const AVCodecParameters* params, const DecodeThreading& threading, AVCodecContext** ctx);
+	bool Release(AVCodecContext*& ctx); //false (and ctx untouched) when ctx didn't come from this pool
+
+	void EvictIdle();
+	void Clear();
+
+	void SetCapacity(size_t capacity);
+	void SetIdleTimeout(int64_t idleTimeoutMs);
+	DecoderPoolStats Stats() const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Key
+	{
+		AVCodecID codec_id = AV_CODEC_ID_NONE;
+		AVMediaType codec_type = AVMEDIA_TYPE_UNKNOWN;
+		uint32_t codec_tag = 0;
+		int format = -1;
+		int width = 0;
+		int height = 0;
+		int profile = 0;
+		int level = 0;
+		int bits_per_coded_sample = 0;
+		int sample_rate = 0;
+		int channels = 0;
+		uint64_t channel_layout = 0;
+		int block_align = 0;
+		DecodeThreading threading;
+		std::vector<uint8_t> extradata;
+
+		bool operator==(const Key& other) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		AVCodecContext* ctx;
+		Clock::time_point last_used;
+	};
+
+	static Key makeKey(const AVCodecParameters* params, const DecodeThreading& threading);
+	void trimLocked(Clock::time_point now);
+	void recordOpen(bool hit, Clock::time_point start);
+
+	mutable std::mutex mtx;
+	std::list<Entry> idle; //most recently released first
+	std::map<AVCodecContext*, Key> outstanding;
+	size_t capacity;
+	std::chrono::milliseconds idle_timeout;
+
+	int64_t hits = 0;
+	int64_t misses = 0;
+	int64_t evictions = 0;
+	double hit_ms_total = 0.0;
+	double miss_ms_total = 0.0;
+	double max_open_ms = 0.0;
+};
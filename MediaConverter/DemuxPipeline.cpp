@@ -0,0 +1,256 @@
+#include "pch.h"
+#include "framework.h"
+#include "DemuxPipeline.h"
+#include "MediaConverter.h"
+#include <chrono>
+#include <functional>
+
+namespace
+{
+	//how often a waiting Pop checks whether it is waiting on nothing
+	const std::chrono::milliseconds kPollInterval(5);
+}
+
+DemuxPipeline::DemuxPipeline(AVFormatContext* fmt_ctx, int video_index, AVCodecContext* video_ctx, int audio_index, AVCodecContext* audio_ctx,
+	size_t packet_depth, size_t frame_depth)
+	: fmt_ctx(fmt_ctx),
+	video(video_index, video_ctx, packet_depth, frame_depth),
+	audio(audio_index, audio_ctx, packet_depth, frame_depth),
+	cancel(false), first_error(0), packets_read(0)
+{
+}
+
+DemuxPipeline::~DemuxPipeline()
+{
+	Stop();
+}
+
+void DemuxPipeline::Start()
+{
+	if (running)
+		return;
+
+	cancel = false;
+	first_error = 0;
+	for (Stream* stream : { &video, &audio })
+	{
+		drain(*stream);
+		if (stream->ctx)
+			stream->thread = std::thread(&DemuxPipeline::decodeLoop, this, std::ref(*stream));
+		else
+			stream->frames.Close();
+	}
+	demuxer = std::thread(&DemuxPipeline::demuxLoop, this);
+	running = true;
+}
+
+void DemuxPipeline::Stop()
+{
+	if (running)
+	{
+		//Abort gets every thread off a full or empty queue
+		cancel = true;
+		for (Stream* stream : { &video, &audio })
+		{
+			stream->packets.Abort();
+			stream->frames.Abort();
+		}
+		if (demuxer.joinable())
+			demuxer.join();
+		for (Stream* stream : { &video, &audio })
+		{
+			if (stream->thread.joinable())
+				stream->thread.join();
+		}
+		running = false;
+	}
+
+	for (Stream* stream : { &video, &audio })
+	{
+		drain(*stream);
+		//whatever the decoder still holds belongs to the old position, drained decoders need it to be usable again
+		if (stream->ctx)
+			avcodec_flush_buffers(stream->ctx);
+	}
+}
+
+int DemuxPipeline::PopVideo(FrameHandle& frame)
+{
+	return pop(video, audio, frame);
+}
+
+int DemuxPipeline::PopAudio(FrameHandle& frame)
+{
+	return pop(audio, video, frame);
+}
+
+int DemuxPipeline::pop(Stream& stream, Stream& other, FrameHandle& frame)
+{
+	if (!stream.ctx)
+		return (int)ErrorCode::NO_CODEC_CTX;
+	if (!running)
+		Start();
+
+	AVFrame* decoded = nullptr;
+	while (!stream.frames.PopFor(decoded, kPollInterval))
+	{
+		//the decoder closes its queue once it is done, eof or an error
+		if (stream.frames.IsClosed() && stream.frames.Size() == 0)
+		{
+			int error = first_error;
+			return error != 0 ? error : (int)ErrorCode::FILE_EOF;
+		}
+		//nothing on its way for this stream while the other one's frames aren't being read
+		if (stream.in_flight == 0 && other.ctx && other.frames.Size() >= other.frames.Capacity())
+			return (int)ErrorCode::AGAIN;
+	}
+
+	frame.Attach(decoded);
+	return 0;
+}
+
+//frees what is still queued and leaves both queues open and empty
+void DemuxPipeline::drain(Stream& stream)
+{
+	for (AVPacket* packet : stream.packets.Reset())
+		av_packet_free(&packet);
+	for (AVFrame* frame : stream.frames.Reset())
+	{
+		av_frame_free(&frame);
+		++discarded;
+	}
+	stream.in_flight = 0;
+}
+
+void DemuxPipeline::setError(int error)
+{
+	int expected = 0;
+	first_error.compare_exchange_strong(expected, error);
+}
+
+void DemuxPipeline::demuxLoop()
+{
+	AVPacket* packet = av_packet_alloc();
+	if (!packet)
+		setError((int)ErrorCode::NO_PACKET);
+
+	while (packet && !cancel)
+	{
+		int response = av_read_frame(fmt_ctx, packet);
+		if (response < 0)
+		{
+			//same as the serial path, a read error other than eof goes back as the av error
+			if (response != AVERROR_EOF)
+				setError(response);
+			break;
+		}
+		++packets_read;
+
+		Stream* stream = nullptr;
+		if (packet->stream_index == video.index && video.ctx)
+			stream = &video;
+		else if (packet->stream_index == audio.index && audio.ctx)
+			stream = &audio;
+		if (!stream)
+		{
+			av_packet_unref(packet);
+			continue;
+		}
+
+		AVPacket* queued = av_packet_alloc();
+		if (!queued)
+		{
+			av_packet_unref(packet);
+			setError((int)ErrorCode::NO_PACKET);
+			break;
+		}
+		av_packet_move_ref(queued, packet);
+
+		++stream->in_flight;
+		if (!stream->packets.Offer(queued))
+		{
+			//aborted, by Stop or by a decoder that gave up
+			--stream->in_flight;
+			av_packet_free(&queued);
+			break;
+		}
+	}
+
+	av_packet_free(&packet);
+	video.packets.Close();
+	audio.packets.Close();
+}
+
+void DemuxPipeline::decodeLoop(Stream& stream)
+{
+	AVFrame* frame = av_frame_alloc();
+	bool ok = frame != nullptr;
+	if (!ok)
+		setError((int)ErrorCode::NO_FRAME);
+
+	AVPacket* packet = nullptr;
+	while (ok && stream.packets.Pop(packet))
+	{
+		int response = avcodec_send_packet(stream.ctx, packet);
+		if (response == AVERROR(EAGAIN))
+		{
+			ok = receiveFrames(stream, frame);
+			if (ok)
+				response = avcodec_send_packet(stream.ctx, packet);
+		}
+		av_packet_free(&packet);
+
+		if (ok && response < 0)
+		{
+			setError((int)ErrorCode::PKT_NOT_DECODED);
+			ok = false;
+		}
+		if (ok)
+			ok = receiveFrames(stream, frame);
+		--stream.in_flight;
+	}
+
+	//the demuxer reached the end, whatever the decoder held back comes out now
+	if (ok && !cancel && !stream.packets.IsAborted())
+	{
+		avcodec_send_packet(stream.ctx, nullptr);
+		receiveFrames(stream, frame);
+	}
+	//a decoder that gave up stops the demuxer too rather than leaving it blocked on a queue nobody reads
+	if (!ok)
+		stream.packets.Abort();
+
+	av_frame_free(&frame);
+	stream.frames.Close();
+}
+
+//false when decoding can't go on: a decode error, or the frame queue was aborted
+bool DemuxPipeline::receiveFrames(Stream& stream, AVFrame* frame)
+{
+	while (true)
+	{
+		int response = avcodec_receive_frame(stream.ctx, frame);
+		if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+			return true;
+		if (response < 0)
+		{
+			setError((int)ErrorCode::PKT_NOT_RECEIVED);
+			return false;
+		}
+
+		AVFrame* out = av_frame_alloc();
+		if (!out)
+		{
+			av_frame_unref(frame);
+			setError((int)ErrorCode::NO_FRAME);
+			return false;
+		}
+		av_frame_move_ref(out, frame);
+		if (!stream.frames.Offer(out))
+		{
+			av_frame_free(&out);
+			return false;
+		}
+		++stream.decoded;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "BoundedQueue.h"
+#include "FrameHandle.h"
+#include <atomic>
+#include <thread>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+/*
+* reads the container once for both streams. one thread runs the av_read_frame loop and routes every packet into
+* its stream's packet queue, a decoder thread per stream turns those into frames in the stream's frame queue.
+* the threads only use the format context, the two codec contexts and packets/frames they allocated themselves,
+* nothing of the reader state changes under the consumer.
+* like ReadAheadQueue, Start/Stop/Pop belong to the consumer thread; Stop drops everything queued so a seek
+* never hands back stale frames, and the next Pop starts again from wherever the demuxer is.
+* the queues are bounded, so a stream that isn't read holds the demuxer up: a Pop that has nothing to wait for
+* while the other stream's frames are backed up returns AGAIN instead of blocking
+*/
+class MEDIACONVERTER_API DemuxPipeline
+{
+public:
+	//a null codec context leaves that stream out, its packets are dropped
+	DemuxPipeline(AVFormatContext* fmt_ctx, int video_index, AVCodecContext* video_ctx, int audio_index, AVCodecContext* audio_ctx,
+		size_t packet_depth, size_t frame_depth);
+	~DemuxPipeline();
+	DemuxPipeline(const DemuxPipeline&) = delete;
+	DemuxPipeline& operator=(const DemuxPipeline&) = delete;
+
+	void Start();
+	void Stop();
+	bool IsRunning() const { return running; }
+
+	//0, or an ErrorCode: FILE_EOF once the stream is drained, AGAIN when the other stream has to be read first
+	int PopVideo(FrameHandle& frame);
+	int PopAudio(FrameHandle& frame);
+
+	int64_t PacketsRead() const { return packets_read; }
+	int64_t VideoFrames() const { return video.decoded; }
+	int64_t AudioFrames() const { return audio.decoded; }
+	int64_t Discarded() const { return discarded; } //decoded but dropped by a seek/stop
+	size_t VideoHighWater() const { return video.frames.HighWater(); }
+	size_t AudioHighWater() const { return audio.frames.HighWater(); }
+
+private:
+	struct Stream
+	{
+		Stream(int index, AVCodecContext* ctx, size_t packet_depth, size_t frame_depth)
+			: index(index), ctx(ctx), packets(packet_depth), frames(frame_depth), in_flight(0), decoded(0) {}
+
+		int index;
+		AVCodecContext* ctx;
+		BoundedQueue<AVPacket*> packets;
+		BoundedQueue<AVFrame*> frames;
+		std::thread thread;
+		std::atomic<int> in_flight; //packets routed to this stream that its decoder hasn't finished with
+		std::atomic<int64_t> decoded;
+	};
+
+	void demuxLoop();
+	void decodeLoop(Stream& stream);
+	bool receiveFrames(Stream& stream, AVFrame* frame);
+	int pop(Stream& stream, Stream& other, FrameHandle& frame);
+	void drain(Stream& stream);
+	void setError(int error);
+
+	AVFormatContext* fmt_ctx;
+	Stream video;
+	Stream audio;
+	std::thread demuxer;
+	std::atomic<bool> cancel;
+	std::atomic<int> first_error;
+	bool running = false;
+
+	std::atomic<int64_t> packets_read;
+	int64_t discarded = 0;
+};
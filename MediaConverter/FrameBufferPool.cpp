@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "framework.h"
+#include "FrameBufferPool.h"
+#include <cstdlib>
+#include <unordered_set>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+	//buffers that were still leased out when their pool was destroyed. never destroyed itself, so a release
+	//during static destruction still finds it
+	struct DetachedBuffers
+	{
+		std::mutex mtx;
+		std::unordered_set<uint8_t*> buffers;
+	};
+
+	DetachedBuffers& detachedBuffers()
+	{
+		static DetachedBuffers* detached = new DetachedBuffers();
+		return *detached;
+	}
+}
+
+FrameLease::FrameLease()
+{
+}
+
+FrameLease::FrameLease(FrameBufferPool* pool, uint8_t* data, size_t size) : pool(pool), data(data), size(size)
+{
+}
+
+FrameLease::FrameLease(FrameLease&& other) : pool(other.pool), data(other.data), size(other.size)
+{
+	other.pool = nullptr;
+	other.data = nullptr;
+	other.size = 0;
+}
+
+FrameLease& FrameLease::operator=(FrameLease&& other)
+{
+	if (this != &other)
+	{
+		Reset();
+		pool = other.pool;
+		data = other.data;
+		size = other.size;
+		other.pool = nullptr;
+		other.data = nullptr;
+		other.size = 0;
+	}
+	return *this;
+}
+
+FrameLease::~FrameLease()
+{
+	Reset();
+}
+
+uint8_t* FrameLease::Detach()
+{
+	uint8_t* detached = data;
+	pool = nullptr;
+	data = nullptr;
+	size = 0;
+	return detached;
+}
+
+void FrameLease::Reset()
+{
+	if (pool && data)
+		pool->Return(data);
+	pool = nullptr;
+	data = nullptr;
+	size = 0;
+}
+
+FrameBufferPool::FrameBufferPool(size_t capacity) : capacity(capacity)
+{
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+	Trim();
+	//callers may still be using what is leased out, so it is handed over to the detached set instead of freed
+	std::lock_guard<std::mutex> lock(mtx);
+	if (outstanding.empty())
+		return;
+	DetachedBuffers& detached = detachedBuffers();
+	std::lock_guard<std::mutex> detachedLock(detached.mtx);
+	for (auto& buffer : outstanding)
+		detached.buffers.insert(buffer.first);
+	outstanding.clear();
+}
+
+bool FrameBufferPool::ReleaseDetached(uint8_t* data)
+{
+	if (!data)
+		return false;
+
+	DetachedBuffers& detached = detachedBuffers();
+	{
+		std::lock_guard<std::mutex> lock(detached.mtx);
+		if (detached.buffers.erase(data) == 0)
+			return false;
+	}
+	alignedFree(data);
+	return true;
+}
+
+uint8_t* FrameBufferPool::alignedAlloc(size_t size)
+{
+#ifdef _WIN32
+	return (uint8_t*)_aligned_malloc(size, kAlignment);
+#else
+	void* data = nullptr;
+	if (posix_memalign(&data, kAlignment, size) != 0)
+		return nullptr;
+	return (uint8_t*)data;
+#endif
+}
+
+void FrameBufferPool::alignedFree(uint8_t* data)
+{
+#ifdef _WIN32
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+FrameLease FrameBufferPool::Acquire(size_t size)
+{
+	uint8_t* data = AcquireRaw(size);
+	if (!data)
+		return FrameLease();
+	std::lock_guard<std::mutex> lock(mtx);
+	return FrameLease(this, data, outstanding[data]);
+}
+
+uint8_t* FrameBufferPool::AcquireRaw(size_t size)
+{
+	if (size == 0)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	//smallest idle buffer that fits, so a 4k request doesn't steal the only 8k buffer from a later request
+	auto best = idle.end();
+	for (auto it = idle.begin(); it != idle.end(); ++it)
+	{
+		if (it->size >= size && (best == idle.end() || it->size < best->size))
+			best = it;
+	}
+
+	PooledBuffer buffer;
+	if (best != idle.end())
+	{
+		buffer = *best;
+		idle.erase(best);
+		++hits;
+	}
+	else
+	{
+		buffer.data = alignedAlloc(size);
+		buffer.size = size;
+		if (!buffer.data)
+			return nullptr;
+		++misses;
+	}
+
+	outstanding[buffer.data] = buffer.size;
+	if (outstanding.size() > high_water)
+		high_water = outstanding.size();
+	return buffer.data;
+}
+
+bool FrameBufferPool::Return(uint8_t* data)
+{
+	if (!data)
+		return false;
+
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = outstanding.find(data);
+	if (it == outstanding.end())
+	{
+		lock.unlock();
+		return ReleaseDetached(data);
+	}
+
+	PooledBuffer buffer = { it->first, it->second };
+	outstanding.erase(it);
+
+	if (idle.size() < capacity)
+	{
+		idle.push_back(buffer);
+		return true;
+	}
+
+	//pool is full, drop the smallest buffer since it is the least likely to satisfy the next request
+	auto smallest = idle.begin();
+	for (auto it2 = idle.begin(); it2 != idle.end(); ++it2)
+	{
+		if (it2->size < smallest->size)
+			smallest = it2;
+	}
+	if (smallest != idle.end() && smallest->size < buffer.size)
+	{
+		alignedFree(smallest->data);
+		*smallest = buffer;
+	}
+	else
+	{
+		alignedFree(buffer.data);
+	}
+	return true;
+}
+
+void FrameBufferPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& buffer : idle)
+		alignedFree(buffer.data);
+	idle.clear();
+}
+
+int64_t FrameBufferPool::Hits() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return hits;
+}
+
+int64_t FrameBufferPool::Misses() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return misses;
+}
+
+size_t FrameBufferPool::Outstanding() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return outstanding.size();
+}
+
+size_t FrameBufferPool::HighWater() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return high_water;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+class FrameBufferPool;
+
+//RAII lease on a pooled buffer, the buffer goes back to its pool when the lease is destroyed
+class MEDIACONVERTER_API FrameLease
+{
+public:
+	FrameLease();
+	FrameLease(FrameBufferPool* pool, uint8_t* data, size_t size);
+	FrameLease(FrameLease&& other);
+	FrameLease& operator=(FrameLease&& other);
+	FrameLease(const FrameLease&) = delete;
+	FrameLease& operator=(const FrameLease&) = delete;
+	~FrameLease();
+
+	uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+	explicit operator bool() const { return data != nullptr; }
+
+	uint8_t* Detach(); //caller becomes responsible for handing the buffer back with FrameBufferPool::Return
+	void Reset();
+
+private:
+	FrameBufferPool* pool = nullptr;
+	uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+/*
+* keeps up to capacity idle output buffers around so per frame allocations are served from memory we already own.
+* buffers are aligned for SIMD loads/stores and may be larger than requested when an idle one is big enough.
+* buffers still out when the pool is destroyed are detached rather than freed, Return on any pool (or
+* ReleaseDetached) frees them later. a FrameLease has to go before its pool does
+*/
+class MEDIACONVERTER_API FrameBufferPool
+{
+public:
+	static const size_t kAlignment = 64;
+
+	explicit FrameBufferPool(size_t capacity = 8);
+	~FrameBufferPool();
+
+	FrameLease Acquire(size_t size);
+	uint8_t* AcquireRaw(size_t size);
+	bool Return(uint8_t* data); //false if data didn't come from this pool and isn't a detached buffer either
+	static bool ReleaseDetached(uint8_t* data); //frees a buffer whose pool is gone, false for anything else
+	void Trim(); //frees every idle buffer
+
+	size_t Capacity() const { return capacity; }
+	int64_t Hits() const;
+	int64_t Misses() const;
+	size_t Outstanding() const;
+	size_t HighWater() const;
+
+private:
+	struct PooledBuffer
+	{
+		uint8_t* data;
+		size_t size;
+	};
+
+	static uint8_t* alignedAlloc(size_t size);
+	static void alignedFree(uint8_t* data);
+
+	mutable std::mutex mtx;
+	std::vector<PooledBuffer> idle;
+	std::unordered_map<uint8_t*, size_t> outstanding;
+	size_t capacity;
+	size_t high_water = 0;
+	int64_t hits = 0;
+	int64_t misses = 0;
+};
@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "framework.h"
+#include "FrameHandle.h"
+
+FrameHandle::FrameHandle()
+{
+}
+
+FrameHandle::FrameHandle(const AVFrame* src)
+{
+	Ref(src);
+}
+
+FrameHandle::FrameHandle(const FrameHandle& other)
+{
+	*this = other;
+}
+
+FrameHandle::FrameHandle(FrameHandle&& other) : frame(other.frame)
+{
+	other.frame = nullptr;
+}
+
+FrameHandle::~FrameHandle()
+{
+	av_frame_free(&frame);
+}
+
+FrameHandle& FrameHandle::operator=(const FrameHandle& other)
+{
+	if (this != &other)
+	{
+		if (other.frame)
+			Ref(other.frame);
+		else
+			Reset();
+	}
+	return *this;
+}
+
+FrameHandle& FrameHandle::operator=(FrameHandle&& other)
+{
+	if (this != &other)
+	{
+		av_frame_free(&frame);
+		frame = other.frame;
+		other.frame = nullptr;
+	}
+	return *this;
+}
+
+bool FrameHandle::Ref(const AVFrame* src)
+{
+	if (!src)
+		return false;
+	if (!frame)
+		frame = av_frame_alloc();
+	else
+		av_frame_unref(frame);
+	if (!frame)
+		return false;
+	return av_frame_ref(frame, src) >= 0;
+}
+
+bool FrameHandle::MoveFrom(AVFrame* src)
+{
+	if (!src)
+		return false;
+	if (!frame)
+		frame = av_frame_alloc();
+	else
+		av_frame_unref(frame);
+	if (!frame)
+		return false;
+	av_frame_move_ref(frame, src);
+	return true;
+}
+
+void FrameHandle::Attach(AVFrame* src)
+{
+	av_frame_free(&frame);
+	frame = src;
+}
+
+void FrameHandle::Reset()
+{
+	if (frame)
+		av_frame_unref(frame);
+}
+
+int FrameHandle::PlaneCount() const
+{
+	if (!frame)
+		return 0;
+	int planes = 0;
+	while (planes < AV_NUM_DATA_POINTERS && frame->data[planes])
+		++planes;
+	return planes;
+}
+
+const uint8_t* FrameHandle::Data(int plane) const
+{
+	if (!frame || plane < 0 || plane >= AV_NUM_DATA_POINTERS)
+		return nullptr;
+	return frame->data[plane];
+}
+
+int FrameHandle::Stride(int plane) const
+{
+	if (!frame || plane < 0 || plane >= AV_NUM_DATA_POINTERS)
+		return 0;
+	return frame->linesize[plane];
+}
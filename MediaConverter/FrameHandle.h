@@ -0,0 +1,48 @@
+#pragma once
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+}
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+/*
+* refcounted reference to a decoded (or converted) AVFrame. copies add a reference to the same
+* buffers, nothing is duplicated, and the buffers are released when the last handle lets go
+*/
+class MEDIACONVERTER_API FrameHandle
+{
+public:
+	FrameHandle();
+	explicit FrameHandle(const AVFrame* src);
+	FrameHandle(const FrameHandle& other);
+	FrameHandle(FrameHandle&& other);
+	~FrameHandle();
+	FrameHandle& operator=(const FrameHandle& other);
+	FrameHandle& operator=(FrameHandle&& other);
+
+	bool Ref(const AVFrame* src); //drops the current frame and references src
+	bool MoveFrom(AVFrame* src); //takes over the references held by src, src is left blank
+	void Attach(AVFrame* src); //takes ownership of src itself
+	void Reset();
+
+	bool IsValid() const { return frame && frame->data[0]; }
+	const AVFrame* Get() const { return frame; }
+
+	int Width() const { return frame ? frame->width : 0; }
+	int Height() const { return frame ? frame->height : 0; }
+	AVPixelFormat PixelFormat() const { return frame ? (AVPixelFormat)frame->format : AV_PIX_FMT_NONE; }
+	int64_t Pts() const { return frame ? frame->pts : AV_NOPTS_VALUE; }
+	bool IsKeyFrame() const { return frame && frame->key_frame; }
+	int PlaneCount() const;
+	const uint8_t* Data(int plane) const;
+	int Stride(int plane) const;
+
+private:
+	AVFrame* frame = nullptr;
+};
@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "framework.h"
+#include "FrameIndex.h"
+#include <algorithm>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace
+{
+	const uint32_t kIndexMagic = 0x4946434d; //"MCFI"
+	const uint32_t kIndexVersion = 1;
+
+	struct IndexHeader
+	{
+		uint32_t magic = kIndexMagic;
+		uint32_t version = kIndexVersion;
+		int64_t source_size = -1;
+		int64_t source_mtime = -1;
+		int32_t stream_index = -1;
+		int32_t reserved = 0;
+		uint64_t count = 0;
+	};
+
+	//size + mtime is what we use to decide if a sidecar still belongs to the media file
+	bool sourceFileStats(const char* sourceFile, int64_t& size, int64_t& mtime)
+	{
+#ifdef _WIN32
+		struct _stat64 st;
+		if (_stat64(sourceFile, &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(sourceFile, &st) != 0)
+			return false;
+#endif
+		size = (int64_t)st.st_size;
+		mtime = (int64_t)st.st_mtime;
+		return true;
+	}
+}
+
+FrameIndex::FrameIndex()
+{
+}
+
+FrameIndex::~FrameIndex()
+{
+}
+
+int FrameIndex::Build(AVFormatContext* fmt_ctx, int streamIndex)
+{
+	if (!fmt_ctx || streamIndex < 0 || streamIndex >= (int)fmt_ctx->nb_streams)
+		return AVERROR(EINVAL);
+
+	entries.clear();
+	key_frames.clear();
+	stream_index = streamIndex;
+
+	//allocated before the discard flags change, so every return after that goes through the restore below
+	AVPacket* pkt = av_packet_alloc();
+	if (!pkt)
+		return AVERROR(ENOMEM);
+
+	//let the demuxer skip everything but the indexed stream while scanning
+	std::vector<AVDiscard> discards(fmt_ctx->nb_streams);
+	for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i)
+	{
+		discards[i] = fmt_ctx->streams[i]->discard;
+		if ((int)i != streamIndex)
+			fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+	}
+
+	int ret = 0;
+	while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0)
+	{
+		if (pkt->stream_index == streamIndex)
+		{
+			FrameIndexEntry entry;
+			entry.pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+			entry.dts = pkt->dts;
+			entry.pos = pkt->pos;
+			entry.size = pkt->size;
+			entry.key_frame = (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0;
+			entries.push_back(entry);
+		}
+		av_packet_unref(pkt);
+	}
+	av_packet_free(&pkt);
+
+	for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i)
+		fmt_ctx->streams[i]->discard = discards[i];
+
+	finalize();
+
+	int64_t start = entries.empty() ? 0 : entries.front().pts;
+	av_seek_frame(fmt_ctx, streamIndex, start, AVSEEK_FLAG_BACKWARD);
+
+	if (ret != AVERROR_EOF)
+		return ret;
+	return 0;
+}
+
+void FrameIndex::finalize()
+{
+	entries.erase(std::remove_if(entries.begin(), entries.end(),
+		[](const FrameIndexEntry& e) { return e.pts == AV_NOPTS_VALUE; }), entries.end());
+
+	//packets arrive in decode order, frame numbers are in presentation order
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const FrameIndexEntry& a, const FrameIndexEntry& b) { return a.pts < b.pts; });
+
+	key_frames.clear();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].key_frame)
+			key_frames.push_back(i);
+	}
+
+	int64_t shortest = INT64_MAX, longest = 0;
+	for (size_t i = 1; i < entries.size(); ++i)
+	{
+		int64_t gap = entries[i].pts - entries[i - 1].pts;
+		shortest = (std::min)(shortest, gap);
+		longest = (std::max)(longest, gap);
+	}
+	constant_rate = entries.size() < 3 || longest - shortest <= 1;
+}
+
+int64_t FrameIndex::FramePts(int64_t frameNumber) const
+{
+	if (frameNumber < 0 || frameNumber >= (int64_t)entries.size())
+		return AV_NOPTS_VALUE;
+	return entries[(size_t)frameNumber].pts;
+}
+
+int64_t FrameIndex::FrameNumberAt(int64_t pts) const
+{
+	return FrameNumber(FrameAtOrBefore(pts));
+}
+
+const FrameIndexEntry* FrameIndex::FrameAtOrBefore(int64_t pts) const
+{
+	if (entries.empty())
+		return nullptr;
+
+	auto it = std::upper_bound(entries.begin(), entries.end(), pts,
+		[](int64_t value, const FrameIndexEntry& e) { return value < e.pts; });
+	if (it == entries.begin())
+		return &entries.front();
+	return &*(it - 1);
+}
+
+const FrameIndexEntry* FrameIndex::KeyFrameAtOrBefore(int64_t pts) const
+{
+	if (key_frames.empty())
+		return entries.empty() ? nullptr : &entries.front();
+
+	auto it = std::upper_bound(key_frames.begin(), key_frames.end(), pts,
+		[this](int64_t value, size_t pos) { return value < entries[pos].pts; });
+	if (it == key_frames.begin())
+		return &entries[key_frames.front()];
+	return &entries[*(it - 1)];
+}
+
+bool FrameIndex::Save(const char* indexPath, const char* sourceFile) const
+{
+	if (!indexPath || !sourceFile || entries.empty())
+		return false;
+
+	IndexHeader header;
+	if (!sourceFileStats(sourceFile, header.source_size, header.source_mtime))
+		return false;
+	header.stream_index = stream_index;
+	header.count = entries.size();
+
+	std::ofstream out(indexPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)entries.data(), entries.size() * sizeof(FrameIndexEntry));
+	return out.good();
+}
+
+bool FrameIndex::Load(const char* indexPath, const char* sourceFile, int streamIndex)
+{
+	if (!indexPath || !sourceFile)
+		return false;
+
+	std::ifstream in(indexPath, std::ios::binary);
+	if (!in)
+		return false;
+
+	IndexHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || header.magic != kIndexMagic || header.version != kIndexVersion || header.stream_index != streamIndex)
+		return false;
+
+	int64_t size = -1, mtime = -1;
+	if (!sourceFileStats(sourceFile, size, mtime) || size != header.source_size || mtime != header.source_mtime)
+		return false;
+
+	//a corrupt count must not size the vector, the entries have to actually be in the file
+	std::streamoff body = in.tellg();
+	in.seekg(0, std::ios::end);
+	std::streamoff remaining = in.tellg() - body;
+	in.seekg(body);
+	if (!in || remaining < 0 || header.count > (uint64_t)remaining / sizeof(FrameIndexEntry))
+		return false;
+
+	std::vector<FrameIndexEntry> loaded((size_t)header.count);
+	in.read((char*)loaded.data(), loaded.size() * sizeof(FrameIndexEntry));
+	if (!in)
+		return false;
+
+	entries.swap(loaded);
+	stream_index = streamIndex;
+	finalize();
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+#include <vector>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+struct FrameIndexEntry
+{
+	int64_t pts = AV_NOPTS_VALUE;
+	int64_t dts = AV_NOPTS_VALUE;
+	int64_t pos = -1;
+	int32_t size = 0;
+	int32_t key_frame = 0;
+};
+
+/*
+* per frame pts/dts/size and keyframe positions of one stream, gathered from a packet-only scan (nothing is decoded).
+* entries are kept in presentation order so the position of an entry is its frame number
+*/
+class MEDIACONVERTER_API FrameIndex
+{
+public:
+	FrameIndex();
+	~FrameIndex();
+
+	int Build(AVFormatContext* fmt_ctx, int streamIndex); //returns 0 or an AVERROR, leaves the context rewound to the start
+	bool Save(const char* indexPath, const char* sourceFile) const;
+	bool Load(const char* indexPath, const char* sourceFile, int streamIndex); //false if missing or stale
+
+	bool IsEmpty() const { return entries.empty(); }
+	size_t FrameCount() const { return entries.size(); }
+	size_t KeyFrameCount() const { return key_frames.size(); }
+	int StreamIndex() const { return stream_index; }
+	const std::vector<FrameIndexEntry>& Entries() const { return entries; }
+
+	const FrameIndexEntry* FrameAtOrBefore(int64_t pts) const;
+	const FrameIndexEntry* KeyFrameAtOrBefore(int64_t pts) const;
+	int64_t FrameNumber(const FrameIndexEntry* entry) const { return entry ? entry - &entries[0] : -1; }
+	int64_t FramePts(int64_t frameNumber) const; //AV_NOPTS_VALUE out of range
+	int64_t FrameNumberAt(int64_t pts) const; //the frame showing at pts, 0 before the first one, -1 when empty
+	//every gap between frames within a tick of the others, a rounded 29.97 in a 1/1000 time base still counts
+	bool IsConstantRate() const { return constant_rate; }
+
+private:
+	void finalize();
+
+	std::vector<FrameIndexEntry> entries;
+	std::vector<size_t> key_frames; //positions in entries, ascending pts
+	bool constant_rate = true;
+	int stream_index = -1;
+};
@@ -0,0 +1,308 @@
+#include "pch.h"
+#include "framework.h"
+#include "HeadEncoder.h"
+#include <cstring>
+
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+namespace
+{
+	void appendNal(std::vector<uint8_t>& out, const uint8_t* nal, size_t size, int lengthSize)
+	{
+		for (int i = lengthSize - 1; i >= 0; --i)
+			out.push_back((uint8_t)(size >> (8 * i)));
+		out.insert(out.end(), nal, nal + size);
+	}
+
+	//swaps pkt's payload for data, keeping timestamps/flags/side data
+	bool replacePayload(AVPacket* pkt, const std::vector<uint8_t>& data)
+	{
+		AVPacket* replaced = av_packet_alloc();
+		if (!replaced || av_new_packet(replaced, (int)data.size()) < 0 || av_packet_copy_props(replaced, pkt) < 0)
+		{
+			av_packet_free(&replaced);
+			return false;
+		}
+		memcpy(replaced->data, data.data(), data.size());
+		av_packet_unref(pkt);
+		av_packet_move_ref(pkt, replaced);
+		av_packet_free(&replaced);
+		return true;
+	}
+}
+
+HeadEncoder::HeadEncoder()
+{
+}
+
+HeadEncoder::~HeadEncoder()
+{
+	for (AVPacket*& pkt : encoded)
+		av_packet_free(&pkt);
+	avcodec_free_context(&dec_ctx);
+	avcodec_free_context(&enc_ctx);
+}
+
+bool HeadEncoder::Supported(const AVCodecParameters* par)
+{
+	if (par->codec_type != AVMEDIA_TYPE_VIDEO || !avcodec_find_encoder(par->codec_id))
+		return false;
+
+	//hvcC hevc would need the same nal rewriting as avcC h264, which is all that's handled
+	bool length_prefixed = par->extradata && par->extradata_size > 0 && par->extradata[0] == 1;
+	return !(par->codec_id == AV_CODEC_ID_HEVC && length_prefixed);
+}
+
+ErrorCode HeadEncoder::Open(const AVStream* stream, AVRational frameRate, const char* encoderName, int64_t start)
+{
+	const AVCodecParameters* par = stream->codecpar;
+	this->start = start;
+	stream_time_base = stream->time_base;
+
+	AVCodec* decoder = avcodec_find_decoder(par->codec_id);
+	if (!decoder)
+		return ErrorCode::NO_CODEC;
+	dec_ctx = avcodec_alloc_context3(decoder);
+	if (!dec_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+	if (avcodec_parameters_to_context(dec_ctx, par) < 0)
+		return ErrorCode::CODEC_CTX_UNINIT;
+	dec_ctx->pkt_timebase = stream->time_base;
+	if (avcodec_open2(dec_ctx, decoder, nullptr) < 0)
+		return ErrorCode::CODEC_UNOPENED;
+
+	//has to produce the same codec as the packets it sits in front of
+	AVCodec* encoder = encoderName ? avcodec_find_encoder_by_name(encoderName) : avcodec_find_encoder(par->codec_id);
+	if (!encoder || encoder->id != par->codec_id)
+		return ErrorCode::NO_CODEC;
+	enc_ctx = avcodec_alloc_context3(encoder);
+	if (!enc_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+
+	AVPixelFormat src_fmt = par->format != AV_PIX_FMT_NONE ? (AVPixelFormat)par->format : AV_PIX_FMT_YUV420P;
+	enc_ctx->width = par->width;
+	enc_ctx->height = par->height;
+	enc_ctx->sample_aspect_ratio = par->sample_aspect_ratio;
+	enc_ctx->pix_fmt = encoder->pix_fmts ? avcodec_find_best_pix_fmt_of_list(encoder->pix_fmts, src_fmt, 0, nullptr) : src_fmt;
+	enc_ctx->color_range = par->color_range;
+	enc_ctx->colorspace = par->color_space;
+	enc_ctx->color_primaries = par->color_primaries;
+	enc_ctx->color_trc = par->color_trc;
+
+	if (frameRate.num <= 0 || frameRate.den <= 0)
+		frameRate = AVRational{ 25, 1 };
+	enc_ctx->framerate = frameRate;
+	enc_ctx->time_base = av_inv_q(frameRate);
+
+	//no reordering, so the packets come out in presentation order and Finish can squeeze the dts in
+	enc_ctx->max_b_frames = 0;
+	if (par->bit_rate > 0)
+		enc_ctx->bit_rate = par->bit_rate;
+	else if (!enc_ctx->priv_data || !av_opt_find(enc_ctx->priv_data, "crf", nullptr, 0, 0))
+	{
+		enc_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+		enc_ctx->global_quality = FF_QP2LAMBDA * 3;
+	}
+
+	//no AV_CODEC_FLAG_GLOBAL_HEADER, the headers have to travel in-band with these frames
+	if (avcodec_open2(enc_ctx, encoder, nullptr) < 0)
+		return ErrorCode::CODEC_UNOPENED;
+
+	if (par->codec_id == AV_CODEC_ID_H264 && par->extradata_size >= 7 && par->extradata[0] == 1)
+	{
+		//avcC: 5 byte header (last 2 bits = nal length - 1), sps count + [len, sps], pps count + [len, pps]
+		nal_length_size = (par->extradata[4] & 3) + 1;
+		const uint8_t* p = par->extradata + 5;
+		const uint8_t* end = par->extradata + par->extradata_size;
+		for (int set = 0; set < 2 && p < end; ++set)
+		{
+			int count = set == 0 ? (*p++ & 0x1f) : *p++;
+			for (int i = 0; i < count && p + 2 <= end; ++i)
+			{
+				size_t size = (p[0] << 8) | p[1];
+				p += 2;
+				if (p + size > end)
+					break;
+				appendNal(join_prefix, p, size, nal_length_size);
+				p += size;
+			}
+		}
+	}
+
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode HeadEncoder::Decode(const AVPacket* pkt)
+{
+	//leading pictures can fail to decode without their references, which only costs frames before the cut
+	avcodec_send_packet(dec_ctx, pkt);
+	return receiveFrames();
+}
+
+ErrorCode HeadEncoder::receiveFrames()
+{
+	AVFrame* frame = av_frame_alloc();
+	if (!frame)
+		return ErrorCode::NO_FRAME;
+
+	ErrorCode ret = ErrorCode::SUCCESS;
+	while (ret == ErrorCode::SUCCESS && avcodec_receive_frame(dec_ctx, frame) >= 0)
+	{
+		int64_t pts = frame->best_effort_timestamp;
+		if (pts == AV_NOPTS_VALUE || pts < start || (end != AV_NOPTS_VALUE && pts >= end))
+		{
+			av_frame_unref(frame);
+			continue;
+		}
+
+		AVFrame* input = frame;
+		AVFrame* converted = nullptr;
+		if (frame->format != enc_ctx->pix_fmt || frame->width != enc_ctx->width || frame->height != enc_ctx->height)
+		{
+			ScalerKey key;
+			key.src_width = frame->width;
+			key.src_height = frame->height;
+			key.src_fmt = (AVPixelFormat)frame->format;
+			key.dst_width = enc_ctx->width;
+			key.dst_height = enc_ctx->height;
+			key.dst_fmt = enc_ctx->pix_fmt;
+			key.flags = SWS_BICUBIC;
+			key.colorspace = frame->colorspace;
+			key.color_range = frame->color_range;
+
+			SwsContext* sws = scalers.Get(key);
+			converted = av_frame_alloc();
+			converted->format = enc_ctx->pix_fmt;
+			converted->width = enc_ctx->width;
+			converted->height = enc_ctx->height;
+			if (!sws || av_frame_get_buffer(converted, 32) < 0)
+			{
+				av_frame_free(&converted);
+				ret = ErrorCode::NO_SCALER;
+				break;
+			}
+			sws_scale(sws, frame->data, frame->linesize, 0, frame->height, converted->data, converted->linesize);
+			av_frame_copy_props(converted, frame);
+			input = converted;
+		}
+
+		int64_t enc_pts = av_rescale_q(pts, stream_time_base, enc_ctx->time_base);
+		if (last_pts != AV_NOPTS_VALUE && enc_pts <= last_pts)
+			enc_pts = last_pts + 1;
+		last_pts = enc_pts;
+		input->pts = enc_pts;
+		input->pict_type = AV_PICTURE_TYPE_NONE;
+		if (enc_ctx->flags & AV_CODEC_FLAG_QSCALE)
+			input->quality = enc_ctx->global_quality;
+
+		if (avcodec_send_frame(enc_ctx, input) < 0)
+			ret = ErrorCode::PKT_NOT_DECODED;
+		else
+		{
+			++frames_encoded;
+			ret = receivePackets();
+		}
+		av_frame_free(&converted);
+		av_frame_unref(frame);
+	}
+
+	av_frame_free(&frame);
+	return ret;
+}
+
+ErrorCode HeadEncoder::receivePackets()
+{
+	while (true)
+	{
+		AVPacket* pkt = av_packet_alloc();
+		if (!pkt)
+			return ErrorCode::NO_PACKET;
+
+		int ret = avcodec_receive_packet(enc_ctx, pkt);
+		if (ret < 0)
+		{
+			av_packet_free(&pkt);
+			return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? ErrorCode::SUCCESS : ErrorCode::PKT_NOT_RECEIVED;
+		}
+		encoded.push_back(pkt);
+	}
+}
+
+ErrorCode HeadEncoder::Finish(int64_t nextDts, std::vector<AVPacket*>& packets)
+{
+	avcodec_send_packet(dec_ctx, nullptr);
+	ErrorCode ret = receiveFrames();
+	if (ret != ErrorCode::SUCCESS)
+		return ret;
+
+	avcodec_send_frame(enc_ctx, nullptr);
+	ret = receivePackets();
+	if (ret != ErrorCode::SUCCESS)
+		return ret;
+
+	//dts follow pts until they'd run into the copied keyframe, then step one tick at a time below it
+	int64_t count = (int64_t)encoded.size();
+	for (int64_t i = 0; i < count; ++i)
+	{
+		AVPacket* pkt = encoded[(size_t)i];
+		av_packet_rescale_ts(pkt, enc_ctx->time_base, stream_time_base);
+		if (nextDts != AV_NOPTS_VALUE)
+			pkt->dts = (std::min)(pkt->pts, nextDts - (count - i));
+		else
+			pkt->dts = pkt->pts;
+
+		if (nal_length_size > 0 && !toLengthPrefixed(pkt))
+			return ErrorCode::NO_PACKET;
+		packets.push_back(pkt);
+	}
+	encoded.clear();
+	return ErrorCode::SUCCESS;
+}
+
+bool HeadEncoder::toLengthPrefixed(AVPacket* pkt) const
+{
+	const uint8_t* data = pkt->data;
+	size_t size = (size_t)pkt->size;
+	std::vector<uint8_t> out;
+	out.reserve(size + 16);
+
+	//annex b: nals separated by 00 00 01 (or 00 00 00 01), trailing zeros belong to the next start code
+	const size_t none = (size_t)-1;
+	size_t nal_start = none;
+	for (size_t i = 0; i + 2 < size;)
+	{
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+		{
+			if (nal_start != none && nal_start < i)
+			{
+				size_t end = i;
+				while (end > nal_start && data[end - 1] == 0)
+					--end;
+				appendNal(out, data + nal_start, end - nal_start, nal_length_size);
+			}
+			i += 3;
+			nal_start = i;
+		}
+		else
+			++i;
+	}
+	if (nal_start == none)
+		return true; //no start codes, already length prefixed
+	if (nal_start < size)
+		appendNal(out, data + nal_start, size - nal_start, nal_length_size);
+
+	return replacePayload(pkt, out);
+}
+
+ErrorCode HeadEncoder::PrepareJoin(AVPacket* key) const
+{
+	if (join_prefix.empty())
+		return ErrorCode::SUCCESS;
+
+	std::vector<uint8_t> data(join_prefix);
+	data.insert(data.end(), key->data, key->data + key->size);
+	return replacePayload(key, data) ? ErrorCode::SUCCESS : ErrorCode::NO_PACKET;
+}
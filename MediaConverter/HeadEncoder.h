@@ -0,0 +1,52 @@
+#pragma once
+#include "MediaConverter.h"
+#include "ScalerCache.h"
+#include <vector>
+
+/*
+* frame accurate start for the remuxing encodeMedia. the packets from the keyframe before the cut up to the
+* next keyframe are decoded here, the frames from the cut on are re-encoded with the source codec and the
+* stream is copied again from that next keyframe. the re-encoded frames carry their own parameter sets
+* in-band; for avcC h264 they are rewritten to length prefixed nals, and the source's sps/pps are put back
+* in front of the keyframe where copying resumes so the decoder switches back
+*/
+class MEDIACONVERTER_API HeadEncoder
+{
+public:
+	HeadEncoder();
+	~HeadEncoder();
+	HeadEncoder(const HeadEncoder&) = delete;
+	HeadEncoder& operator=(const HeadEncoder&) = delete;
+
+	static bool Supported(const AVCodecParameters* par); //false for codecs whose in-band headers can't be mixed with copied packets
+
+	//start is the cut in the stream's time_base, encoderName may be null for the codec's default encoder
+	ErrorCode Open(const AVStream* stream, AVRational frameRate, const char* encoderName, int64_t start);
+	ErrorCode Decode(const AVPacket* pkt);
+	//pts of the keyframe copying resumes on, frames from there on are dropped. set it before that keyframe goes
+	//into Decode, leading pictures after it in decode order still need it as a reference
+	void SetEnd(int64_t end) { this->end = end; }
+	//flushes everything, packets come back with timestamps in the stream's time_base and every dts below nextDts
+	ErrorCode Finish(int64_t nextDts, std::vector<AVPacket*>& packets);
+	//source sps/pps in front of the keyframe copying resumes on, a no-op unless the stream is avcC h264
+	ErrorCode PrepareJoin(AVPacket* key) const;
+
+	int64_t FramesEncoded() const { return frames_encoded; }
+
+private:
+	ErrorCode receiveFrames();
+	ErrorCode receivePackets();
+	bool toLengthPrefixed(AVPacket* pkt) const;
+
+	AVCodecContext* dec_ctx = nullptr;
+	AVCodecContext* enc_ctx = nullptr;
+	AVRational stream_time_base = { 0, 1 };
+	int64_t start = AV_NOPTS_VALUE;
+	int64_t end = AV_NOPTS_VALUE;
+	int64_t last_pts = AV_NOPTS_VALUE;
+	int64_t frames_encoded = 0;
+	int nal_length_size = 0; //0 when the source isn't length prefixed h264
+	std::vector<uint8_t> join_prefix; //source parameter sets, already length prefixed
+	std::vector<AVPacket*> encoded; //in encoder time_base until Finish
+	ScalerCache scalers;
+};
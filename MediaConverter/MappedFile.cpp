@@ -0,0 +1,178 @@
+#include "pch.h"
+#include "framework.h"
+#include "MappedFile.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#endif
+
+MappedFile::MappedFile()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+	if (!filename)
+		return false;
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	file = handle;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		Close();
+		return false;
+	}
+	data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+#else
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	data = (uint8_t*)view;
+	size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	if (data)
+		munmap(data, size);
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	data = nullptr;
+	size = 0;
+	pattern = AccessPattern::Normal;
+}
+
+bool MappedFile::Advise(AccessPattern pattern)
+{
+	if (!data)
+		return false;
+	this->pattern = pattern;
+#ifdef _WIN32
+	return true;
+#else
+	int advice = pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : pattern == AccessPattern::Random ? MADV_RANDOM : MADV_NORMAL;
+	return madvise(data, size, advice) == 0;
+#endif
+}
+
+bool MappedFile::WillNeed(size_t offset, size_t length)
+{
+	if (!data || offset >= size)
+		return false;
+	length = (std::min)(length, size - offset);
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = data + offset;
+	range.NumberOfBytes = length;
+	return PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0) != 0;
+#else
+	//madvise wants a page aligned start
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t aligned = offset - offset % page;
+	return madvise(data + aligned, length + (offset - aligned), MADV_WILLNEED) == 0;
+#endif
+}
+
+ProcessIoCounters ProcessIoCounters::Sample()
+{
+	ProcessIoCounters counters;
+#ifdef _WIN32
+	IO_COUNTERS io;
+	if (GetProcessIoCounters(GetCurrentProcess(), &io))
+	{
+		counters.read_syscalls = (int64_t)io.ReadOperationCount;
+		counters.bytes_read = (int64_t)io.ReadTransferCount;
+	}
+	PROCESS_MEMORY_COUNTERS memory;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+	{
+		counters.page_faults = (int64_t)memory.PageFaultCount;
+		counters.peak_rss = (int64_t)memory.PeakWorkingSetSize;
+	}
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		counters.page_faults = (int64_t)usage.ru_minflt + (int64_t)usage.ru_majflt;
+#ifdef __APPLE__
+		counters.peak_rss = (int64_t)usage.ru_maxrss;
+#else
+		counters.peak_rss = (int64_t)usage.ru_maxrss * 1024; //KB everywhere but macOS
+#endif
+	}
+
+	//linux only, left at -1 elsewhere
+	std::ifstream io("/proc/self/io");
+	std::string key;
+	int64_t value;
+	while (io >> key >> value)
+	{
+		if (key == "syscr:")
+			counters.read_syscalls = value;
+		else if (key == "rchar:")
+			counters.bytes_read = value;
+	}
+#endif
+	return counters;
+}
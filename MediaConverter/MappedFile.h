@@ -0,0 +1,64 @@
+#pragma once
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+enum class MEDIACONVERTER_API AccessPattern : int
+{
+	Normal,
+	Sequential, //aggressive read-ahead, pages behind the reader can be dropped early
+	Random //no read-ahead, only what's touched (or asked for with WillNeed) is read in
+};
+
+/*
+* read only view of a whole file. reads become page faults on the mapping instead of read() calls into
+* a buffer; Advise/WillNeed are madvise(MADV_SEQUENTIAL/MADV_RANDOM/MADV_WILLNEED) on posix. windows has
+* no access pattern hint for a view, there Advise only records the pattern and WillNeed is
+* PrefetchVirtualMemory, which is what MediaInput uses to do the sequential read-ahead itself
+*/
+class MEDIACONVERTER_API MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const char* filename);
+	void Close();
+
+	bool IsOpen() const { return data != nullptr; }
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+	bool Advise(AccessPattern pattern);
+	bool WillNeed(size_t offset, size_t length); //starts reading the range in without waiting for it
+	AccessPattern Pattern() const { return pattern; }
+
+private:
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	AccessPattern pattern = AccessPattern::Normal;
+};
+
+//process wide, take one before and one after and subtract. -1 where the platform doesn't report it
+struct MEDIACONVERTER_API ProcessIoCounters
+{
+	int64_t read_syscalls = -1; //ReadFile/read() calls
+	int64_t page_faults = -1; //soft + hard
+	int64_t bytes_read = -1; //through read calls, mapped reads don't show up here
+	int64_t peak_rss = -1; //bytes, high water mark of the resident set since the process started
+
+	static ProcessIoCounters Sample();
+};
@@ -3,8 +3,39 @@
 #include "pch.h"
 #include "framework.h"
 #include "MediaConverter.h"
+#include "ColorConverter.h"
+#include "DecoderPool.h"
+#include "HeadEncoder.h"
+#include "MediaInput.h"
+#include "SegmentTranscoder.h"
+#include "StreamingOutput.h"
+#include "Transcoder.h"
+#include <chrono>
 #include <thread>
 
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double elapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    //pts can be missing where the decoder's guess isn't
+    int64_t framePts(const AVFrame* frame)
+    {
+        if (!frame)
+            return AV_NOPTS_VALUE;
+        return frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+    }
+}
+
 // This is the constructor of a class that has been exported.
 CMediaConverter::CMediaConverter()
 {
@@ -20,73 +51,75 @@ ErrorCode CMediaConverter::openVideoReader(const char* filename)
 }
 
 ErrorCode CMediaConverter::openVideoReader(MediaReaderState* state, const char* filename)
+{
+    return openVideoReader(state, filename, OpenOptions());
+}
+
+ErrorCode CMediaConverter::openVideoReader(MediaReaderState* state, const char* filename, const OpenOptions& options)
+{
+    return openVideoReader(state, options.map_file ? MediaInput::FromMappedFile(filename) : MediaInput::FromFile(filename), options);
+}
+
+ErrorCode CMediaConverter::openVideoReader(MediaReaderState* state, const MediaInput& input, const OpenOptions& options)
 {
     auto& av_format_ctx = state->av_format_ctx;
-    auto& av_codec_ctx = state->video_codec_ctx;
     auto& av_frame = state->av_frame;
     auto& av_packet = state->av_packet;
-    auto& sws_scaler_ctx = state->sws_scaler_ctx;
 
-    av_format_ctx = avformat_alloc_context();
-    if (!av_format_ctx)
-        return ErrorCode::NO_FMT_CTX;
-
-    if (avformat_open_input(&av_format_ctx, filename, NULL, NULL)) //returns 0 on success
-        return ErrorCode::FMT_UNOPENED;
+    ErrorCode opened = input.Open(&av_format_ctx, &state->av_io_ctx);
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
 
     if (av_format_ctx->nb_streams < 1)
         return ErrorCode::NO_STREAMS;
 
     state->av_format_ctx->seek2any = 1;
 
+    //without this avg_frame_rate/duration are only what the container header happens to store
+    if (options.find_stream_info)
+    {
+        if (options.probe_size > 0)
+            av_format_ctx->probesize = options.probe_size;
+        if (options.analyze_duration > 0)
+            av_format_ctx->max_analyze_duration = options.analyze_duration;
+        if (avformat_find_stream_info(av_format_ctx, nullptr) < 0)
+            return ErrorCode::NO_STREAMS;
+    }
+
+    //the best stream of each selected type that has a decoder, data/subtitle tracks and undecodable streams are left out
+    int wanted = (int)options.streams;
+    AVCodec* decoder = nullptr;
     state->video_stream_index = -1;
     state->audio_stream_index = -1;
-    AVCodec* av_codec = nullptr;
-    AVCodecParameters* av_codec_params = nullptr;
+    bool undecodable = false;
+    if (wanted & (int)StreamSelection::Video)
+    {
+        int ret = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+        state->video_stream_index = (std::max)(ret, -1);
+        undecodable |= ret == AVERROR_DECODER_NOT_FOUND;
+    }
+    if (wanted & (int)StreamSelection::Audio)
+    {
+        int ret = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_AUDIO, -1, state->video_stream_index, &decoder, 0);
+        state->audio_stream_index = (std::max)(ret, -1);
+        undecodable |= ret == AVERROR_DECODER_NOT_FOUND;
+    }
+    if (!state->HasVideoStream() && !state->HasAudioStream())
+        return undecodable ? ErrorCode::NO_CODEC : ErrorCode::NO_STREAMS;
 
     for (unsigned int i = 0; i < av_format_ctx->nb_streams; ++i)
     {
-        auto stream = av_format_ctx->streams[i];
-        av_codec_params = av_format_ctx->streams[i]->codecpar;
-
-        av_codec = avcodec_find_decoder(av_codec_params->codec_id);
-        if (!av_codec)
-            return ErrorCode::NO_CODEC;
-
-        if (av_codec_params->codec_type == AVMEDIA_TYPE_VIDEO)
-        {
-            state->video_stream_index = i;
-
-            av_codec_ctx = avcodec_alloc_context3(av_codec);
-            if (!av_codec_ctx)
-                return ErrorCode::NO_CODEC_CTX;
-
-            av_codec_ctx->thread_count = std::thread::hardware_concurrency();
-
-            if (avcodec_parameters_to_context(av_codec_ctx, av_codec_params) < 0)
-                return ErrorCode::CODEC_CTX_UNINIT;
-
-            if (avcodec_open2(av_codec_ctx, av_codec, NULL) < 0)
-                return ErrorCode::CODEC_UNOPENED;
-        }
-        else if (av_codec_params->codec_type == AVMEDIA_TYPE_AUDIO)
-        {
-            state->audio_stream_index = i;
-            state->audio_codec_ctx = avcodec_alloc_context3(av_codec);
-            if (!state->audio_codec_ctx)
-                return ErrorCode::NO_CODEC_CTX;
-
-            state->audio_codec_ctx->thread_count = 8;
-
-            if (avcodec_parameters_to_context(state->audio_codec_ctx, av_codec_params) < 0)
-                return ErrorCode::CODEC_CTX_UNINIT;
-
-            if (avcodec_open2(state->audio_codec_ctx, av_codec, NULL) < 0)
-                return ErrorCode::CODEC_UNOPENED;
+        if ((int)i != state->video_stream_index && (int)i != state->audio_stream_index)
+            av_format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
 
-            if (state->audio_codec_ctx->channel_layout == 0)
-                state->audio_codec_ctx->channel_layout = AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT;
-        }
+    state->pool_decoders = options.pool_decoders;
+    state->threading = options.threading;
+    if (!options.lazy_decoders)
+    {
+        ErrorCode ret = state->OpenDecoders();
+        if (ret != ErrorCode::SUCCESS)
+            return ret;
     }
 
     av_frame = av_frame_alloc();
@@ -97,6 +130,20 @@ ErrorCode CMediaConverter::openVideoReader(MediaReaderState* state, const char*
     if (!av_packet)
         return ErrorCode::NO_PACKET;
 
+    if (options.build_index && state->HasVideoStream())
+    {
+        //the sidecar is keyed on the source file, Filename() is null for in-memory/callback input so that always scans
+        const char* filename = input.Filename();
+        auto index = std::make_shared<FrameIndex>();
+        if (!index->Load(options.index_path, filename, state->video_stream_index))
+        {
+            if (index->Build(av_format_ctx, state->video_stream_index) >= 0 && options.index_path)
+                index->Save(options.index_path, filename);
+        }
+        if (!index->IsEmpty())
+            state->frame_index = index;
+    }
+
     state->SetIsOpened();
     return ErrorCode::SUCCESS;
 }
@@ -107,6 +154,47 @@ ErrorCode CMediaConverter::readVideoFrame(VideoBuffer& buffer)
 }
 
 ErrorCode CMediaConverter::readVideoFrame(MediaReaderState* state, VideoBuffer& buffer)
+{
+    FrameHandle frame;
+    ErrorCode ret = readVideoFrame(state, frame);
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
+
+    return (ErrorCode)outputToBuffer(state, frame, buffer);
+}
+
+ErrorCode CMediaConverter::readVideoFrame(MediaReaderState* state, VideoBuffer& buffer, const OutputOptions& options)
+{
+    FrameHandle frame;
+    ErrorCode ret = readVideoFrame(state, frame);
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
+
+    return (ErrorCode)outputToBuffer(state, frame, buffer, options);
+}
+
+ErrorCode CMediaConverter::readVideoFrame(FrameHandle& frame)
+{
+    return readVideoFrame(&m_mrState, frame);
+}
+
+ErrorCode CMediaConverter::readVideoFrame(MediaReaderState* state, FrameHandle& frame)
+{
+    if (state->demux_pipeline)
+    {
+        ErrorCode ret = (ErrorCode)state->demux_pipeline->PopVideo(frame);
+        if (ret == ErrorCode::SUCCESS)
+            state->videoFrameData.FillDataFromFrame(frame.Get());
+        return ret;
+    }
+
+    if (state->read_ahead)
+        return (ErrorCode)state->read_ahead->Pop(frame);
+
+    return decodeVideoFrame(state, frame);
+}
+
+ErrorCode CMediaConverter::decodeVideoFrame(MediaReaderState* state, FrameHandle& frame)
 {
     int response = processVideoPacketsIntoFrames(state);
 
@@ -116,7 +204,65 @@ ErrorCode CMediaConverter::readVideoFrame(MediaReaderState* state, VideoBuffer&
         return ErrorCode::FILE_EOF;
     }
 
-    return (ErrorCode)outputToBuffer(state, buffer);
+    if (response != (int)ErrorCode::SUCCESS)
+        return (ErrorCode)response;
+
+    //hand the decoder's references over, state->av_frame is left blank for the next receive
+    if (!frame.MoveFrom(state->av_frame))
+        return ErrorCode::NO_FRAME;
+
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::convertVideoFrame(MediaReaderState* state, const FrameHandle& src, FrameHandle& dst)
+{
+    return convertVideoFrame(state, src, dst, OutputOptions());
+}
+
+ErrorCode CMediaConverter::convertVideoFrame(MediaReaderState* state, const FrameHandle& src, FrameHandle& dst, const OutputOptions& options)
+{
+    if (!src.IsValid())
+        return ErrorCode::NO_FRAME;
+
+    int w = 0, h = 0;
+    resolveOutputSize(src.Get(), options, w, h);
+    int size = av_image_get_buffer_size(options.pix_fmt, w, h, 32);
+    if (size <= 0)
+        return ErrorCode::NO_DATA_AVAIL;
+
+    AVBufferPool* pool = state->GetConvertedFramePool(size);
+    if (!pool)
+        return ErrorCode::NO_FRAME;
+
+    AVFrame* out = av_frame_alloc();
+    if (!out)
+        return ErrorCode::NO_FRAME;
+
+    out->buf[0] = av_buffer_pool_get(pool);
+    if (!out->buf[0])
+    {
+        av_frame_free(&out);
+        return ErrorCode::NO_FRAME;
+    }
+    out->format = options.pix_fmt;
+    out->width = w;
+    out->height = h;
+    av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, options.pix_fmt, w, h, 32);
+    av_frame_copy_props(out, src.Get());
+
+    int ret;
+    {
+        TIME_STAGE(state->stage_timings.get(), Stage::VideoOutput);
+        ret = scaleFrame(state, src.Get(), out->data, out->linesize, w, h, options);
+    }
+    if (ret != (int)ErrorCode::SUCCESS)
+    {
+        av_frame_free(&out);
+        return (ErrorCode)ret;
+    }
+
+    dst.Attach(out);
+    return ErrorCode::SUCCESS;
 }
 
 ErrorCode CMediaConverter::readAudioFrame(AudioBuffer& audioBuffer)
@@ -124,8 +270,207 @@ ErrorCode CMediaConverter::readAudioFrame(AudioBuffer& audioBuffer)
     return readAudioFrame(&m_mrState, audioBuffer);
 }
 
+ErrorCode CMediaConverter::readAudioFrame(FrameHandle& frame)
+{
+    return readAudioFrame(&m_mrState, frame);
+}
+
+ErrorCode CMediaConverter::startReadAhead(const ReadAheadOptions& options)
+{
+    return startReadAhead(&m_mrState, options);
+}
+
+ErrorCode CMediaConverter::startReadAhead(MediaReaderState* state, const ReadAheadOptions& options)
+{
+    if (!state->IsOpened())
+        return ErrorCode::FMT_UNOPENED;
+    stopReadAhead(state);
+    stopDemuxPipeline(state);
+
+    //opened here rather than on the decode thread
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
+    if (!state->video_codec_ctx)
+        return ErrorCode::NO_CODEC_CTX;
+
+    //the decode thread gets its own scaler so it never shares the state's cache with the consumer
+    auto cache = std::make_shared<ScalerCache>();
+    ReadAheadQueue::Producer producer = [this, state, options, cache](FrameHandle& frame)
+    {
+        ErrorCode ret = decodeVideoFrame(state, frame);
+        if (ret != ErrorCode::SUCCESS || !options.convert)
+            return (int)ret;
+
+        FrameHandle converted;
+        ret = convertReadAheadFrame(frame, converted, options.output, *cache);
+        frame = std::move(converted);
+        return (int)ret;
+    };
+
+    state->read_ahead = std::make_shared<ReadAheadQueue>(producer, options.depth);
+    state->read_ahead->Start();
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::stopReadAhead()
+{
+    return stopReadAhead(&m_mrState);
+}
+
+ErrorCode CMediaConverter::stopReadAhead(MediaReaderState* state)
+{
+    //the queue's destructor cancels and joins the thread
+    state->read_ahead.reset();
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::getReadAheadStats(ReadAheadStats& stats)
+{
+    return getReadAheadStats(&m_mrState, stats);
+}
+
+ErrorCode CMediaConverter::getReadAheadStats(MediaReaderState* state, ReadAheadStats& stats)
+{
+    stats = ReadAheadStats();
+    if (!state->read_ahead)
+        return ErrorCode::SUCCESS;
+
+    stats.running = state->read_ahead->IsRunning();
+    stats.depth = state->read_ahead->Depth();
+    stats.capacity = state->read_ahead->Capacity();
+    stats.high_water = state->read_ahead->HighWater();
+    stats.underruns = state->read_ahead->Underruns();
+    stats.decoded = state->read_ahead->Decoded();
+    stats.discarded = state->read_ahead->Discarded();
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::startDemuxPipeline(const DemuxPipelineOptions& options)
+{
+    return startDemuxPipeline(&m_mrState, options);
+}
+
+ErrorCode CMediaConverter::startDemuxPipeline(MediaReaderState* state, const DemuxPipelineOptions& options)
+{
+    if (!state->IsOpened())
+        return ErrorCode::FMT_UNOPENED;
+    stopReadAhead(state);
+    stopDemuxPipeline(state);
+
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
+    if (!state->video_codec_ctx && !state->audio_codec_ctx)
+        return ErrorCode::NO_CODEC_CTX;
+
+    state->demux_pipeline = std::make_shared<DemuxPipeline>(state->av_format_ctx,
+        state->video_stream_index, state->video_codec_ctx, state->audio_stream_index, state->audio_codec_ctx,
+        options.packet_depth, options.frame_depth);
+    state->demux_pipeline->Start();
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::stopDemuxPipeline()
+{
+    return stopDemuxPipeline(&m_mrState);
+}
+
+ErrorCode CMediaConverter::stopDemuxPipeline(MediaReaderState* state)
+{
+    //the pipeline's destructor cancels and joins its threads
+    state->demux_pipeline.reset();
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::getDemuxPipelineStats(DemuxPipelineStats& stats)
+{
+    return getDemuxPipelineStats(&m_mrState, stats);
+}
+
+ErrorCode CMediaConverter::getDemuxPipelineStats(MediaReaderState* state, DemuxPipelineStats& stats)
+{
+    stats = DemuxPipelineStats();
+    if (!state->demux_pipeline)
+        return ErrorCode::SUCCESS;
+
+    stats.running = state->demux_pipeline->IsRunning();
+    stats.packets_read = state->demux_pipeline->PacketsRead();
+    stats.video_frames = state->demux_pipeline->VideoFrames();
+    stats.audio_frames = state->demux_pipeline->AudioFrames();
+    stats.discarded = state->demux_pipeline->Discarded();
+    stats.video_high_water = state->demux_pipeline->VideoHighWater();
+    stats.audio_high_water = state->demux_pipeline->AudioHighWater();
+    return ErrorCode::SUCCESS;
+}
+
+//anything that moves the demuxer or decoder has to get the read ahead and pipeline threads out of the way first
+void CMediaConverter::discardReadAhead(MediaReaderState* state)
+{
+    if (state->read_ahead)
+        state->read_ahead->Stop();
+    if (state->demux_pipeline)
+        state->demux_pipeline->Stop();
+}
+
+//reading on from where the read ahead thread got to, the frames it already decoded are still the next ones
+void CMediaConverter::pauseReadAhead(MediaReaderState* state)
+{
+    if (state->read_ahead)
+        state->read_ahead->Pause();
+}
+
+ErrorCode CMediaConverter::convertReadAheadFrame(const FrameHandle& src, FrameHandle& dst, const OutputOptions& options, ScalerCache& cache)
+{
+    if (!src.IsValid())
+        return ErrorCode::NO_FRAME;
+
+    int w = 0, h = 0;
+    resolveOutputSize(src.Get(), options, w, h);
+
+    AVFrame* out = av_frame_alloc();
+    if (!out)
+        return ErrorCode::NO_FRAME;
+
+    out->format = options.pix_fmt;
+    out->width = w;
+    out->height = h;
+    if (av_frame_get_buffer(out, 32) < 0)
+    {
+        av_frame_free(&out);
+        return ErrorCode::NO_FRAME;
+    }
+    av_frame_copy_props(out, src.Get());
+
+    int ret = scaleFrame(cache, nullptr, src.Get(), out->data, out->linesize, w, h, options);
+    if (ret != (int)ErrorCode::SUCCESS)
+    {
+        av_frame_free(&out);
+        return (ErrorCode)ret;
+    }
+
+    dst.Attach(out);
+    return ErrorCode::SUCCESS;
+}
+
 ErrorCode CMediaConverter::readAudioFrame(MediaReaderState* state, AudioBuffer& audioBuffer)
 {
+    if (state->demux_pipeline)
+    {
+        FrameHandle frame;
+        ErrorCode ret = (ErrorCode)state->demux_pipeline->PopAudio(frame);
+        if (ret != ErrorCode::SUCCESS)
+            return ret;
+
+        //resampled from the consumer's own frame, the decode thread never sees state->av_frame
+        av_frame_unref(state->av_frame);
+        if (av_frame_ref(state->av_frame, frame.Get()) < 0)
+            return ErrorCode::NO_FRAME;
+        state->audioFrameData.FillDataFromFrame(state->av_frame);
+        return (ErrorCode)outputToAudioBuffer(state, audioBuffer);
+    }
+
+    pauseReadAhead(state);
     int response = processAudioPacketsIntoFrames(state);
 
     if (response == AVERROR_EOF)
@@ -140,6 +485,34 @@ ErrorCode CMediaConverter::readAudioFrame(MediaReaderState* state, AudioBuffer&
     return (ErrorCode)response;
 }
 
+ErrorCode CMediaConverter::readAudioFrame(MediaReaderState* state, FrameHandle& frame)
+{
+    if (state->demux_pipeline)
+    {
+        ErrorCode ret = (ErrorCode)state->demux_pipeline->PopAudio(frame);
+        if (ret == ErrorCode::SUCCESS)
+            state->audioFrameData.FillDataFromFrame(frame.Get());
+        return ret;
+    }
+
+    pauseReadAhead(state);
+    int response = processAudioPacketsIntoFrames(state);
+
+    if (response == AVERROR_EOF)
+    {
+        avcodec_flush_buffers(state->audio_codec_ctx);
+        return ErrorCode::FILE_EOF;
+    }
+
+    if (response != (int)ErrorCode::SUCCESS)
+        return (ErrorCode)response;
+
+    if (!frame.MoveFrom(state->av_frame))
+        return ErrorCode::NO_FRAME;
+
+    return ErrorCode::SUCCESS;
+}
+
 /*
 * this returns int because the av_read_frame supercedes any other errors but those errors are sent back 
 * and can be handled if returned. av_read_frame returns negative for errors and 0 for success.
@@ -152,6 +525,11 @@ int CMediaConverter::processVideoPacketsIntoFrames()
 
 int CMediaConverter::processVideoPacketsIntoFrames(MediaReaderState* state)
 {
+    //lazily opened decoders have to exist before the first packet, the EOF paths flush them
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return (int)opened;
+
     //inital frame read, gives it an initial state to branch from
     int response = readFrame(state);
 
@@ -168,6 +546,10 @@ int CMediaConverter::processAudioPacketsIntoFrames()
 
 int CMediaConverter::processAudioPacketsIntoFrames(MediaReaderState* state)
 {
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return (int)opened;
+
     int response = readFrame(state);
 
     if (response >= 0)
@@ -180,6 +562,9 @@ int CMediaConverter::processAudioPacketsIntoFrames(MediaReaderState* state)
 
 int CMediaConverter::processVideoIntoFrames(MediaReaderState* state)
 {
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return (int)opened;
     if (!state->video_codec_ctx)
         return (int)ErrorCode::NO_CODEC_CTX;
 
@@ -189,11 +574,17 @@ int CMediaConverter::processVideoIntoFrames(MediaReaderState* state)
         if (state->av_packet->stream_index != state->video_stream_index)
             continue;
 
-        response = avcodec_send_packet(state->video_codec_ctx, state->av_packet);
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::VideoSendPacket);
+            response = avcodec_send_packet(state->video_codec_ctx, state->av_packet);
+        }
         if (response < 0)
             return (int)ErrorCode::PKT_NOT_DECODED;
 
-        response = avcodec_receive_frame(state->video_codec_ctx, state->av_frame);
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::VideoReceiveFrame);
+            response = avcodec_receive_frame(state->video_codec_ctx, state->av_frame);
+        }
         if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
             continue;
         else if (response < 0)
@@ -212,6 +603,9 @@ int CMediaConverter::processVideoIntoFrames(MediaReaderState* state)
 
 int CMediaConverter::processAudioIntoFrames(MediaReaderState* state)
 {
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return (int)opened;
     if (!state->audio_codec_ctx)
         return (int)ErrorCode::NO_CODEC_CTX;
 
@@ -221,12 +615,18 @@ int CMediaConverter::processAudioIntoFrames(MediaReaderState* state)
         if (state->av_packet->stream_index != state->audio_stream_index)
             continue;
 
-        response = avcodec_send_packet(state->audio_codec_ctx, state->av_packet);
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::AudioSendPacket);
+            response = avcodec_send_packet(state->audio_codec_ctx, state->av_packet);
+        }
 
         if (response < 0)
             return (int)ErrorCode::PKT_NOT_DECODED;
 
-        response = avcodec_receive_frame(state->audio_codec_ctx, state->av_frame);
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::AudioReceiveFrame);
+            response = avcodec_receive_frame(state->audio_codec_ctx, state->av_frame);
+        }
         if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
             continue;
         else if (response < 0)
@@ -252,6 +652,7 @@ int CMediaConverter::readFrame(MediaReaderState* state)
 {
     if (!state->av_format_ctx)
         return (int)ErrorCode::NO_FMT_CTX;
+    TIME_STAGE(state->stage_timings.get(), Stage::ReadFrame);
     int ret = av_read_frame(state->av_format_ctx, state->av_packet);
     //retrieve stats
     if(ret == (int)ErrorCode::SUCCESS)
@@ -267,40 +668,127 @@ int CMediaConverter::outputToBuffer(VideoBuffer& buffer)
 
 int CMediaConverter::outputToBuffer(MediaReaderState* state, VideoBuffer& buffer)
 {
-    auto& sws_scaler_ctx = state->sws_scaler_ctx;
-    auto& av_codec_ctx = state->video_codec_ctx;
-    auto& av_frame = state->av_frame;
-    if (!av_codec_ctx)
+    FrameHandle frame;
+    frame.MoveFrom(state->av_frame);
+    return outputToBuffer(state, frame, buffer);
+}
+
+int CMediaConverter::outputToBuffer(MediaReaderState* state, const FrameHandle& frame, VideoBuffer& buffer)
+{
+    return outputToBuffer(state, frame, buffer, OutputOptions());
+}
+
+int CMediaConverter::outputToBuffer(MediaReaderState* state, const FrameHandle& frame, VideoBuffer& buffer, const OutputOptions& options)
+{
+    if (!frame.IsValid())
         return -1;
-    //setup scaler
-    if (!sws_scaler_ctx)
-    {
-        sws_scaler_ctx = sws_getContext(state->VideoWidth(), state->VideoHeight(), av_codec_ctx->pix_fmt, //input
-            state->VideoWidth(), state->VideoHeight(), AV_PIX_FMT_RGB0, //output
-            SWS_BILINEAR, NULL, NULL, NULL); //options
-    }
-    if (!sws_scaler_ctx)
-        return (int)ErrorCode::NO_SCALER;
-    uint64_t w = av_frame->width;
-    uint64_t h = av_frame->height;
-    uint64_t size = w * h * 4;
 
-    if (size == 0)
+    TIME_STAGE(state->stage_timings.get(), Stage::VideoOutput);
+    int w = 0, h = 0;
+    resolveOutputSize(frame.Get(), options, w, h);
+    int size = av_image_get_buffer_size(options.pix_fmt, w, h, 1);
+
+    if (size <= 0)
         return -1;
 
     buffer.resize(size);
 
-    //using 4 here because RGB0 designates 4 channels of values
-    unsigned char* dest[4] = { &buffer[0], NULL, NULL, NULL };
-    int dest_linesize[4] = { state->VideoWidth() * 4, 0, 0, 0 };
+    //planes are packed back to back with no row padding
+    uint8_t* dest[4] = { NULL, NULL, NULL, NULL };
+    int dest_linesize[4] = { 0, 0, 0, 0 };
+    av_image_fill_arrays(dest, dest_linesize, &buffer[0], options.pix_fmt, w, h, 1);
+
+    //frames converted ahead of time are already in the requested layout
+    if (frame.PixelFormat() == options.pix_fmt && frame.Width() == w && frame.Height() == h)
+    {
+        const AVFrame* src = frame.Get();
+        if (av_image_copy_to_buffer(&buffer[0], size, src->data, src->linesize, options.pix_fmt, w, h, 1) < 0)
+            return -1;
+        return (int)ErrorCode::SUCCESS;
+    }
 
-    sws_scale(sws_scaler_ctx, av_frame->data, av_frame->linesize, 0, state->VideoHeight(), dest, dest_linesize);
+    return scaleFrame(state, frame.Get(), dest, dest_linesize, w, h, options);
+}
 
-    av_frame_unref(av_frame);
+void CMediaConverter::resolveOutputSize(const AVFrame* frame, const OutputOptions& options, int& width, int& height)
+{
+    width = options.width;
+    height = options.height;
+    if (width <= 0 && height <= 0)
+    {
+        width = frame->width;
+        height = frame->height;
+    }
+    else if (width <= 0)
+    {
+        width = (int)av_rescale(frame->width, height, frame->height);
+    }
+    else if (height <= 0)
+    {
+        height = (int)av_rescale(frame->height, width, frame->width);
+    }
+}
+
+int CMediaConverter::scaleFrame(MediaReaderState* state, const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4],
+    int width, int height, const OutputOptions& options)
+{
+    return scaleFrame(state->scaler_cache, state->slice_scaler.get(), frame, dest, destLinesize, width, height, options);
+}
+
+int CMediaConverter::scaleFrame(ScalerCache& cache, SliceScaler* slicer, const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4],
+    int width, int height, const OutputOptions& options)
+{
+    //the key comes from the frame itself so a mid-stream resolution change picks up a matching scaler
+    ScalerKey key;
+    key.src_width = frame->width;
+    key.src_height = frame->height;
+    key.src_fmt = (AVPixelFormat)frame->format;
+    key.dst_width = width;
+    key.dst_height = height;
+    key.dst_fmt = options.pix_fmt;
+    key.flags = options.sws_flags;
+    key.colorspace = frame->colorspace;
+    key.color_range = frame->color_range;
+
+    //the fast kernels only run when the caller asked for them, they convert on this thread and aren't byte exact.
+    //everything else, the default included, goes through the slicer when setConversionThreads set one up
+    if (options.fast_convert && ColorConverter::Supports(frame, width, height, options.pix_fmt))
+    {
+        if (ColorConverter::ToRGB0(frame, dest[0], destLinesize[0]) < 0)
+            return (int)ErrorCode::NO_SCALER;
+        return (int)ErrorCode::SUCCESS;
+    }
+
+    if (slicer)
+    {
+        if (slicer->Scale(frame, dest, destLinesize, key) < 0)
+            return (int)ErrorCode::NO_SCALER;
+        return (int)ErrorCode::SUCCESS;
+    }
+
+    SwsContext* sws_scaler_ctx = cache.Get(key);
+    if (!sws_scaler_ctx)
+        return (int)ErrorCode::NO_SCALER;
+
+    sws_scale(sws_scaler_ctx, frame->data, frame->linesize, 0, frame->height, dest, destLinesize);
 
     return (int)ErrorCode::SUCCESS;
 }
 
+ErrorCode CMediaConverter::setConversionThreads(size_t threads)
+{
+    return setConversionThreads(&m_mrState, threads);
+}
+
+ErrorCode CMediaConverter::setConversionThreads(MediaReaderState* state, size_t threads)
+{
+    if (threads <= 1)
+        state->slice_scaler.reset();
+    else if (!state->slice_scaler || state->slice_scaler->Threads() != threads)
+        state->slice_scaler = std::make_shared<SliceScaler>(threads);
+    return ErrorCode::SUCCESS;
+}
+
 int CMediaConverter::outputToAudioBuffer(AudioBuffer& audioBuffer)
 {
     return outputToAudioBuffer(&m_mrState, audioBuffer);
@@ -308,34 +796,39 @@ int CMediaConverter::outputToAudioBuffer(AudioBuffer& audioBuffer)
 
 int CMediaConverter::outputToAudioBuffer(MediaReaderState* state, AudioBuffer& audioBuffer)
 {
-    if (audioBuffer.size() != state->AudioBufferSize() && state->AudioBufferSize() > 0)
-        audioBuffer.resize(state->AudioBufferSize());
-    else
+    if (state->AudioBufferSize() <= 0)
         return (int)ErrorCode::NO_DATA_AVAIL;
 
+    TIME_STAGE(state->stage_timings.get(), Stage::AudioOutput);
+
+    if (audioBuffer.size() != state->AudioBufferSize())
+        audioBuffer.resize(state->AudioBufferSize());
+
     auto ptr = &audioBuffer[0];
-    
-    state->swr_ctx = swr_alloc_set_opts(nullptr, AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT, AV_SAMPLE_FMT_FLT, state->SampleRate(),
-        state->audio_codec_ctx->channel_layout, state->AudioSampleFormat(), state->SampleRate(), 0, nullptr);
+    auto av_frame = state->av_frame;
 
-    if (!state->swr_ctx)
-        return (int)ErrorCode::NO_SWR_CTX;
+    //the frame's own parameters win, the codec context is only a fallback for streams that don't report a layout
+    uint64_t in_layout = av_frame->channel_layout ? av_frame->channel_layout : state->audio_codec_ctx->channel_layout;
+    AVSampleFormat in_fmt = av_frame->format >= 0 ? (AVSampleFormat)av_frame->format : state->AudioSampleFormat();
+    int in_rate = av_frame->sample_rate > 0 ? av_frame->sample_rate : state->SampleRate();
 
-    swr_init(state->swr_ctx);
+    SwrContext* swr_ctx = state->GetResampler(in_layout, in_fmt, in_rate);
+    if (!swr_ctx)
+        return (int)ErrorCode::NO_SWR_CTX;
 
-    int got_samples = swr_convert(state->swr_ctx, &ptr, state->NumSamples(), (const uint8_t**)state->av_frame->extended_data, state->av_frame->nb_samples);
+    int got_samples = swr_convert(swr_ctx, &ptr, state->NumSamples(), (const uint8_t**)av_frame->extended_data, av_frame->nb_samples);
 
     if(got_samples < 0)
         return (int)ErrorCode::NO_SWR_CONVERT;
 
     while (got_samples > 0)
     {
-        got_samples = swr_convert(state->swr_ctx, &ptr, state->NumSamples(), nullptr, 0);
+        got_samples = swr_convert(swr_ctx, &ptr, state->NumSamples(), nullptr, 0);
         if (got_samples < 0)
             return (int)ErrorCode::NO_SWR_CONVERT;
     }
 
-    av_frame_unref(state->av_frame);
+    av_frame_unref(av_frame);
 
     return (int)ErrorCode::SUCCESS;
 }
@@ -347,13 +840,18 @@ ErrorCode CMediaConverter::trackToFrame(int64_t targetPts)
 
 ErrorCode CMediaConverter::trackToFrame(MediaReaderState* state, int64_t targetPts)
 {
+    discardReadAhead(state);
+    if (state->HasFrameIndex())
+        return trackToIndexedFrame(state, targetPts);
+
     seekToFrame(state, targetPts);
     auto ret = processVideoPacketsIntoFrames(state);
     if (ret != (int)ErrorCode::SUCCESS)
         return (ErrorCode)ret;
     int64_t interval = state->VideoFrameInterval() * state->FPS(); // interval starts at 1 second previous
     int64_t previous = state->VideoFramePts();
-    while (!WithinTolerance(targetPts, state->VideoFramePts(), state->VideoFrameInterval() - 10))
+    //anything closer than half a frame is that frame, with a 1 tick interval only an exact match is
+    while (!WithinTolerance(targetPts, state->VideoFramePts(), state->VideoFrameInterval() / 2 + 1))
     {
         if (state->VideoFramePts() < targetPts)
         {
@@ -376,6 +874,198 @@ ErrorCode CMediaConverter::trackToFrame(MediaReaderState* state, int64_t targetP
     return ErrorCode::SUCCESS;
 }
 
+/*
+* with an index the keyframe and the exact pts of the frame we want are known up front,
+* so this is one seek followed by decoding only the frames between the keyframe and the target
+*/
+ErrorCode CMediaConverter::trackToIndexedFrame(MediaReaderState* state, int64_t targetPts)
+{
+    const FrameIndex* index = state->GetFrameIndex();
+    const FrameIndexEntry* target = index->FrameAtOrBefore(targetPts);
+    const FrameIndexEntry* key = index->KeyFrameAtOrBefore(target->pts);
+
+    if (av_seek_frame(state->av_format_ctx, state->video_stream_index, key->pts, AVSEEK_FLAG_BACKWARD) < 0)
+        return ErrorCode::SEEK_FAILED;
+    if (state->video_codec_ctx)
+        avcodec_flush_buffers(state->video_codec_ctx);
+
+    //the demuxer can land on an earlier keyframe than asked for, so bound the walk by the whole index rather than the gop
+    int64_t remaining = (int64_t)index->FrameCount();
+    do
+    {
+        auto ret = processVideoPacketsIntoFrames(state);
+        if (ret != (int)ErrorCode::SUCCESS)
+            return (ErrorCode)ret;
+    } while (state->VideoFramePts() < target->pts && --remaining > 0);
+
+    return ErrorCode::SUCCESS;
+}
+
+ErrorCode CMediaConverter::seekExact(int64_t targetPts, FrameHandle& frame, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    return seekExact(&m_mrState, targetPts, frame, options, stats);
+}
+
+ErrorCode CMediaConverter::seekExact(MediaReaderState* state, int64_t targetPts, FrameHandle& frame, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    ExactSeekStats local;
+    ExactSeekStats& seek = stats ? *stats : local;
+    seek = ExactSeekStats();
+    frame.Reset();
+
+    discardReadAhead(state);
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
+    AVCodecContext* ctx = state->video_codec_ctx;
+    if (!ctx)
+        return ErrorCode::NO_CODEC_CTX;
+
+    //with an index the seek goes straight to the keyframe the target needs, otherwise it's up to the demuxer
+    auto start = Clock::now();
+    int64_t seekPts = targetPts;
+    const FrameIndexEntry* key = state->HasFrameIndex() ? state->GetFrameIndex()->KeyFrameAtOrBefore(targetPts) : nullptr;
+    if (key)
+        seekPts = seek.keyframe_pts = key->pts;
+    if (av_seek_frame(state->av_format_ctx, state->video_stream_index, seekPts, AVSEEK_FLAG_BACKWARD) < 0)
+        return ErrorCode::SEEK_FAILED;
+    avcodec_flush_buffers(ctx);
+    seek.seek_ms = elapsedMs(start);
+
+    start = Clock::now();
+    bool skips = options.skip_nonref || options.skip_loop_filter;
+    FrameHandle last; //latest frame before the target, handed back if the stream ends first
+    ErrorCode ret = ErrorCode::SUCCESS;
+    while (true)
+    {
+        int response;
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::VideoReceiveFrame);
+            response = avcodec_receive_frame(ctx, state->av_frame);
+        }
+        if (response >= 0)
+        {
+            ++seek.frames_decoded;
+            int64_t pts = framePts(state->av_frame);
+            state->videoFrameData.FillDataFromFrame(state->av_frame);
+            if (pts != AV_NOPTS_VALUE && pts < targetPts)
+            {
+                ++seek.frames_discarded;
+                last.MoveFrom(state->av_frame);
+                continue;
+            }
+            frame.MoveFrom(state->av_frame);
+            break;
+        }
+        if (response == AVERROR_EOF)
+        {
+            //a drained decoder only gives EOF until it's flushed, the next read or seek needs it usable again
+            avcodec_flush_buffers(ctx);
+            if (last.IsValid())
+            {
+                --seek.frames_discarded;
+                frame = std::move(last);
+            }
+            else
+                ret = ErrorCode::FILE_EOF;
+            break;
+        }
+        if (response != AVERROR(EAGAIN))
+        {
+            ret = ErrorCode::PKT_NOT_RECEIVED;
+            break;
+        }
+
+        //decoder wants more, end of file drains it
+        if (readFrame(state) < 0)
+        {
+            avcodec_send_packet(ctx, nullptr);
+            continue;
+        }
+        AVPacket* packet = state->av_packet;
+        if (packet->stream_index != state->video_stream_index)
+        {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        //a packet before the target can't be the target frame, a skipped non-reference one can't be needed for it
+        bool skippable = skips && packet->pts != AV_NOPTS_VALUE && packet->pts < targetPts;
+        ctx->skip_frame = skippable && options.skip_nonref ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        ctx->skip_loop_filter = skippable && options.skip_loop_filter ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        if (skippable)
+            ++seek.packets_skippable;
+        {
+            TIME_STAGE(state->stage_timings.get(), Stage::VideoSendPacket);
+            response = avcodec_send_packet(ctx, packet);
+        }
+        av_packet_unref(packet);
+        if (response < 0)
+        {
+            ret = ErrorCode::PKT_NOT_DECODED;
+            break;
+        }
+        ++seek.packets_sent;
+    }
+
+    ctx->skip_frame = AVDISCARD_DEFAULT;
+    ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+    seek.decode_ms = elapsedMs(start);
+    if (ret == ErrorCode::SUCCESS)
+        seek.frame_pts = framePts(frame.Get());
+    return ret;
+}
+
+ErrorCode CMediaConverter::seekExact(int64_t targetPts, VideoBuffer& buffer, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    return seekExact(&m_mrState, targetPts, buffer, options, stats);
+}
+
+ErrorCode CMediaConverter::seekExact(MediaReaderState* state, int64_t targetPts, VideoBuffer& buffer, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    ExactSeekStats local;
+    ExactSeekStats& seek = stats ? *stats : local;
+    FrameHandle frame;
+    ErrorCode ret = seekExact(state, targetPts, frame, options, &seek);
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
+
+    auto start = Clock::now();
+    ret = (ErrorCode)outputToBuffer(state, frame, buffer, options.output);
+    seek.convert_ms = elapsedMs(start);
+    return ret;
+}
+
+ErrorCode CMediaConverter::seekToFrameNumber(int64_t frameNumber, FrameHandle& frame, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    return seekToFrameNumber(&m_mrState, frameNumber, frame, options, stats);
+}
+
+ErrorCode CMediaConverter::seekToFrameNumber(MediaReaderState* state, int64_t frameNumber, FrameHandle& frame, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    if (frameNumber < 0)
+        return ErrorCode::SEEK_FAILED;
+    int64_t target = state->FrameStartPts(frameNumber);
+    if (target == AV_NOPTS_VALUE)
+        return state->HasFrameIndex() ? ErrorCode::FILE_EOF : ErrorCode::SEEK_FAILED;
+    return seekExact(state, target, frame, options, stats);
+}
+
+ErrorCode CMediaConverter::readFrameAt(int64_t frameNumber, VideoBuffer& buffer, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    return readFrameAt(&m_mrState, frameNumber, buffer, options, stats);
+}
+
+ErrorCode CMediaConverter::readFrameAt(MediaReaderState* state, int64_t frameNumber, VideoBuffer& buffer, const ExactSeekOptions& options, ExactSeekStats* stats)
+{
+    if (frameNumber < 0)
+        return ErrorCode::SEEK_FAILED;
+    int64_t target = state->FrameStartPts(frameNumber);
+    if (target == AV_NOPTS_VALUE)
+        return state->HasFrameIndex() ? ErrorCode::FILE_EOF : ErrorCode::SEEK_FAILED;
+    return seekExact(state, target, buffer, options, stats);
+}
+
 ErrorCode CMediaConverter::trackToAudioFrame(int64_t targetPts)
 {
     return trackToAudioFrame(&m_mrState, targetPts);
@@ -383,6 +1073,10 @@ ErrorCode CMediaConverter::trackToAudioFrame(int64_t targetPts)
 
 ErrorCode CMediaConverter::trackToAudioFrame(MediaReaderState* state, int64_t targetPts)
 {
+    discardReadAhead(state);
+    ErrorCode opened = state->OpenDecoders();
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
     if (!state->audio_codec_ctx)
         return ErrorCode::NO_CODEC_CTX;
     if (state->audio_stream_index < 0)
@@ -423,9 +1117,11 @@ ErrorCode CMediaConverter::seekToFrame(int64_t targetPts)
 
 ErrorCode CMediaConverter::seekToFrame(MediaReaderState* state, int64_t targetPts)
 {
+    discardReadAhead(state);
     if (av_seek_frame(state->av_format_ctx, state->video_stream_index, targetPts, AVSEEK_FLAG_BACKWARD) >= 0)
     {
-        avcodec_flush_buffers(state->video_codec_ctx);
+        if (state->video_codec_ctx) //nothing to flush before lazily opened decoders exist
+            avcodec_flush_buffers(state->video_codec_ctx);
         return ErrorCode::SUCCESS;
     }
     return ErrorCode::SEEK_FAILED;
@@ -438,9 +1134,11 @@ ErrorCode CMediaConverter::seekToAudioFrame(int64_t targetPts)
 
 ErrorCode CMediaConverter::seekToAudioFrame(MediaReaderState* state, int64_t targetPts)
 {
+    discardReadAhead(state);
     if (av_seek_frame(state->av_format_ctx, state->audio_stream_index, targetPts, AVSEEK_FLAG_BACKWARD) >= 0)
     {
-        avcodec_flush_buffers(state->audio_codec_ctx);
+        if (state->audio_codec_ctx)
+            avcodec_flush_buffers(state->audio_codec_ctx);
         return ErrorCode::SUCCESS;
     }
     return ErrorCode::SEEK_FAILED;
@@ -453,9 +1151,11 @@ ErrorCode CMediaConverter::seekToStart()
 
 ErrorCode CMediaConverter::seekToStart(MediaReaderState* state)
 {
+    discardReadAhead(state);
     if (av_seek_frame(state->av_format_ctx, state->video_stream_index, 0, 0) >= 0)
     {
-        avcodec_flush_buffers(state->video_codec_ctx);
+        if (state->video_codec_ctx) //nothing to flush before lazily opened decoders exist
+            avcodec_flush_buffers(state->video_codec_ctx);
         return ErrorCode::SUCCESS;
     }
     return ErrorCode::SEEK_FAILED;
@@ -468,9 +1168,11 @@ ErrorCode CMediaConverter::seekToAudioStart()
 
 ErrorCode CMediaConverter::seekToAudioStart(MediaReaderState* state)
 {
+    discardReadAhead(state);
     if (av_seek_frame(state->av_format_ctx, state->audio_stream_index, 0, 0) >= 0)
     {
-        avcodec_flush_buffers(state->audio_codec_ctx);
+        if (state->audio_codec_ctx)
+            avcodec_flush_buffers(state->audio_codec_ctx);
         return ErrorCode::SUCCESS;
     }
     return ErrorCode::SEEK_FAILED;
@@ -483,15 +1185,7 @@ ErrorCode CMediaConverter::closeVideoReader()
 
 ErrorCode CMediaConverter::closeVideoReader(MediaReaderState* state)
 {
-    sws_freeContext(state->sws_scaler_ctx);
-    swr_free(&state->swr_ctx);
-    avformat_close_input(&state->av_format_ctx);
-    avformat_free_context(state->av_format_ctx);
-    avcodec_free_context(&state->video_codec_ctx);
-    avcodec_free_context(&state->audio_codec_ctx);
-    av_frame_free(&state->av_frame);
-    av_packet_free(&state->av_packet);
-    state->SetIsOpened(false);
+    state->Close();
     return ErrorCode::SUCCESS;
 }
 
@@ -507,46 +1201,56 @@ ErrorCode CMediaConverter::readVideoReaderFrame(unsigned char** frameBuffer, boo
 
 ErrorCode CMediaConverter::readVideoReaderFrame(MediaReaderState* state, unsigned char** frameBuffer, bool requestFlush)
 {
-    auto& av_format_ctx = state->av_format_ctx;
-    auto& av_codec_ctx = state->video_codec_ctx;
-    auto& av_frame = state->av_frame;
-    auto& av_packet = state->av_packet;
-    auto& vid_str_idx = state->video_stream_index;
-    auto& sws_scaler_ctx = state->sws_scaler_ctx;
+    FrameLease lease;
+    ErrorCode ret = readVideoReaderFrame(state, lease);
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
 
-    int response = processVideoPacketsIntoFrames(state);
+    *frameBuffer = lease.Detach();
 
-    if (response == AVERROR_EOF)
-    {
-        avcodec_flush_buffers(av_codec_ctx);
-        return ErrorCode::FILE_EOF;
-    }
+    return ErrorCode::SUCCESS;
+}
 
-    //setup scaler
-    if (!sws_scaler_ctx)
-    {
-        sws_scaler_ctx = sws_getContext(state->VideoWidth(), state->VideoHeight(), av_codec_ctx->pix_fmt, //input
-            state->VideoWidth(), state->VideoHeight(), AV_PIX_FMT_RGB0, //output
-            SWS_BILINEAR, NULL, NULL, NULL); //options
-    }
-    if (!sws_scaler_ctx)
-        return ErrorCode::NO_SCALER;
-    uint64_t w = av_frame->width;
-    uint64_t h = av_frame->height;
+ErrorCode CMediaConverter::readVideoReaderFrame(MediaReaderState* state, FrameLease& frameBuffer)
+{
+    FrameHandle frame;
+    ErrorCode ret = readVideoFrame(state, frame);
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
+
+    uint64_t w = frame.Width();
+    uint64_t h = frame.Height();
     uint64_t size = w * h * 4;
-    unsigned char* output = new unsigned char[size];
+
+    FrameLease output = state->frame_buffer_pool.Acquire(size);
+    if (!output)
+        return ErrorCode::NO_FRAME;
 
     //using 4 here because RGB0 designates 4 channels of values
-    unsigned char* dest[4] = { output, NULL, NULL, NULL };
-    int dest_linesize[4] = { state->VideoWidth() * 4, 0, 0, 0 };
+    uint8_t* dest[4] = { output.Data(), NULL, NULL, NULL };
+    int dest_linesize[4] = { frame.Width() * 4, 0, 0, 0 };
 
-    sws_scale(sws_scaler_ctx, av_frame->data, av_frame->linesize, 0, state->VideoHeight(), dest, dest_linesize);
+    ret = (ErrorCode)scaleFrame(state, frame.Get(), dest, dest_linesize, frame.Width(), frame.Height(), OutputOptions());
+    if (ret != ErrorCode::SUCCESS)
+        return ret;
 
-    *frameBuffer = output;
+    frameBuffer = std::move(output);
 
     return ErrorCode::SUCCESS;
 }
 
+ErrorCode CMediaConverter::releaseVideoReaderFrame(unsigned char* frameBuffer)
+{
+    return releaseVideoReaderFrame(&m_mrState, frameBuffer);
+}
+
+ErrorCode CMediaConverter::releaseVideoReaderFrame(MediaReaderState* state, unsigned char* frameBuffer)
+{
+    if (!state->frame_buffer_pool.Return(frameBuffer))
+        return ErrorCode::NO_FRAME;
+    return ErrorCode::SUCCESS;
+}
+
 ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile)
 {
     return encodeMedia(inFile, outFile, &m_mrState);
@@ -554,109 +1258,314 @@ ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile)
 
 ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile, MediaReaderState* state)
 {
-    if (avformat_open_input(&state->av_format_ctx, inFile, nullptr, nullptr) < 0)
+    return encodeMedia(inFile, outFile, TrimOptions(), state);
+}
+
+ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats)
+{
+    return encodeMedia(MediaInput::FromFile(inFile), outFile, trim, state, stats);
+}
+
+ErrorCode CMediaConverter::encodeMedia(const MediaInput& input, const char* outFile, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats)
+{
+    return remuxMedia(input, outFile, nullptr, trim, state, stats);
+}
+
+ErrorCode CMediaConverter::encodeMedia(const char* inFile, const StreamingOptions& output, MediaReaderState* state, const TrimOptions& trim, TrimStats* stats)
+{
+    return encodeMedia(MediaInput::FromFile(inFile), output, state, trim, stats);
+}
+
+ErrorCode CMediaConverter::encodeMedia(const MediaInput& input, const StreamingOptions& output, MediaReaderState* state, const TrimOptions& trim, TrimStats* stats)
+{
+    StreamingOutput streaming(output);
+    return remuxMedia(input, nullptr, &streaming, trim, state, stats);
+}
+
+//shared by the file and streaming encodeMedia, streaming owns the output context when it's set
+ErrorCode CMediaConverter::remuxMedia(const MediaInput& input, const char* outFile, StreamingOutput* streaming, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats)
+{
+    if (input.Open(&state->av_format_ctx, &state->av_io_ctx) != ErrorCode::SUCCESS)
         return ErrorCode::FMT_UNOPENED;
 
-    if (avformat_find_stream_info(state->av_format_ctx, nullptr) < 0)
+    AVFormatContext* in_ctx = state->av_format_ctx;
+    if (avformat_find_stream_info(in_ctx, nullptr) < 0)
+    {
+        MediaInput::Close(&state->av_format_ctx, &state->av_io_ctx);
         return ErrorCode::NO_STREAMS;
+    }
 
-    AVFormatContext* out_ctx = nullptr;
-    avformat_alloc_output_context2(&out_ctx, nullptr, nullptr, outFile);
-    if (!out_ctx)
-        return ErrorCode::NO_CODEC_CTX;
-
-    int num_streams = state->av_format_ctx->nb_streams;
+    int num_streams = in_ctx->nb_streams;
     if (num_streams <= 0)
+    {
+        MediaInput::Close(&state->av_format_ctx, &state->av_io_ctx);
         return ErrorCode::NO_STREAMS;
+    }
 
-    int* streams_list = nullptr;
-    streams_list = (int*)av_mallocz_array(num_streams, sizeof(*streams_list));
-    if (!streams_list)
-        return ErrorCode::NO_STREAMS;
+    AVFormatContext* out_ctx = nullptr;
+    if (streaming)
+    {
+        if (streaming->Open() == ErrorCode::SUCCESS)
+            out_ctx = streaming->Context();
+    }
+    else
+        avformat_alloc_output_context2(&out_ctx, nullptr, nullptr, outFile);
+    if (!out_ctx)
+    {
+        MediaInput::Close(&state->av_format_ctx, &state->av_io_ctx);
+        return ErrorCode::NO_CODEC_CTX;
+    }
 
+    ErrorCode ret = ErrorCode::SUCCESS;
+    std::vector<int> streams_list(num_streams, -1);
+    std::vector<int64_t> offsets(num_streams, 0); //start in each stream's time_base, the output begins there
     int stream_index = 0;
-    for (unsigned int i = 0; i < state->av_format_ctx->nb_streams; ++i)
+    for (unsigned int i = 0; ret == ErrorCode::SUCCESS && i < in_ctx->nb_streams; ++i)
     {
-        AVStream* out_stream = nullptr;
-        AVStream* in_stream = state->av_format_ctx->streams[i];
+        AVStream* in_stream = in_ctx->streams[i];
         AVCodecParameters* in_codecpar = in_stream->codecpar;
 
         if (in_codecpar->codec_type != AVMEDIA_TYPE_AUDIO &&
             in_codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
         {
-            streams_list[i] = -1;
+            in_stream->discard = AVDISCARD_ALL; //don't even demux what gets dropped
             continue;
         }
 
         streams_list[i] = stream_index++;
-        out_stream = avformat_new_stream(out_ctx, nullptr);
-        if (!out_stream)
-            return ErrorCode::NO_CODEC_CTX;
+        if (trim.start_time != AV_NOPTS_VALUE)
+            offsets[i] = av_rescale_q(trim.start_time, AV_TIME_BASE_Q, in_stream->time_base);
 
-        if (avcodec_parameters_copy(out_stream->codecpar, in_codecpar) < 0)
-            return ErrorCode::NO_CODEC_CTX;
+        AVStream* out_stream = avformat_new_stream(out_ctx, nullptr);
+        if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, in_codecpar) < 0)
+            ret = ErrorCode::NO_CODEC_CTX;
+        else
+            out_stream->time_base = in_stream->time_base;
     }
 
-    av_dump_format(out_ctx, 0, outFile, 1);
+    //only the packets of the cut are read, starting from a seek instead of the top of the file
+    PacketRange range(in_ctx, trim.start_time, trim.end_time);
+    if (ret == ErrorCode::SUCCESS && range.Seek() < 0)
+        ret = ErrorCode::SEEK_FAILED;
+
+    //exact start: decode from the keyframe before start and re-encode up to the next one
+    int video = range.VideoStream();
+    int64_t video_cut = video >= 0 ? offsets[video] : AV_NOPTS_VALUE;
+    HeadEncoder head;
+    bool heading = ret == ErrorCode::SUCCESS && trim.exact && trim.start_time != AV_NOPTS_VALUE && video >= 0 && streams_list[video] >= 0 &&
+        range.VideoStart() != AV_NOPTS_VALUE && range.VideoStart() < video_cut && HeadEncoder::Supported(in_ctx->streams[video]->codecpar);
+    if (heading)
+    {
+        AVRational frame_rate = av_guess_frame_rate(in_ctx, in_ctx->streams[video], nullptr);
+        heading = head.Open(in_ctx->streams[video], frame_rate, trim.head_encoder, video_cut) == ErrorCode::SUCCESS;
+    }
 
-    if (!(out_ctx->oformat->flags & AVFMT_NOFILE))
+    if (ret == ErrorCode::SUCCESS && !streaming)
     {
-        if (avio_open(&out_ctx->pb, outFile, AVIO_FLAG_WRITE) < 0)
-            return ErrorCode::NO_OUTPUT_FILE;
+        av_dump_format(out_ctx, 0, outFile, 1);
+
+        if (!(out_ctx->oformat->flags & AVFMT_NOFILE) && avio_open(&out_ctx->pb, outFile, AVIO_FLAG_WRITE) < 0)
+            ret = ErrorCode::NO_OUTPUT_FILE;
     }
 
-    AVDictionary* opts = nullptr;
-    //av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    //fragmented output (movflags etc) is set up by StreamingOutput
+    if (ret == ErrorCode::SUCCESS)
+    {
+        if (streaming)
+            ret = streaming->WriteHeader();
+        else if (avformat_write_header(out_ctx, nullptr) < 0)
+            ret = ErrorCode::NO_OUTPUT_FILE;
+    }
 
-    if (avformat_write_header(out_ctx, &opts) < 0)
-        return ErrorCode::NO_OUTPUT_FILE;
+    int64_t packets_written = 0;
+    std::vector<int64_t> last_dts(out_ctx->nb_streams, AV_NOPTS_VALUE);
+    auto writePacket = [&](AVPacket* pkt)
+    {
+        int in_index = pkt->stream_index;
+        AVStream* in_stream = in_ctx->streams[in_index];
+        AVStream* out_stream = out_ctx->streams[streams_list[in_index]];
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts -= offsets[in_index];
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts -= offsets[in_index];
+
+        pkt->stream_index = streams_list[in_index];
+        pkt->pts = av_rescale_q_rnd(pkt->pts, in_stream->time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        pkt->dts = av_rescale_q_rnd(pkt->dts, in_stream->time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        pkt->duration = av_rescale_q(pkt->duration, in_stream->time_base, out_stream->time_base);
+        pkt->pos = -1;
+
+        //the muxer may pick a coarser time_base than the re-encoded head's dts were squeezed into
+        int64_t& last = last_dts[pkt->stream_index];
+        if (pkt->dts != AV_NOPTS_VALUE && last != AV_NOPTS_VALUE && pkt->dts <= last)
+        {
+            pkt->dts = last + 1;
+            if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+                pkt->pts = pkt->dts;
+        }
+        if (pkt->dts != AV_NOPTS_VALUE)
+            last = pkt->dts;
+
+        bool written = streaming ? streaming->Write(pkt) == ErrorCode::SUCCESS : av_interleaved_write_frame(out_ctx, pkt) >= 0;
+        if (written)
+            ++packets_written;
+        else if (streaming)
+            ret = ErrorCode::NO_OUTPUT_FILE; //the sink gave up, no point demuxing any further
+        av_packet_unref(pkt);
+    };
+
+    //the keyframe copying resumes on, held back until the re-encoded frames before it are written
+    AVPacket* join = nullptr;
+    int64_t head_end = AV_NOPTS_VALUE; //join's pts, or its dts when it has none
+    auto finishHead = [&]()
+    {
+        std::vector<AVPacket*> packets;
+        ErrorCode result = head.Finish(join ? join->dts : AV_NOPTS_VALUE, packets);
+        for (AVPacket* pkt : packets)
+        {
+            if (result == ErrorCode::SUCCESS)
+            {
+                pkt->stream_index = video;
+                writePacket(pkt);
+            }
+            av_packet_free(&pkt);
+        }
+        if (join)
+        {
+            if (result == ErrorCode::SUCCESS)
+                result = head.PrepareJoin(join);
+            writePacket(join);
+            av_packet_free(&join);
+        }
+        heading = false;
+        return result;
+    };
 
     AVPacket pkt;
-    while (1) //this will end up linking up with the start and stop frames of the files
+    while (ret == ErrorCode::SUCCESS)
     {
-        AVStream* in_stream = nullptr;
-        AVStream* out_stream = nullptr;
-        if (av_read_frame(state->av_format_ctx, &pkt) < 0)
+        if (av_read_frame(in_ctx, &pkt) < 0)
             break;
 
-        in_stream = state->av_format_ctx->streams[pkt.stream_index];
-        if (pkt.stream_index > num_streams || streams_list[pkt.stream_index] < 0)
+        if (pkt.stream_index >= num_streams || streams_list[pkt.stream_index] < 0 || !range.Accept(&pkt))
         {
             av_packet_unref(&pkt);
+            if (range.Done())
+                break;
             continue;
         }
 
-        pkt.stream_index = streams_list[pkt.stream_index];
-        out_stream = out_ctx->streams[pkt.stream_index];
-        pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        pkt.dts = av_rescale_q_rnd(pkt.dts, in_stream->time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        pkt.duration = av_rescale_q(pkt.duration, in_stream->time_base, out_stream->time_base);
-        pkt.pos = -1;
+        if (heading && pkt.stream_index == video)
+        {
+            int64_t pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+            if (!join && (pkt.flags & AV_PKT_FLAG_KEY) && pts > video_cut)
+            {
+                //the leading pictures that follow reference it, the head decodes it but only keeps what comes before
+                head_end = pts;
+                head.SetEnd(head_end);
+                head.Decode(&pkt);
+                join = av_packet_clone(&pkt);
+                av_packet_unref(&pkt);
+                continue;
+            }
+
+            //everything before the next keyframe, and the leading pictures right after it, only feed the head
+            if (!join || (pts != AV_NOPTS_VALUE && pts < head_end))
+            {
+                head.Decode(&pkt);
+                av_packet_unref(&pkt);
+                continue;
+            }
+            ret = finishHead();
+        }
+
+        writePacket(&pkt);
+    }
 
-        av_interleaved_write_frame(out_ctx, &pkt);
+    //cut ends inside the head gop or right after the join
+    if (heading && ret == ErrorCode::SUCCESS)
+        ret = finishHead();
+    av_packet_free(&join);
 
-        av_packet_unref(&pkt);  
+    if (ret == ErrorCode::SUCCESS)
+    {
+        if (streaming)
+            ret = streaming->Finish();
+        else
+            av_write_trailer(out_ctx);
     }
 
-    av_write_trailer(out_ctx);
+    if (stats)
+    {
+        stats->bytes_read = in_ctx->pb ? in_ctx->pb->bytes_read : 0;
+        stats->packets_written = packets_written;
+        stats->head_frames = head.FramesEncoded();
+    }
 
-    avformat_close_input(&state->av_format_ctx);
-    if (out_ctx && !(out_ctx->oformat->flags & AVFMT_NOFILE))
-        avio_closep(&out_ctx->pb);
+    MediaInput::Close(&state->av_format_ctx, &state->av_io_ctx);
+    if (!streaming)
+    {
+        if (!(out_ctx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&out_ctx->pb);
+        avformat_free_context(out_ctx);
+    }
+    return ret;
+}
 
-    avformat_free_context(out_ctx);
-    av_freep(&streams_list);
-    return ErrorCode::SUCCESS;
+ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile, const TranscodeOptions& options, TranscodeStats* stats)
+{
+    return encodeMedia(MediaInput::FromFile(inFile), outFile, options, stats);
+}
+
+ErrorCode CMediaConverter::encodeMedia(const MediaInput& input, const char* outFile, const TranscodeOptions& options, TranscodeStats* stats)
+{
+    Transcoder transcoder(options);
+    ErrorCode ret = transcoder.Run(input, outFile);
+    if (stats)
+        *stats = transcoder.Stats();
+    return ret;
+}
+
+ErrorCode CMediaConverter::encodeMedia(const char* inFile, const char* outFile, const SegmentOptions& options, SegmentStats* stats)
+{
+    SegmentTranscoder transcoder(options);
+    ErrorCode ret = transcoder.Run(inFile, outFile);
+    if (stats)
+        *stats = transcoder.Stats();
+    return ret;
 }
 
 ErrorCode CMediaConverter::loadFrame(const char* filename, int& width, int& height, unsigned char** data)
 {
-    AVFormatContext* av_format_ctx = avformat_alloc_context();
-    if (!av_format_ctx)
-        return ErrorCode::NO_FMT_CTX;
+    return loadFrame(MediaInput::FromFile(filename), width, height, data);
+}
 
-    if (avformat_open_input(&av_format_ctx, filename, NULL, NULL)) //returns 0 on success
-        return ErrorCode::FMT_UNOPENED;
+ErrorCode CMediaConverter::loadFrame(const MediaInput& input, int& width, int& height, unsigned char** data)
+{
+    //everything opened here is released on every return path
+    struct LoadFrameContexts
+    {
+        AVFormatContext* av_format_ctx = nullptr;
+        AVIOContext* av_io_ctx = nullptr;
+        AVCodecContext* av_codec_ctx = nullptr;
+        AVFrame* av_frame = nullptr;
+        AVPacket* av_packet = nullptr;
+        ~LoadFrameContexts()
+        {
+            av_packet_free(&av_packet);
+            av_frame_free(&av_frame);
+            avcodec_free_context(&av_codec_ctx);
+            MediaInput::Close(&av_format_ctx, &av_io_ctx);
+        }
+    } contexts;
+    auto& av_format_ctx = contexts.av_format_ctx;
+    auto& av_codec_ctx = contexts.av_codec_ctx;
+    auto& av_frame = contexts.av_frame;
+    auto& av_packet = contexts.av_packet;
+
+    ErrorCode opened = input.Open(&av_format_ctx, &contexts.av_io_ctx);
+    if (opened != ErrorCode::SUCCESS)
+        return opened;
 
     if (av_format_ctx->nb_streams < 1)
         return ErrorCode::NO_STREAMS;
@@ -684,7 +1593,7 @@ ErrorCode CMediaConverter::loadFrame(const char* filename, int& width, int& heig
     if (vid_str_idx == -1)
         return ErrorCode::NO_VID_STREAM;
 
-    AVCodecContext* av_codec_ctx = avcodec_alloc_context3(av_codec);
+    av_codec_ctx = avcodec_alloc_context3(av_codec);
     if (!av_codec_ctx)
         return ErrorCode::NO_CODEC_CTX;
 
@@ -694,11 +1603,11 @@ ErrorCode CMediaConverter::loadFrame(const char* filename, int& width, int& heig
     if (avcodec_open2(av_codec_ctx, av_codec, NULL) < 0)
         return ErrorCode::CODEC_UNOPENED;
 
-    AVFrame* av_frame = av_frame_alloc();
+    av_frame = av_frame_alloc();
     if (!av_frame)
         return ErrorCode::NO_FRAME;
 
-    AVPacket* av_packet = av_packet_alloc();
+    av_packet = av_packet_alloc();
     if (!av_packet)
         return ErrorCode::NO_PACKET;
 
@@ -706,9 +1615,13 @@ ErrorCode CMediaConverter::loadFrame(const char* filename, int& width, int& heig
     while (av_read_frame(av_format_ctx, av_packet) >= 0)
     {
         if (av_packet->stream_index != vid_str_idx)
+        {
+            av_packet_unref(av_packet);
             continue;
+        }
 
         response = avcodec_send_packet(av_codec_ctx, av_packet);
+        av_packet_unref(av_packet);
         if (response < 0)
             return ErrorCode::PKT_NOT_DECODED;
 
@@ -718,18 +1631,26 @@ ErrorCode CMediaConverter::loadFrame(const char* filename, int& width, int& heig
         else if (response < 0)
             return ErrorCode::PKT_NOT_RECEIVED;
 
-        av_packet_unref(av_packet);
         break;
     }
 
-    unsigned char* output = new unsigned char[static_cast<unsigned long>(av_frame->width) * static_cast<unsigned long>(av_frame->height) * 4];
+    if (av_frame->width <= 0 || av_frame->height <= 0)
+        return ErrorCode::NO_DATA_AVAIL;
+
+    //loadFrame buffers are handed back through releaseVideoReaderFrame(data)
+    unsigned char* output = m_mrState.frame_buffer_pool.AcquireRaw(static_cast<size_t>(av_frame->width) * static_cast<size_t>(av_frame->height) * 4);
+    if (!output)
+        return ErrorCode::NO_FRAME;
 
     SwsContext* sws_scaler_ctx = sws_getContext(av_frame->width, av_frame->height, av_codec_ctx->pix_fmt, //input
         av_frame->width, av_frame->height, AV_PIX_FMT_RGB0, //output
         SWS_BILINEAR, NULL, NULL, NULL); //options
 
     if (!sws_scaler_ctx)
+    {
+        m_mrState.frame_buffer_pool.Return(output);
         return ErrorCode::NO_SCALER;
+    }
 
     unsigned char* dest[4] = { output, NULL, NULL, NULL };
     int dest_linesize[4] = { av_frame->width * 4, 0, 0, 0 };
@@ -1,3 +1,4 @@
+#pragma once
 // The following ifdef block is the standard way of creating macros which make exporting
 // from a DLL simpler. All files within this DLL are compiled with the MEDIACONVERTER_EXPORTS
 // symbol defined on the command line. This symbol should not be defined on any project
@@ -11,9 +12,20 @@
 #endif
 
 #include "MediaReaderState.h"
+#include "FrameHandle.h"
+#include "ReadAheadQueue.h"
+#include "DemuxPipeline.h"
 #include <vector>
 #include <memory>
 
+struct TranscodeOptions;
+struct TranscodeStats;
+struct SegmentOptions;
+struct SegmentStats;
+struct StreamingOptions;
+class StreamingOutput;
+class MediaInput;
+
 enum class MEDIACONVERTER_API ErrorCode : int
 {
 	AGAIN = -2,
@@ -39,7 +51,93 @@ enum class MEDIACONVERTER_API ErrorCode : int
 	NO_DATA_AVAIL,
 	REPEATING_FRAME,
 	NO_AUDIO_DEVICES,
-	NO_OUTPUT_FILE
+	NO_OUTPUT_FILE,
+	STREAM_MISMATCH //pieces that were meant to be joined don't have the same codec parameters
+};
+
+//per call output settings for the buffer based frame api
+struct OutputOptions
+{
+	int width = 0; //0 keeps the source size, setting only one dimension keeps the aspect ratio
+	int height = 0;
+	AVPixelFormat pix_fmt = AV_PIX_FMT_RGB0;
+	int sws_flags = SWS_BILINEAR;
+	bool fast_convert = false; //opt in: built in yuv -> RGB0 kernels when the size doesn't change. replicated chroma, not byte exact with swscale
+};
+
+//seekExact. the skips only apply to packets before the target, the target frame itself is always fully decoded
+struct ExactSeekOptions
+{
+	bool skip_nonref = false; //skip_frame = AVDISCARD_NONREF: frames nothing references aren't decoded at all
+	bool skip_loop_filter = false; //skip_loop_filter = AVDISCARD_NONREF: the ones that are still decoded skip deblocking
+	OutputOptions output; //for the VideoBuffer version, only the returned frame is converted
+};
+
+struct ExactSeekStats
+{
+	int64_t keyframe_pts = AV_NOPTS_VALUE; //where decoding started, only known with a frame index
+	int64_t frame_pts = AV_NOPTS_VALUE; //of the frame handed back
+	int64_t packets_sent = 0;
+	int64_t packets_skippable = 0; //sent while the skips were on, the decoder drops the non-reference ones
+	int64_t frames_decoded = 0; //out of the decoder, the returned frame included
+	int64_t frames_discarded = 0; //decoded but before the target
+	double seek_ms = 0.0;
+	double decode_ms = 0.0;
+	double convert_ms = 0.0;
+};
+
+//background decoding for readVideoFrame, see startReadAhead
+struct ReadAheadOptions
+{
+	size_t depth = 8; //frames kept decoded ahead of the consumer
+	bool convert = false; //also convert on the decode thread, readVideoFrame then hands back frames already in output's size/format
+	OutputOptions output;
+};
+
+struct ReadAheadStats
+{
+	bool running = false;
+	size_t depth = 0; //frames waiting right now
+	size_t capacity = 0;
+	size_t high_water = 0;
+	int64_t underruns = 0; //reads that found nothing decoded yet
+	int64_t decoded = 0;
+	int64_t discarded = 0; //decoded ahead but thrown away by a seek
+};
+
+//one pass over the container for readVideoFrame and readAudioFrame, see startDemuxPipeline
+struct DemuxPipelineOptions
+{
+	size_t packet_depth = 64; //packets waiting on each stream's decoder
+	size_t frame_depth = 16; //decoded frames waiting on the consumer, per stream
+};
+
+struct DemuxPipelineStats
+{
+	bool running = false;
+	int64_t packets_read = 0; //every packet av_read_frame handed back, both streams and the ones dropped
+	int64_t video_frames = 0;
+	int64_t audio_frames = 0;
+	int64_t discarded = 0; //decoded but thrown away by a seek
+	size_t video_high_water = 0;
+	size_t audio_high_water = 0;
+};
+
+//[start, end) cut for the remuxing encodeMedia, times in AV_TIME_BASE units (AV_NOPTS_VALUE leaves that side open).
+//the output timeline starts at start. only the packets around the cut are read, see PacketRange
+struct TrimOptions
+{
+	int64_t start_time = AV_NOPTS_VALUE; //video is copied from the keyframe at or before start, frames before start are hidden by an edit list where the container has one
+	int64_t end_time = AV_NOPTS_VALUE; //video stops before the first keyframe at or after end so the last gop stays decodable, audio stops at end
+	bool exact = false; //re-encode the frames from start up to the next keyframe instead of copying from the keyframe before it, see HeadEncoder
+	const char* head_encoder = nullptr; //encoder for those frames, the source codec's default encoder when null
+};
+
+struct TrimStats
+{
+	int64_t bytes_read = 0;
+	int64_t packets_written = 0;
+	int64_t head_frames = 0; //re-encoded by the exact mode
 };
 
 // This class is exported from the dll
@@ -52,25 +150,72 @@ public:
 	CMediaConverter();
 	~CMediaConverter();
 	ErrorCode loadFrame(const char* filename, int& width, int& height, unsigned char** data);
+	ErrorCode loadFrame(const MediaInput& input, int& width, int& height, unsigned char** data);
 
 	ErrorCode openVideoReader(const char* filename);
 	ErrorCode openVideoReader(MediaReaderState* state, const char* filename);
+	ErrorCode openVideoReader(MediaReaderState* state, const char* filename, const OpenOptions& options);
+	//memory span or read/seek callbacks instead of a file, see MediaInput. memory has to stay valid until closeVideoReader
+	ErrorCode openVideoReader(MediaReaderState* state, const MediaInput& input, const OpenOptions& options = OpenOptions());
 
 	ErrorCode readVideoFrame(MediaReaderState* state, VideoBuffer& buffer);
 	ErrorCode readVideoFrame(VideoBuffer& buffer);
+	ErrorCode readVideoFrame(MediaReaderState* state, VideoBuffer& buffer, const OutputOptions& options);
+
+	//zero copy versions, the handle references the decoder's frame directly
+	ErrorCode readVideoFrame(MediaReaderState* state, FrameHandle& frame);
+	ErrorCode readVideoFrame(FrameHandle& frame);
+	ErrorCode convertVideoFrame(MediaReaderState* state, const FrameHandle& src, FrameHandle& dst); //RGB0 frame from a pool owned by state
+	ErrorCode convertVideoFrame(MediaReaderState* state, const FrameHandle& src, FrameHandle& dst, const OutputOptions& options);
+
+	/*
+	* decode on a background thread so readVideoFrame only waits when the decoder falls behind.
+	* seeks and audio reads pause the thread and drop what was decoded ahead, the next readVideoFrame
+	* picks up from the new position. the state's current frame/stats belong to the thread while it runs,
+	* use the frames handed back by readVideoFrame rather than outputToBuffer(state, buffer)
+	*/
+	ErrorCode startReadAhead(MediaReaderState* state, const ReadAheadOptions& options);
+	ErrorCode startReadAhead(const ReadAheadOptions& options);
+	ErrorCode stopReadAhead(MediaReaderState* state);
+	ErrorCode stopReadAhead();
+	ErrorCode getReadAheadStats(MediaReaderState* state, ReadAheadStats& stats);
+	ErrorCode getReadAheadStats(ReadAheadStats& stats);
+
+	/*
+	* demux once on a background thread and decode video and audio on a thread each, readVideoFrame and
+	* readAudioFrame then pop decoded frames instead of each reading the file for their own stream.
+	* read both streams roughly in step: once one stream's frames pile up the other read returns AGAIN.
+	* replaces a running read ahead. seeks drop what was decoded and the next read starts over from there,
+	* stopping leaves the demuxer wherever the pipeline got to
+	*/
+	ErrorCode startDemuxPipeline(MediaReaderState* state, const DemuxPipelineOptions& options);
+	ErrorCode startDemuxPipeline(const DemuxPipelineOptions& options);
+	ErrorCode stopDemuxPipeline(MediaReaderState* state);
+	ErrorCode stopDemuxPipeline();
+	ErrorCode getDemuxPipelineStats(MediaReaderState* state, DemuxPipelineStats& stats);
+	ErrorCode getDemuxPipelineStats(DemuxPipelineStats& stats);
 
 	ErrorCode readAudioFrame(MediaReaderState* state, AudioBuffer& audioBuffer);
 	ErrorCode readAudioFrame(AudioBuffer& audioBuffer);
+	ErrorCode readAudioFrame(MediaReaderState* state, FrameHandle& frame); //decoded samples, not resampled
+	ErrorCode readAudioFrame(FrameHandle& frame);
 
 	int readFrame();
 	int readFrame(MediaReaderState* state);
 
 	int outputToBuffer(VideoBuffer& buffer);
 	int outputToBuffer(MediaReaderState*, VideoBuffer& buffer);
+	int outputToBuffer(MediaReaderState*, const FrameHandle& frame, VideoBuffer& buffer);
+	int outputToBuffer(MediaReaderState*, const FrameHandle& frame, VideoBuffer& buffer, const OutputOptions& options);
 
 	int outputToAudioBuffer(AudioBuffer& ab_ptr);
 	int outputToAudioBuffer(MediaReaderState*, AudioBuffer& ab_ptr);
 
+	//splits same-size color conversion into slices over this many threads, 0 or 1 converts on the calling thread.
+	//OutputOptions::fast_convert takes precedence and always converts on the calling thread
+	ErrorCode setConversionThreads(MediaReaderState* state, size_t threads);
+	ErrorCode setConversionThreads(size_t threads);
+
 	int processVideoIntoFrames(MediaReaderState* state);
 	int processAudioIntoFrames(MediaReaderState* state);
 
@@ -83,6 +228,23 @@ public:
 	ErrorCode trackToFrame(MediaReaderState* state, int64_t targetPts);
 	ErrorCode trackToFrame(int64_t targetPts);
 
+	/*
+	* the first frame with pts >= targetPts (or the last frame of the stream when the target is past it): one seek to
+	* the keyframe before the target, then frames are decoded and dropped without any conversion until the target.
+	* the state's frame data is left on that frame and reading carries on after it. stats is optional
+	*/
+	ErrorCode seekExact(MediaReaderState* state, int64_t targetPts, FrameHandle& frame, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode seekExact(int64_t targetPts, FrameHandle& frame, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode seekExact(MediaReaderState* state, int64_t targetPts, VideoBuffer& buffer, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode seekExact(int64_t targetPts, VideoBuffer& buffer, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+
+	//frame number n (0 based, presentation order) through seekExact, see MediaReaderState::FramePts for how numbers map to pts.
+	//FILE_EOF past the last frame of an indexed file. reading carries on with frame n + 1
+	ErrorCode seekToFrameNumber(MediaReaderState* state, int64_t frameNumber, FrameHandle& frame, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode seekToFrameNumber(int64_t frameNumber, FrameHandle& frame, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode readFrameAt(MediaReaderState* state, int64_t frameNumber, VideoBuffer& buffer, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+	ErrorCode readFrameAt(int64_t frameNumber, VideoBuffer& buffer, const ExactSeekOptions& options = ExactSeekOptions(), ExactSeekStats* stats = nullptr);
+
 	ErrorCode trackToAudioFrame(MediaReaderState* state, int64_t targetPts);
 	ErrorCode trackToAudioFrame(int64_t targetPts);
 
@@ -103,13 +265,42 @@ public:
 
 	ErrorCode encodeMedia(const char* inFile, const char* outFile);
 	ErrorCode encodeMedia(const char* inFile, const char* outFile, MediaReaderState* state);
+	ErrorCode encodeMedia(const char* inFile, const char* outFile, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats = nullptr);
+	ErrorCode encodeMedia(const MediaInput& input, const char* outFile, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats = nullptr);
+	//fragmented mp4/mpeg-ts handed to output.on_fragment piece by piece instead of written to a file, see StreamingOutput
+	ErrorCode encodeMedia(const char* inFile, const StreamingOptions& output, MediaReaderState* state, const TrimOptions& trim = TrimOptions(), TrimStats* stats = nullptr);
+	ErrorCode encodeMedia(const MediaInput& input, const StreamingOptions& output, MediaReaderState* state, const TrimOptions& trim = TrimOptions(), TrimStats* stats = nullptr);
+	//decodes and re-encodes instead of remuxing, see Transcoder. stats is optional
+	ErrorCode encodeMedia(const char* inFile, const char* outFile, const TranscodeOptions& options, TranscodeStats* stats = nullptr);
+	ErrorCode encodeMedia(const MediaInput& input, const char* outFile, const TranscodeOptions& options, TranscodeStats* stats = nullptr);
+	//splits the file on keyframes and transcodes/remuxes the pieces in parallel, see SegmentTranscoder
+	ErrorCode encodeMedia(const char* inFile, const char* outFile, const SegmentOptions& options, SegmentStats* stats = nullptr);
+
+	ErrorCode readVideoReaderFrame(MediaReaderState* state, unsigned char** frameBuffer, bool requestFlush = false); //unmanaged data version, buffer comes from the state's pool
+	ErrorCode readVideoReaderFrame(unsigned char** frameBuffer, bool requestFlush = false); //unmanaged data version, buffer comes from the state's pool
+	ErrorCode readVideoReaderFrame(MediaReaderState* state, FrameLease& frameBuffer); //buffer goes back to the pool when the lease is destroyed
 
-	ErrorCode readVideoReaderFrame(MediaReaderState* state, unsigned char** frameBuffer, bool requestFlush = false); //unmanaged data version, creates heap data in function
-	ErrorCode readVideoReaderFrame(unsigned char** frameBuffer, bool requestFlush = false); //unmanaged data version, creates heap data in function
+	//returns buffers from readVideoReaderFrame/loadFrame to the pool. they used to come from new[] but are aligned
+	//allocations now (_aligned_malloc on windows), so delete[]/free on them is undefined and this is the only way back.
+	//buffers still out when their state is closed stay valid, and so do ones outliving the state, releasing them
+	//through any state frees them then
+	ErrorCode releaseVideoReaderFrame(MediaReaderState* state, unsigned char* frameBuffer);
+	ErrorCode releaseVideoReaderFrame(unsigned char* frameBuffer);
 
 	const MediaReaderState& MRState() const { return m_mrState; }
 	MediaReaderState& MRState() { return m_mrState; }
 private:
+	void resolveOutputSize(const AVFrame* frame, const OutputOptions& options, int& width, int& height);
+	int scaleFrame(MediaReaderState* state, const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4],
+		int width, int height, const OutputOptions& options);
+	int scaleFrame(ScalerCache& cache, SliceScaler* slicer, const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4],
+		int width, int height, const OutputOptions& options);
+	ErrorCode decodeVideoFrame(MediaReaderState* state, FrameHandle& frame);
+	ErrorCode convertReadAheadFrame(const FrameHandle& src, FrameHandle& dst, const OutputOptions& options, ScalerCache& cache);
+	void discardReadAhead(MediaReaderState* state);
+	void pauseReadAhead(MediaReaderState* state);
+	ErrorCode remuxMedia(const MediaInput& input, const char* outFile, StreamingOutput* streaming, const TrimOptions& trim, MediaReaderState* state, TrimStats* stats);
+	ErrorCode trackToIndexedFrame(MediaReaderState* state, int64_t targetPts);
 	bool WithinTolerance(int64_t referencePts, int64_t targetPts, int64_t tolerance);
 	MediaReaderState m_mrState;
 };
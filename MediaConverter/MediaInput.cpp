@@ -0,0 +1,303 @@
+#include "pch.h"
+#include "framework.h"
+#include "MediaInput.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	const int64_t kReadAheadWindow = 8 * 1024 * 1024; //asked for ahead of a linear reader, one call per window
+	const int64_t kSeekWindow = 1024 * 1024; //asked for around a far seek target
+	const int64_t kNearSeek = 1024 * 1024; //demuxers hop between interleaved chunks, that's still linear
+	const int64_t kSequentialRun = 4 * 1024 * 1024; //read linearly after a far seek before going back to sequential
+}
+
+struct MediaInput::Counters
+{
+	std::atomic<int64_t> reads{ 0 };
+	std::atomic<int64_t> bytes_read{ 0 };
+	std::atomic<int64_t> seeks{ 0 };
+	std::atomic<int64_t> far_seeks{ 0 };
+	std::atomic<int64_t> advise_calls{ 0 };
+};
+
+//one per open, the AVIO's opaque. the callbacks are copied in so the MediaInput can go away after Open
+struct MediaInput::IoState
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	int64_t position = 0; //memory input only
+	ReadCallback read_callback;
+	SeekCallback seek_callback;
+	int64_t callback_size = -1;
+	std::shared_ptr<Counters> counters;
+
+	//mapped input only
+	std::unique_ptr<MappedFile> mapped;
+	bool random = false;
+	int64_t read_ahead_end = 0; //read-ahead has been asked for up to here
+	int64_t linear_run = 0; //bytes read since the last far seek
+
+	void Advise(AccessPattern pattern)
+	{
+		mapped->Advise(pattern);
+		++counters->advise_calls;
+	}
+
+	void WillNeed(int64_t offset, int64_t length)
+	{
+		mapped->WillNeed((size_t)offset, (size_t)length);
+		++counters->advise_calls;
+		read_ahead_end = (std::min)(offset + length, (int64_t)size);
+	}
+
+	void OnRead(int64_t count)
+	{
+		if (!mapped)
+			return;
+		linear_run += count;
+		if (random && linear_run >= kSequentialRun)
+		{
+			random = false;
+			Advise(AccessPattern::Sequential);
+		}
+		//keep a window ahead of the reader, issued in whole windows so it's one call per window
+		if (!random && read_ahead_end < (int64_t)size && position + kReadAheadWindow / 2 > read_ahead_end)
+			WillNeed((std::max)(position, read_ahead_end), kReadAheadWindow);
+	}
+
+	void OnSeek(int64_t target)
+	{
+		if (!mapped)
+			return;
+		bool linear = target >= position - kNearSeek && target <= (std::max)(position + kNearSeek, read_ahead_end);
+		if (linear)
+			return;
+
+		++counters->far_seeks;
+		linear_run = 0;
+		if (!random)
+		{
+			random = true;
+			Advise(AccessPattern::Random);
+		}
+		WillNeed((std::max)((int64_t)0, target - kSeekWindow / 4), kSeekWindow);
+	}
+};
+
+MediaInput::MediaInput() : counters(std::make_shared<Counters>())
+{
+}
+
+MediaInput MediaInput::FromFile(const char* filename)
+{
+	MediaInput input;
+	if (filename)
+	{
+		input.type = Type::File;
+		input.filename = filename;
+	}
+	return input;
+}
+
+MediaInput MediaInput::FromMemory(const uint8_t* data, size_t size)
+{
+	MediaInput input;
+	if (data && size > 0)
+	{
+		input.type = Type::Memory;
+		input.data = data;
+		input.size = size;
+	}
+	return input;
+}
+
+MediaInput MediaInput::FromMappedFile(const char* filename)
+{
+	MediaInput input;
+	if (filename)
+	{
+		input.type = Type::Mapped;
+		input.filename = filename;
+	}
+	return input;
+}
+
+MediaInput MediaInput::FromCallbacks(ReadCallback read, SeekCallback seek, int64_t size)
+{
+	MediaInput input;
+	if (read)
+	{
+		input.type = Type::Callbacks;
+		input.read_callback = read;
+		input.seek_callback = seek;
+		input.callback_size = size;
+	}
+	return input;
+}
+
+MediaInput& MediaInput::BufferSize(int size)
+{
+	buffer_size = size > 0 ? size : 32 * 1024;
+	return *this;
+}
+
+InputStats MediaInput::Stats() const
+{
+	InputStats stats;
+	stats.reads = counters->reads;
+	stats.bytes_read = counters->bytes_read;
+	stats.seeks = counters->seeks;
+	stats.far_seeks = counters->far_seeks;
+	stats.advise_calls = counters->advise_calls;
+	return stats;
+}
+
+ErrorCode MediaInput::Open(AVFormatContext** ctx, AVIOContext** io) const
+{
+	if (type == Type::None)
+		return ErrorCode::FMT_UNOPENED;
+
+	*ctx = avformat_alloc_context();
+	if (!*ctx)
+		return ErrorCode::NO_FMT_CTX;
+
+	if (type == Type::File)
+		return avformat_open_input(ctx, filename.c_str(), nullptr, nullptr) < 0 ? ErrorCode::FMT_UNOPENED : ErrorCode::SUCCESS;
+
+	IoState* state = new IoState();
+	state->data = data;
+	state->size = size;
+	state->read_callback = read_callback;
+	state->seek_callback = seek_callback;
+	state->callback_size = callback_size;
+	state->counters = counters;
+
+	if (type == Type::Mapped)
+	{
+		state->mapped.reset(new MappedFile());
+		if (!state->mapped->Open(filename.c_str()))
+		{
+			delete state;
+			avformat_free_context(*ctx);
+			*ctx = nullptr;
+			return ErrorCode::FMT_UNOPENED;
+		}
+		state->data = state->mapped->Data();
+		state->size = state->mapped->Size();
+		//a demux or remux starts out reading front to back
+		state->Advise(AccessPattern::Sequential);
+		state->WillNeed(0, kReadAheadWindow);
+	}
+
+	uint8_t* buffer = (uint8_t*)av_malloc(buffer_size);
+	if (!buffer)
+	{
+		delete state;
+		avformat_free_context(*ctx);
+		*ctx = nullptr;
+		return ErrorCode::NO_DATA_AVAIL;
+	}
+
+	bool seekable = !read_callback || seek_callback;
+	*io = avio_alloc_context(buffer, buffer_size, 0, state, &MediaInput::readPacket, nullptr, seekable ? &MediaInput::seek : nullptr);
+	if (!*io)
+	{
+		av_free(buffer);
+		delete state;
+		avformat_free_context(*ctx);
+		*ctx = nullptr;
+		return ErrorCode::NO_FMT_CTX;
+	}
+
+	//reads bigger than what's buffered skip the AVIO buffer, the span is copied once, into the packet
+	if (type == Type::Memory || type == Type::Mapped)
+		(*io)->direct = 1;
+
+	(*ctx)->pb = *io;
+	(*ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+	if (avformat_open_input(ctx, nullptr, nullptr, nullptr) < 0) //frees *ctx but leaves our AVIO alone
+	{
+		Close(ctx, io);
+		return ErrorCode::FMT_UNOPENED;
+	}
+	return ErrorCode::SUCCESS;
+}
+
+void MediaInput::Close(AVFormatContext** ctx, AVIOContext** io)
+{
+	avformat_close_input(ctx);
+	if (io && *io)
+	{
+		delete (IoState*)(*io)->opaque;
+		//the AVIO may have swapped its buffer for a bigger one, free whatever it holds now
+		av_freep(&(*io)->buffer);
+		avio_context_free(io);
+	}
+}
+
+int MediaInput::readPacket(void* opaque, uint8_t* buf, int size)
+{
+	IoState* state = (IoState*)opaque;
+	++state->counters->reads;
+	if (state->read_callback)
+	{
+		int ret = state->read_callback(buf, size);
+		if (ret > 0)
+			state->counters->bytes_read += ret;
+		return ret == 0 ? AVERROR_EOF : ret;
+	}
+
+	if (state->position >= (int64_t)state->size)
+		return AVERROR_EOF;
+	int count = (int)(std::min)((int64_t)size, (int64_t)state->size - state->position);
+	memcpy(buf, state->data + state->position, count);
+	state->position += count;
+	state->counters->bytes_read += count;
+	state->OnRead(count);
+	return count;
+}
+
+int64_t MediaInput::seek(void* opaque, int64_t offset, int whence)
+{
+	IoState* state = (IoState*)opaque;
+	whence &= ~AVSEEK_FORCE;
+	if (whence != AVSEEK_SIZE)
+		++state->counters->seeks;
+
+	if (state->read_callback)
+	{
+		int64_t ret = state->seek_callback(offset, whence);
+		if (whence == AVSEEK_SIZE && ret < 0 && state->callback_size >= 0)
+			return state->callback_size;
+		return ret;
+	}
+
+	int64_t size = (int64_t)state->size;
+	int64_t position;
+	switch (whence)
+	{
+	case AVSEEK_SIZE:
+		return size;
+	case SEEK_SET:
+		position = offset;
+		break;
+	case SEEK_CUR:
+		position = state->position + offset;
+		break;
+	case SEEK_END:
+		position = size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (position < 0 || position > size)
+		return AVERROR(EINVAL);
+	state->OnSeek(position);
+	state->position = position;
+	return position;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "MediaConverter.h"
+#include <functional>
+#include <memory>
+#include <string>
+
+//what the AVIO callbacks saw, non file input only
+struct InputStats
+{
+	int64_t reads = 0; //read callback calls
+	int64_t bytes_read = 0;
+	int64_t seeks = 0; //AVSEEK_SIZE queries aren't counted
+	int64_t far_seeks = 0; //left the read-ahead window, mapped input switches to random access for those
+	int64_t advise_calls = 0; //madvise/PrefetchVirtualMemory calls made for mapped input
+};
+
+/*
+* where the demuxer reads from. a file goes to avformat_open_input by name as before, everything else is
+* read through an AVIOContext: a memory span (a downloaded blob, an mmapped archive member) or caller
+* supplied read/seek callbacks. memory input is zero-copy, the span is never duplicated and the AVIO
+* runs in direct mode, so the demuxer's reads copy straight from the span into the packet buffers
+* without going through the AVIO buffer first. the span has to outlive everything opened from it.
+* a mapped file is memory input over a MappedFile owned by the open; linear reading runs with sequential
+* access and read-ahead issued in windows ahead of the reader, a seek out of that window switches to random
+* access and asks for the pages around the target, a long enough linear run after it switches back
+*/
+class MEDIACONVERTER_API MediaInput
+{
+public:
+	//fills buf with up to size bytes, returns the count, AVERROR_EOF at the end or another negative AVERROR
+	typedef std::function<int(uint8_t* buf, int size)> ReadCallback;
+	//whence is SEEK_SET/SEEK_CUR/SEEK_END, or AVSEEK_SIZE to ask for the total size (negative if unknown)
+	typedef std::function<int64_t(int64_t offset, int whence)> SeekCallback;
+
+	MediaInput();
+
+	static MediaInput FromFile(const char* filename);
+	static MediaInput FromMemory(const uint8_t* data, size_t size);
+	static MediaInput FromMappedFile(const char* filename); //mapped on Open, unmapped on Close
+	//seek may be empty for input that can only be read forward, size is only used when seek can't report it
+	static MediaInput FromCallbacks(ReadCallback read, SeekCallback seek = nullptr, int64_t size = -1);
+
+	MediaInput& BufferSize(int size); //AVIO buffer for memory/callback input, ignored for files
+	int BufferSize() const { return buffer_size; }
+
+	bool IsFile() const { return type == Type::File; }
+	//the path for file and mapped input, null for memory/callbacks
+	const char* Filename() const { return type == Type::File || type == Type::Mapped ? filename.c_str() : nullptr; }
+	//shared by every copy of this input and summed over every open of it
+	InputStats Stats() const;
+
+	//allocates *ctx and opens it. *io is set for non file input and has to be released with Close
+	ErrorCode Open(AVFormatContext** ctx, AVIOContext** io) const;
+	static void Close(AVFormatContext** ctx, AVIOContext** io);
+
+private:
+	enum class Type { None, File, Memory, Mapped, Callbacks };
+	struct IoState;
+	struct Counters;
+
+	static int readPacket(void* opaque, uint8_t* buf, int size);
+	static int64_t seek(void* opaque, int64_t offset, int whence);
+
+	Type type = Type::None;
+	std::string filename;
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	ReadCallback read_callback;
+	SeekCallback seek_callback;
+	int64_t callback_size = -1;
+	int buffer_size = 32 * 1024;
+	std::shared_ptr<Counters> counters;
+};
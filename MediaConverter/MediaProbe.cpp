@@ -0,0 +1,318 @@
+#include "pch.h"
+#include "framework.h"
+#include "MediaProbe.h"
+#include "MediaInput.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace
+{
+	const uint32_t kCacheMagic = 0x4350434d; //"MCPC"
+	const uint32_t kCacheVersion = 1;
+	const uint32_t kMaxString = 64 * 1024; //anything longer means the cache is damaged
+
+	struct CacheHeader
+	{
+		uint32_t magic = kCacheMagic;
+		uint32_t version = kCacheVersion;
+		uint64_t count = 0;
+	};
+
+	bool fileStats(const char* path, int64_t& size, int64_t& mtime)
+	{
+#ifdef _WIN32
+		struct _stat64 st;
+		if (_stat64(path, &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(path, &st) != 0)
+			return false;
+#endif
+		size = (int64_t)st.st_size;
+		mtime = (int64_t)st.st_mtime;
+		return true;
+	}
+
+	int64_t toAvTime(int64_t duration, AVRational timeBase)
+	{
+		return duration == AV_NOPTS_VALUE ? 0 : av_rescale_q(duration, timeBase, AV_TIME_BASE_Q);
+	}
+
+	//stream duration in AV_TIME_BASE, the file's when the stream doesn't have one
+	int64_t streamDuration(const AVFormatContext* ctx, const AVStream* stream)
+	{
+		if (stream->duration != AV_NOPTS_VALUE)
+			return toAvTime(stream->duration, stream->time_base);
+		return ctx->duration != AV_NOPTS_VALUE ? ctx->duration : 0;
+	}
+
+	ErrorCode readInfo(AVFormatContext* ctx, MediaInfo& info, const ProbeOptions& options)
+	{
+		if (options.find_stream_info)
+		{
+			if (options.probe_size > 0)
+				ctx->probesize = options.probe_size;
+			if (options.analyze_duration > 0)
+				ctx->max_analyze_duration = options.analyze_duration;
+			if (avformat_find_stream_info(ctx, nullptr) < 0)
+				return ErrorCode::NO_STREAMS;
+		}
+		if (ctx->nb_streams < 1)
+			return ErrorCode::NO_STREAMS;
+
+		info.format_name = ctx->iformat && ctx->iformat->name ? ctx->iformat->name : "";
+		info.duration = ctx->duration != AV_NOPTS_VALUE ? ctx->duration : 0;
+		info.bit_rate = ctx->bit_rate;
+
+		int video = av_find_best_stream(ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+		if (video >= 0)
+		{
+			AVStream* stream = ctx->streams[video];
+			const AVCodecParameters* par = stream->codecpar;
+			info.video_stream_index = video;
+			info.video_codec = avcodec_get_name(par->codec_id);
+			info.width = par->width;
+			info.height = par->height;
+			info.frame_rate = av_guess_frame_rate(ctx, stream, nullptr);
+			info.fps = info.frame_rate.num > 0 && info.frame_rate.den > 0 ? av_q2d(info.frame_rate) : 0.0;
+			info.video_duration = streamDuration(ctx, stream);
+			info.video_frames = (std::max)((int64_t)0, stream->nb_frames);
+			info.video_bit_rate = par->bit_rate;
+			info.pix_fmt = (AVPixelFormat)par->format;
+		}
+
+		int audio = av_find_best_stream(ctx, AVMEDIA_TYPE_AUDIO, -1, video, nullptr, 0);
+		if (audio >= 0)
+		{
+			AVStream* stream = ctx->streams[audio];
+			const AVCodecParameters* par = stream->codecpar;
+			info.audio_stream_index = audio;
+			info.audio_codec = avcodec_get_name(par->codec_id);
+			info.sample_rate = par->sample_rate;
+			info.channels = par->channels;
+			info.audio_duration = streamDuration(ctx, stream);
+			info.audio_bit_rate = par->bit_rate;
+		}
+
+		return info.HasVideo() || info.HasAudio() ? ErrorCode::SUCCESS : ErrorCode::NO_STREAMS;
+	}
+
+	template<typename T>
+	void writeValue(std::ostream& out, const T& value)
+	{
+		out.write((const char*)&value, sizeof(T));
+	}
+
+	template<typename T>
+	bool readValue(std::istream& in, T& value)
+	{
+		return (bool)in.read((char*)&value, sizeof(T));
+	}
+
+	void writeString(std::ostream& out, const std::string& value)
+	{
+		writeValue(out, (uint32_t)value.size());
+		out.write(value.data(), value.size());
+	}
+
+	bool readString(std::istream& in, std::string& value)
+	{
+		uint32_t size = 0;
+		if (!readValue(in, size) || size > kMaxString)
+			return false;
+		value.resize(size);
+		return size == 0 || (bool)in.read(&value[0], size);
+	}
+
+	void writeInfo(std::ostream& out, const MediaInfo& info)
+	{
+		writeString(out, info.path);
+		writeValue(out, info.file_size);
+		writeValue(out, info.file_mtime);
+		writeValue(out, (int32_t)info.error);
+		writeString(out, info.format_name);
+		writeValue(out, info.duration);
+		writeValue(out, info.bit_rate);
+
+		writeValue(out, (int32_t)info.video_stream_index);
+		writeString(out, info.video_codec);
+		writeValue(out, (int32_t)info.width);
+		writeValue(out, (int32_t)info.height);
+		writeValue(out, (int32_t)info.frame_rate.num);
+		writeValue(out, (int32_t)info.frame_rate.den);
+		writeValue(out, info.video_duration);
+		writeValue(out, info.video_frames);
+		writeValue(out, info.video_bit_rate);
+		writeValue(out, (int32_t)info.pix_fmt);
+
+		writeValue(out, (int32_t)info.audio_stream_index);
+		writeString(out, info.audio_codec);
+		writeValue(out, (int32_t)info.sample_rate);
+		writeValue(out, (int32_t)info.channels);
+		writeValue(out, info.audio_duration);
+		writeValue(out, info.audio_bit_rate);
+	}
+
+	bool readInt(std::istream& in, int& value)
+	{
+		int32_t stored = 0;
+		if (!readValue(in, stored))
+			return false;
+		value = stored;
+		return true;
+	}
+
+	bool readInfo(std::istream& in, MediaInfo& info)
+	{
+		int error = 0, pix_fmt = 0;
+		bool ok = readString(in, info.path) && readValue(in, info.file_size) && readValue(in, info.file_mtime) &&
+			readInt(in, error) && readString(in, info.format_name) && readValue(in, info.duration) && readValue(in, info.bit_rate) &&
+			readInt(in, info.video_stream_index) && readString(in, info.video_codec) && readInt(in, info.width) &&
+			readInt(in, info.height) && readInt(in, info.frame_rate.num) && readInt(in, info.frame_rate.den) &&
+			readValue(in, info.video_duration) && readValue(in, info.video_frames) && readValue(in, info.video_bit_rate) &&
+			readInt(in, pix_fmt) &&
+			readInt(in, info.audio_stream_index) && readString(in, info.audio_codec) && readInt(in, info.sample_rate) &&
+			readInt(in, info.channels) && readValue(in, info.audio_duration) && readValue(in, info.audio_bit_rate);
+		if (!ok)
+			return false;
+
+		info.error = (ErrorCode)error;
+		info.pix_fmt = (AVPixelFormat)pix_fmt;
+		info.fps = info.frame_rate.num > 0 && info.frame_rate.den > 0 ? av_q2d(info.frame_rate) : 0.0;
+		return true;
+	}
+}
+
+MediaProbe::MediaProbe(const ProbeOptions& options) : options(options), pool(options.threads)
+{
+}
+
+MediaProbe::~MediaProbe()
+{
+	pool.WaitIdle();
+}
+
+ErrorCode MediaProbe::Probe(const char* path, MediaInfo& info, const ProbeOptions& options)
+{
+	int64_t size = -1, mtime = -1;
+	if (!path || !fileStats(path, size, mtime))
+	{
+		info = MediaInfo();
+		info.path = path ? path : "";
+		return info.error = ErrorCode::FMT_UNOPENED;
+	}
+
+	ErrorCode ret = Probe(MediaInput::FromFile(path), info, options);
+	info.path = path;
+	info.file_size = size;
+	info.file_mtime = mtime;
+	return ret;
+}
+
+ErrorCode MediaProbe::Probe(const MediaInput& input, MediaInfo& info, const ProbeOptions& options)
+{
+	info = MediaInfo();
+	AVFormatContext* ctx = nullptr;
+	AVIOContext* io = nullptr;
+	ErrorCode ret = input.Open(&ctx, &io);
+	if (ret == ErrorCode::SUCCESS)
+		ret = readInfo(ctx, info, options);
+	MediaInput::Close(&ctx, &io);
+	return info.error = ret;
+}
+
+ProbeStats MediaProbe::Run(const std::vector<std::string>& files, std::vector<MediaInfo>& results)
+{
+	auto start = std::chrono::steady_clock::now();
+	if (!cache_loaded && options.cache_path)
+		loadCache();
+	cache_loaded = true;
+
+	ProbeStats stats;
+	stats.files = files.size();
+	results.assign(files.size(), MediaInfo());
+
+	//a cache hit costs a stat, only the misses go to the pool
+	std::vector<size_t> misses;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		auto cached = cache.find(files[i]);
+		int64_t size = -1, mtime = -1;
+		if (cached != cache.end() && fileStats(files[i].c_str(), size, mtime) &&
+			cached->second.file_size == size && cached->second.file_mtime == mtime)
+		{
+			results[i] = cached->second;
+			++stats.cached;
+		}
+		else
+			misses.push_back(i);
+	}
+
+	for (size_t i : misses)
+	{
+		pool.Submit([this, i, &files, &results](size_t)
+		{
+			Probe(files[i].c_str(), results[i], options);
+		});
+	}
+	pool.WaitIdle();
+
+	//files that couldn't even be stat'ed have nothing to key an entry on
+	for (size_t i : misses)
+	{
+		if (results[i].file_size >= 0)
+			cache[files[i]] = results[i];
+	}
+	for (const MediaInfo& info : results)
+	{
+		if (info.error != ErrorCode::SUCCESS)
+			++stats.failed;
+	}
+
+	stats.probed = misses.size();
+	if (!misses.empty() && options.cache_path)
+		saveCache();
+
+	stats.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+bool MediaProbe::loadCache()
+{
+	std::ifstream in(options.cache_path, std::ios::binary);
+	if (!in)
+		return false;
+
+	CacheHeader header;
+	if (!readValue(in, header) || header.magic != kCacheMagic || header.version != kCacheVersion)
+		return false;
+
+	//entries read before any damage are still good
+	for (uint64_t i = 0; i < header.count; ++i)
+	{
+		MediaInfo info;
+		if (!readInfo(in, info))
+			return false;
+		cache[info.path] = info;
+	}
+	return true;
+}
+
+bool MediaProbe::saveCache() const
+{
+	//entries for files outside this scan are kept, one cache can serve several scans of a library
+	std::ofstream out(options.cache_path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	CacheHeader header;
+	header.count = cache.size();
+	writeValue(out, header);
+	for (const auto& entry : cache)
+		writeInfo(out, entry.second);
+	return out.good();
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "MediaConverter.h"
+#include "WorkerPool.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//what the MediaReaderState accessors report, read from the container without opening a decoder
+struct MediaInfo
+{
+	ErrorCode error = ErrorCode::SUCCESS;
+	std::string path;
+	int64_t file_size = -1; //with file_mtime, what decides if a cached entry still belongs to the file
+	int64_t file_mtime = -1;
+
+	std::string format_name;
+	int64_t duration = 0; //AV_TIME_BASE units
+	int64_t bit_rate = 0;
+
+	int video_stream_index = -1; //best video stream, -1 when there's none
+	std::string video_codec;
+	int width = 0;
+	int height = 0;
+	AVRational frame_rate = { 0, 1 };
+	double fps = 0.0;
+	int64_t video_duration = 0; //AV_TIME_BASE units
+	int64_t video_frames = 0; //0 when the container doesn't say
+	int64_t video_bit_rate = 0;
+	AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+
+	int audio_stream_index = -1;
+	std::string audio_codec;
+	int sample_rate = 0;
+	int channels = 0;
+	int64_t audio_duration = 0; //AV_TIME_BASE units
+	int64_t audio_bit_rate = 0;
+
+	bool HasVideo() const { return video_stream_index >= 0; }
+	bool HasAudio() const { return audio_stream_index >= 0; }
+};
+
+struct ProbeOptions
+{
+	bool find_stream_info = false; //needed for containers whose header lacks the frame rate/duration, it decodes a few frames
+	int64_t probe_size = 0; //caps for find_stream_info, 0 keeps ffmpeg's defaults
+	int64_t analyze_duration = 0;
+	size_t threads = 0; //batch only, 0 uses every hardware thread
+	const char* cache_path = nullptr; //batch only, binary cache loaded before a scan and rewritten after it when anything changed
+};
+
+struct ProbeStats
+{
+	size_t files = 0;
+	size_t cached = 0; //answered from the cache, the file was only stat'ed
+	size_t probed = 0;
+	size_t failed = 0;
+	double wall_ms = 0.0;
+};
+
+/*
+* metadata without openVideoReader: the container is opened and its stream parameters read, no frames,
+* packets or codec contexts are allocated. Run probes a list of files on a worker pool and keeps the
+* results in a cache keyed on path + size + mtime, so re-scanning a library only opens what changed.
+* failures are cached too, a broken file isn't retried until it's modified
+*/
+class MEDIACONVERTER_API MediaProbe
+{
+public:
+	explicit MediaProbe(const ProbeOptions& options = ProbeOptions());
+	~MediaProbe();
+	MediaProbe(const MediaProbe&) = delete;
+	MediaProbe& operator=(const MediaProbe&) = delete;
+
+	static ErrorCode Probe(const char* path, MediaInfo& info, const ProbeOptions& options = ProbeOptions());
+	static ErrorCode Probe(const MediaInput& input, MediaInfo& info, const ProbeOptions& options = ProbeOptions());
+
+	//results line up with files
+	ProbeStats Run(const std::vector<std::string>& files, std::vector<MediaInfo>& results);
+
+private:
+	bool loadCache();
+	bool saveCache() const;
+
+	ProbeOptions options;
+	WorkerPool pool;
+	std::unordered_map<std::string, MediaInfo> cache;
+	bool cache_loaded = false;
+};
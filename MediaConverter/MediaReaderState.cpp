@@ -1,27 +1,112 @@
 #include "pch.h"
 #include "framework.h"
 #include "MediaReaderState.h"
+#include "DecoderPool.h"
+#include "MediaInput.h"
+#include "ThreadBudget.h"
 #include <algorithm>
 #include <cmath>
+#include <thread>
 
-MediaReaderState::MediaReaderState()
+namespace
 {
+	//pooled decoders come back from DecoderPool already opened (reused when a matching one was released),
+	//otherwise this is the usual alloc/open. either way Close knows which one it got
+	ErrorCode openDecoder(const AVCodecParameters* params, const DecodeThreading& threading, bool pooled, AVCodecContext** ctx)
+	{
+		if (pooled)
+			return DecoderPool::Instance().Acquire(params, threading, ctx);
+
+		AVCodec* codec = avcodec_find_decoder(params->codec_id);
+		if (!codec)
+			return ErrorCode::NO_CODEC;
+
+		*ctx = avcodec_alloc_context3(codec);
+		if (!*ctx)
+			return ErrorCode::NO_CODEC_CTX;
+
+		threading.Apply(*ctx);
+
+		if (avcodec_parameters_to_context(*ctx, params) < 0)
+		{
+			avcodec_free_context(ctx);
+			return ErrorCode::CODEC_CTX_UNINIT;
+		}
+
+		if (avcodec_open2(*ctx, codec, NULL) < 0)
+		{
+			avcodec_free_context(ctx);
+			return ErrorCode::CODEC_UNOPENED;
+		}
+
+		return ErrorCode::SUCCESS;
+	}
+
+	//opened without avformat_find_stream_info some containers only have the duration of the whole file
+	int64_t streamDuration(const AVFormatContext* ctx, int index)
+	{
+		const AVStream* stream = ctx->streams[index];
+		if (stream->duration != AV_NOPTS_VALUE || ctx->duration == AV_NOPTS_VALUE)
+			return stream->duration;
+		return av_rescale_q(ctx->duration, AV_TIME_BASE_Q, stream->time_base);
+	}
 }
 
-MediaReaderState::MediaReaderState(const MediaReaderState& other) : 
-av_format_ctx(other.av_format_ctx), 
-video_codec_ctx(other.video_codec_ctx),
-av_frame(other.av_frame),
-av_packet(other.av_packet),
-sws_scaler_ctx(other.sws_scaler_ctx),
-video_stream_index(other.video_stream_index),
-audio_codec_ctx(other.audio_codec_ctx),
-audio_stream_index(other.audio_stream_index)
+void DecodeThreading::Apply(AVCodecContext* ctx) const
 {
+	ctx->thread_count = threads;
+	bool lowLatency = tuning == DecodeTuning::LowLatency;
+	if (type == ThreadType::Frame)
+		ctx->thread_type = FF_THREAD_FRAME;
+	else if (type == ThreadType::Slice || lowLatency)
+		ctx->thread_type = FF_THREAD_SLICE;
+	else
+		ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	if (lowLatency)
+		ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+}
+
+//use_budget only matters before the threads are resolved, two decoders opened with the same settings behave the same
+bool DecodeThreading::operator==(const DecodeThreading& other) const
+{
+	return threads == other.threads && type == other.type && tuning == other.tuning;
+}
+
+MediaReaderState::MediaReaderState()
+{
+	if (StageTimings::Enabled())
+		stage_timings.reset(new StageTimings());
 }
 
 MediaReaderState::~MediaReaderState()
 {
+	Close();
+}
+
+void MediaReaderState::Close()
+{
+	//the decode threads use everything below, they have to be gone first
+	read_ahead.reset();
+	demux_pipeline.reset();
+	scaler_cache.Clear();
+	ReleaseConvertedFramePool();
+	ResetResampler();
+	MediaInput::Close(&av_format_ctx, &av_io_ctx);
+	//pooled decoders are flushed and parked for the next open, anything else is freed
+	DecoderPool::Instance().Release(video_codec_ctx);
+	DecoderPool::Instance().Release(audio_codec_ctx);
+	avcodec_free_context(&video_codec_ctx);
+	avcodec_free_context(&audio_codec_ctx);
+	ThreadBudget::Instance().Release(budget_threads);
+	budget_threads = 0;
+	av_frame_free(&av_frame);
+	av_packet_free(&av_packet);
+	frame_buffer_pool.Trim();
+	frame_index.reset();
+	video_stream_index = -1;
+	audio_stream_index = -1;
+	decoders_opened = false;
+	SetIsOpened(false);
 }
 
 bool MediaReaderState::IsEqual(const MediaReaderState& other)
@@ -30,7 +115,6 @@ bool MediaReaderState::IsEqual(const MediaReaderState& other)
 		video_codec_ctx == other.video_codec_ctx &&
 		av_frame == other.av_frame &&
 		av_packet == other.av_packet &&
-		sws_scaler_ctx == other.sws_scaler_ctx &&
 		video_stream_index == other.video_stream_index &&
 		audio_codec_ctx == other.audio_codec_ctx &&
 		audio_stream_index == other.audio_stream_index;
@@ -47,12 +131,11 @@ int MediaReaderState::FPS() const
 
 int64_t MediaReaderState::VideoFrameInterval() const
 {
-	if (!IsRationalValid(VideoTimebase()))
-		return 1;
-	auto ret = VideoTimebase().den / (double)VideoTimebase().num / VideoAvgFrameRateDbl();
-	if (ret == 0)
+	AVRational rate = VideoFrameRate();
+	if (!IsRationalValid(VideoTimebase()) || rate.num <= 0)
 		return 1;
-	return (int64_t)ret;
+	//ticks per frame, rounded rather than truncated so 1/1000 at 29.97 is 33 and 1/30000 is exactly 1001
+	return (std::max)((int64_t)1, av_rescale_q_rnd(1, av_inv_q(rate), VideoTimebase(), AV_ROUND_NEAR_INF));
 }
 
 int64_t MediaReaderState::AudioFrameInterval() const
@@ -65,6 +148,47 @@ int64_t MediaReaderState::AudioFrameInterval() const
 	return (int64_t)ret;
 }
 
+ErrorCode MediaReaderState::OpenDecoders()
+{
+	if (decoders_opened)
+		return ErrorCode::SUCCESS;
+	if (!av_format_ctx)
+		return ErrorCode::NO_FMT_CTX;
+
+	if (HasVideoStream() && !video_codec_ctx)
+	{
+		//the grant is held even if the open fails, so a retry reuses it instead of asking again. Close gives it back
+		if (threading.use_budget)
+		{
+			if (budget_threads == 0)
+				budget_threads = ThreadBudget::Instance().Acquire(threading.threads);
+			threading.threads = budget_threads;
+		}
+		else if (threading.threads <= 0)
+			threading.threads = (std::max)(1, (int)std::thread::hardware_concurrency());
+
+		ErrorCode ret = openDecoder(av_format_ctx->streams[video_stream_index]->codecpar, threading, pool_decoders, &video_codec_ctx);
+		if (ret != ErrorCode::SUCCESS)
+			return ret;
+	}
+
+	if (HasAudioStream() && !audio_codec_ctx)
+	{
+		//ffmpeg's audio decoders don't thread, extra threads would only be idle
+		DecodeThreading audioThreading;
+		audioThreading.threads = 1;
+		ErrorCode ret = openDecoder(av_format_ctx->streams[audio_stream_index]->codecpar, audioThreading, pool_decoders, &audio_codec_ctx);
+		if (ret != ErrorCode::SUCCESS)
+			return ret;
+
+		if (audio_codec_ctx->channel_layout == 0)
+			audio_codec_ctx->channel_layout = AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT;
+	}
+
+	decoders_opened = true;
+	return ErrorCode::SUCCESS;
+}
+
 AVCodecContext* MediaReaderState::GetCodecCtxFromPkt()
 {
 	return GetCodecCtxFromPkt(av_packet);
@@ -84,7 +208,7 @@ int64_t MediaReaderState::VideoDuration() const
 {
 	if (!HasVideoStream())
 		return 0;
-	return av_format_ctx->streams[video_stream_index]->duration;
+	return streamDuration(av_format_ctx, video_stream_index);
 }
 
 int64_t MediaReaderState::VideoStartTime() const
@@ -109,6 +233,59 @@ double MediaReaderState::VideoAvgFrameRateDbl() const
 	return av_q2d(VideoAvgFrameRate());
 }
 
+AVRational MediaReaderState::VideoFrameRate() const
+{
+	if (!HasVideoStream())
+		return av_make_q(0, 1);
+	AVRational rate = av_guess_frame_rate(av_format_ctx, av_format_ctx->streams[video_stream_index], nullptr);
+	return rate.num > 0 && rate.den > 0 ? rate : av_make_q(0, 1);
+}
+
+int64_t MediaReaderState::FramePts(int64_t frameNumber) const
+{
+	if (HasFrameIndex())
+		return frame_index->FramePts(frameNumber);
+
+	AVRational rate = VideoFrameRate();
+	if (frameNumber < 0 || rate.num <= 0 || !IsRationalValid(VideoTimebase()))
+		return AV_NOPTS_VALUE;
+	int64_t start = VideoStartTime() != AV_NOPTS_VALUE ? VideoStartTime() : 0;
+	return start + av_rescale_q_rnd(frameNumber, av_inv_q(rate), VideoTimebase(), AV_ROUND_NEAR_INF);
+}
+
+int64_t MediaReaderState::FrameNumberAt(int64_t pts) const
+{
+	if (HasFrameIndex())
+		return frame_index->FrameNumberAt(pts);
+
+	AVRational rate = VideoFrameRate();
+	if (pts == AV_NOPTS_VALUE || rate.num <= 0 || !IsRationalValid(VideoTimebase()))
+		return -1;
+	//the extra tick covers muxers that round frame times to the time base
+	int64_t start = VideoStartTime() != AV_NOPTS_VALUE ? VideoStartTime() : 0;
+	int64_t frame = av_rescale_q_rnd(pts - start + 1, VideoTimebase(), av_inv_q(rate), AV_ROUND_DOWN);
+	return (std::max)((int64_t)0, frame);
+}
+
+int64_t MediaReaderState::FrameStartPts(int64_t frameNumber) const
+{
+	if (HasFrameIndex())
+		return frame_index->FramePts(frameNumber);
+
+	//halfway between frame n - 1 and n, whichever way the container rounded frame n it's at or after this
+	AVRational rate = VideoFrameRate();
+	if (frameNumber < 0 || rate.num <= 0 || !IsRationalValid(VideoTimebase()))
+		return AV_NOPTS_VALUE;
+	int64_t start = VideoStartTime() != AV_NOPTS_VALUE ? VideoStartTime() : 0;
+	AVRational halfFrame = av_make_q(rate.den, rate.num * 2);
+	return start + av_rescale_q_rnd(2 * frameNumber - 1, halfFrame, VideoTimebase(), AV_ROUND_UP);
+}
+
+bool MediaReaderState::IsVariableFrameRate() const
+{
+	return HasFrameIndex() && !frame_index->IsConstantRate();
+}
+
 AVRational MediaReaderState::VideoTimebase() const
 {
 	if (!HasVideoStream())
@@ -149,7 +326,7 @@ int64_t MediaReaderState::AudioDuration() const
 {
 	if (!HasAudioStream())
 		return 0;
-	return av_format_ctx->streams[audio_stream_index]->duration;
+	return streamDuration(av_format_ctx, audio_stream_index);
 }
 
 int64_t MediaReaderState::AudioStartTime() const
@@ -192,10 +369,11 @@ double MediaReaderState::AudioTimebaseDbl() const
 
 int MediaReaderState::AudioFrameSize() const
 {
-	if (!HasAudioStream() || !audio_codec_ctx)
+	if (!HasAudioStream())
 		return 0;
 
-	return audio_codec_ctx->frame_size;
+	//the stream's parameters answer this before the decoder is opened
+	return audio_codec_ctx ? audio_codec_ctx->frame_size : av_format_ctx->streams[audio_stream_index]->codecpar->frame_size;
 }
 
 const char* MediaReaderState::CodecName()
@@ -216,10 +394,10 @@ const char* MediaReaderState::CodecName()
 
 AVSampleFormat MediaReaderState::AudioSampleFormat() const
 {
-	if (!HasAudioStream() || !audio_codec_ctx)
+	if (!HasAudioStream())
 		return AV_SAMPLE_FMT_NONE;
 
-	return audio_codec_ctx->sample_fmt;
+	return audio_codec_ctx ? audio_codec_ctx->sample_fmt : (AVSampleFormat)av_format_ctx->streams[audio_stream_index]->codecpar->format;
 }
 
 void MediaReaderState::SetAudioFrameInterval(int64_t interval)
@@ -229,6 +407,59 @@ void MediaReaderState::SetAudioFrameInterval(int64_t interval)
 	audio_frame_interval = interval;
 }
 
+AVBufferPool* MediaReaderState::GetConvertedFramePool(int bufferSize)
+{
+	if (converted_frame_pool && converted_frame_size == bufferSize)
+		return converted_frame_pool;
+
+	//buffers still held by callers stay valid, the pool is only freed once they are all returned
+	ReleaseConvertedFramePool();
+	converted_frame_pool = av_buffer_pool_init(bufferSize, av_buffer_alloc);
+	if (converted_frame_pool)
+		converted_frame_size = bufferSize;
+	return converted_frame_pool;
+}
+
+void MediaReaderState::ReleaseConvertedFramePool()
+{
+	av_buffer_pool_uninit(&converted_frame_pool);
+	converted_frame_size = 0;
+}
+
+SwrContext* MediaReaderState::GetResampler(uint64_t inLayout, AVSampleFormat inFormat, int inRate)
+{
+	if (swr_ctx && swr_in_layout == inLayout && swr_in_fmt == inFormat && swr_in_rate == inRate)
+		return swr_ctx;
+
+	//input parameters changed (or first frame), the old tables are useless now
+	ResetResampler();
+
+	swr_ctx = swr_alloc_set_opts(nullptr, AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT, AV_SAMPLE_FMT_FLT, inRate,
+		inLayout, inFormat, inRate, 0, nullptr);
+	if (!swr_ctx)
+		return nullptr;
+
+	if (swr_init(swr_ctx) < 0)
+	{
+		swr_free(&swr_ctx);
+		return nullptr;
+	}
+
+	swr_in_layout = inLayout;
+	swr_in_fmt = inFormat;
+	swr_in_rate = inRate;
+	++resampler_builds;
+	return swr_ctx;
+}
+
+void MediaReaderState::ResetResampler()
+{
+	swr_free(&swr_ctx);
+	swr_in_layout = 0;
+	swr_in_fmt = AV_SAMPLE_FMT_NONE;
+	swr_in_rate = 0;
+}
+
 bool MediaReaderState::IsRationalValid(const AVRational& rational) const
 {
 	//num can be 0 but den can't 
@@ -272,7 +503,7 @@ bool VideoFrameData::operator==(const VideoFrameData& other)
 		pkt_size == other.pkt_size;
 }
 
-bool VideoFrameData::FillDataFromFrame(AVFrame* frame)
+bool VideoFrameData::FillDataFromFrame(const AVFrame* frame)
 {
 	if (!frame)
 		return false;
@@ -329,7 +560,7 @@ bool AudioFrameData::operator==(const AudioFrameData& other)
 
 //the data provided by the frame isn't necessarily the same for each frame
 //so we selectively update values based on certain needs 
-bool AudioFrameData::FillDataFromFrame(AVFrame* frame)
+bool AudioFrameData::FillDataFromFrame(const AVFrame* frame)
 {
 	if (!frame)
 		return false;
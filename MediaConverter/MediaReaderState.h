@@ -14,6 +14,65 @@ extern "C"
 #include <libswresample/swresample.h>
 #include <libavutil/timestamp.h>
 }
+#include "FrameIndex.h"
+#include "FrameBufferPool.h"
+#include "ScalerCache.h"
+#include "SliceScaler.h"
+#include "StageTimings.h"
+#include "ReadAheadQueue.h"
+#include "DemuxPipeline.h"
+#include <memory>
+
+enum class ErrorCode : int; //defined in MediaConverter.h
+
+//which of the best video/audio streams openVideoReader activates, every other stream is discarded by the demuxer
+enum class StreamSelection : int
+{
+	Video = 1,
+	Audio = 2,
+	Both = Video | Audio
+};
+
+enum class ThreadType : int
+{
+	Auto, //frame + slice for throughput, slice only for low latency
+	Frame, //a frame in flight per thread, best throughput but every thread adds a frame of delay
+	Slice //no added delay, only helps streams encoded with several slices
+};
+
+enum class DecodeTuning : int
+{
+	Throughput,
+	LowLatency //no frame threading unless asked for, and AV_CODEC_FLAG_LOW_DELAY
+};
+
+//how a reader's video decoder is threaded. audio decoders always get one thread, ffmpeg's don't thread
+struct DecodeThreading
+{
+	//0 takes a fair share from ThreadBudget, anything else is an upper bound the budget may lower. opening several
+	//readers at once, call ThreadBudget::Instance().SetExpectedDecoders first or the later ones get what is left
+	int threads = 0;
+	ThreadType type = ThreadType::Auto;
+	DecodeTuning tuning = DecodeTuning::Throughput;
+	bool use_budget = true; //false takes threads as given (0 = every hardware thread) without counting them
+
+	void Apply(AVCodecContext* ctx) const; //thread_count/thread_type/flags, threads has to be resolved first
+	bool operator==(const DecodeThreading& other) const;
+};
+
+struct OpenOptions
+{
+	StreamSelection streams = StreamSelection::Both;
+	bool find_stream_info = true; //probe for what the container doesn't store (frame rate, duration), bounded by the two caps below
+	int64_t probe_size = 0; //bytes the probe may read, 0 keeps ffmpeg's default
+	int64_t analyze_duration = 0; //AV_TIME_BASE units of media the probe may look at, 0 keeps ffmpeg's default
+	bool lazy_decoders = false; //open the decoders on the first read/seek instead of here, metadata queries never pay for them
+	bool build_index = false; //scan the video packets once at open so seeks can jump straight to the right keyframe
+	const char* index_path = nullptr; //sidecar for the index, loaded when it matches the file, written after a scan otherwise
+	bool pool_decoders = true; //reuse warm decoder contexts from DecoderPool, closeVideoReader hands them back
+	DecodeThreading threading;
+	bool map_file = false; //read the file through a memory mapping instead of ffmpeg's file protocol, see MediaInput::FromMappedFile
+};
 
 struct VideoFrameData
 {
@@ -24,7 +83,7 @@ public:
 	VideoFrameData& operator=(const VideoFrameData& other);
 	bool operator==(const VideoFrameData& other);
 
-	bool FillDataFromFrame(AVFrame* frame);
+	bool FillDataFromFrame(const AVFrame* frame);
 	bool FillDataFromPacket(AVPacket* packet);
 	int FrameNumber() { return frame_number; }
 	int64_t PktPts() { return pkt_pts; }
@@ -52,7 +111,7 @@ struct AudioFrameData
 	AudioFrameData& operator=(const AudioFrameData& other);
 	bool operator==(const AudioFrameData& other);
 
-	bool FillDataFromFrame(AVFrame* frame);
+	bool FillDataFromFrame(const AVFrame* frame);
 	bool UpdateBitRate(AVCodecContext* ctx);
 	int BufferSize(AVSampleFormat fmt) const;
 
@@ -76,17 +135,29 @@ private:
 	int64_t bit_rate = -1;
 };
 
+/*
+* everything one open reader owns. the contexts are released by Close (or the destructor), so the state
+* can't be copied - two copies used to share the same decoders and free them twice. it isn't movable either,
+* the read ahead thread and the pools hold on to its address; hand out ownership through a pointer instead
+* (see SessionManager)
+*/
 class MEDIACONVERTER_API MediaReaderState
 {
 public:
 	MediaReaderState();
-	MediaReaderState(const MediaReaderState& other);
+	MediaReaderState(const MediaReaderState&) = delete;
+	MediaReaderState& operator=(const MediaReaderState&) = delete;
 	~MediaReaderState();
 
+	void Close(); //stops read ahead and releases every context, safe to call on a state that was never opened
+
 	bool IsEqual(const MediaReaderState& other);
 	int FPS() const;
 	int64_t VideoFrameInterval() const;
 	int64_t AudioFrameInterval() const;
+	//opens the selected streams' decoders, a no-op once they're open. the read/seek paths call it, see OpenOptions::lazy_decoders
+	ErrorCode OpenDecoders();
+	bool DecodersOpened() const { return decoders_opened; }
 	AVCodecContext* GetCodecCtxFromPkt();
 	AVCodecContext* GetCodecCtxFromPkt(AVPacket* pkt);
 
@@ -127,6 +198,17 @@ public:
 	int VideoWidth() const;
 	int VideoHeight() const;
 
+	/*
+	* exact frame timing. with a frame index (OpenOptions::build_index) frame numbers map to the real packet
+	* timestamps so variable frame rate files line up, otherwise frame n is at start + n / VideoFrameRate()
+	* in rational math, so 30000/1001 doesn't drift like the double based interval did
+	*/
+	AVRational VideoFrameRate() const; //avg_frame_rate, or r_frame_rate when that one's missing/unreliable. 0/1 when unknown
+	int64_t FramePts(int64_t frameNumber) const; //AV_NOPTS_VALUE when it can't be known
+	int64_t FrameNumberAt(int64_t pts) const; //the frame showing at pts, timestamps rounded by a tick still land on their frame
+	int64_t FrameStartPts(int64_t frameNumber) const; //earliest pts that belongs to the frame, what exact seeks aim at
+	bool IsVariableFrameRate() const; //only detectable with a frame index
+
 	int64_t AudioDuration() const;
 	int64_t AudioStartTime() const;
 	AVRational AudioAvgFrameRate() const;
@@ -140,24 +222,56 @@ public:
 	void SetAudioFrameInterval(int64_t interval);
 	bool IsRationalValid(const AVRational& rational) const;
 
+	//refcounted pool backing converted output frames, recreated when the frame size changes
+	AVBufferPool* GetConvertedFramePool(int bufferSize);
+	void ReleaseConvertedFramePool();
+
+	//Resampler cache - only rebuilt when the input layout/format/rate of the frames changes
+	SwrContext* GetResampler(uint64_t inLayout, AVSampleFormat inFormat, int inRate);
+	void ResetResampler();
+	int ResamplerBuilds() const { return resampler_builds; }
+
+	bool HasFrameIndex() const { return frame_index && !frame_index->IsEmpty(); }
+	const FrameIndex* GetFrameIndex() const { return frame_index.get(); }
+
+	//per stage timings of this reader since it was created, null unless built with MEDIACONVERTER_STAGE_TIMING
+	const StageTimings* Timings() const { return stage_timings.get(); }
+
 	bool IsOpened() const { return is_opened; }
 	void SetIsOpened(bool opened = true) { is_opened = opened; }
 
 	bool is_opened = false;
+	bool decoders_opened = false;
+	bool pool_decoders = true; //from OpenOptions, used when the decoders are opened
+	DecodeThreading threading; //same, threads is what the video decoder was given once it's open
+	int budget_threads = 0; //held from ThreadBudget until Close
 
 	AVFrame* av_frame = nullptr;
 	AVPacket* av_packet = nullptr;
 
 	AVFormatContext* av_format_ctx = nullptr;
+	AVIOContext* av_io_ctx = nullptr; //set when the input isn't a file, see MediaInput
 	AVCodecContext* video_codec_ctx = nullptr;
-	SwsContext* sws_scaler_ctx = nullptr;
+	ScalerCache scaler_cache;
+	std::shared_ptr<SliceScaler> slice_scaler; //set through CMediaConverter::setConversionThreads
+	AVBufferPool* converted_frame_pool = nullptr;
+	int converted_frame_size = 0;
+	FrameBufferPool frame_buffer_pool; //backs the raw pointers handed out by readVideoReaderFrame/loadFrame
 	int video_stream_index = -1;
 
 	VideoFrameData videoFrameData;
+	std::shared_ptr<FrameIndex> frame_index;
+	std::shared_ptr<ReadAheadQueue> read_ahead; //set through CMediaConverter::startReadAhead
+	std::shared_ptr<DemuxPipeline> demux_pipeline; //set through CMediaConverter::startDemuxPipeline
+	std::unique_ptr<StageTimings> stage_timings;
 
 	//Audio details
 	AVCodecContext* audio_codec_ctx = nullptr;
 	SwrContext* swr_ctx = nullptr;
+	uint64_t swr_in_layout = 0;
+	AVSampleFormat swr_in_fmt = AV_SAMPLE_FMT_NONE;
+	int swr_in_rate = 0;
+	int resampler_builds = 0;
 	int audio_stream_index = -1;
 
 	AudioFrameData audioFrameData;
@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "framework.h"
+#include "PacketRange.h"
+
+namespace
+{
+	//muxers only interleave roughly (mp4 chunks are ~1s), so audio belonging after start can sit in the
+	//file ahead of the video keyframe. seeking this much earlier picks those packets up
+	const int64_t kSeekPreroll = AV_TIME_BASE;
+
+	int64_t packetTime(const AVPacket* pkt)
+	{
+		return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+	}
+}
+
+PacketRange::PacketRange(AVFormatContext* fmt_ctx, int64_t start, int64_t end, bool decodeTail) :
+	fmt_ctx(fmt_ctx), start_time(start), end_time(end), decode_tail(decodeTail)
+{
+	video_stream = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (video_stream < 0)
+		video_stream = -1;
+
+	cuts.resize(fmt_ctx->nb_streams);
+	for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i)
+	{
+		AVStream* stream = fmt_ctx->streams[i];
+		StreamCut& cut = cuts[i];
+		if (start != AV_NOPTS_VALUE)
+			cut.start = av_rescale_q(start, AV_TIME_BASE_Q, stream->time_base);
+		if (end != AV_NOPTS_VALUE)
+			cut.end = av_rescale_q(end, AV_TIME_BASE_Q, stream->time_base);
+
+		AVMediaType type = stream->codecpar->codec_type;
+		cut.tracked = stream->discard != AVDISCARD_ALL && (type == AVMEDIA_TYPE_AUDIO || type == AVMEDIA_TYPE_VIDEO);
+	}
+}
+
+int PacketRange::Seek()
+{
+	if (start_time == AV_NOPTS_VALUE)
+		return 0;
+
+	int64_t target = start_time;
+	if (video_stream >= 0)
+	{
+		//find which keyframe the video has to start on, then back off from there for the other streams
+		StreamCut& cut = cuts[video_stream];
+		int ret = av_seek_frame(fmt_ctx, video_stream, cut.start, AVSEEK_FLAG_BACKWARD);
+		if (ret < 0)
+			return ret;
+
+		AVPacket* pkt = av_packet_alloc();
+		if (!pkt)
+			return AVERROR(ENOMEM);
+		while (av_read_frame(fmt_ctx, pkt) >= 0)
+		{
+			bool found = pkt->stream_index == video_stream && (pkt->flags & AV_PKT_FLAG_KEY) && packetTime(pkt) != AV_NOPTS_VALUE;
+			if (found)
+				video_start = (std::min)(packetTime(pkt), cut.start);
+			av_packet_unref(pkt);
+			if (found)
+				break;
+		}
+		av_packet_free(&pkt);
+
+		if (video_start != AV_NOPTS_VALUE)
+		{
+			cut.start = video_start;
+			target = (std::min)(target, av_rescale_q(video_start, fmt_ctx->streams[video_stream]->time_base, AV_TIME_BASE_Q));
+		}
+	}
+
+	target -= kSeekPreroll;
+	return avformat_seek_file(fmt_ctx, -1, INT64_MIN, target, target, 0);
+}
+
+bool PacketRange::Accept(const AVPacket* pkt)
+{
+	if (pkt->stream_index < 0 || pkt->stream_index >= (int)cuts.size())
+		return false;
+
+	StreamCut& cut = cuts[pkt->stream_index];
+	int64_t ts = packetTime(pkt);
+
+	if (pkt->stream_index == video_stream)
+	{
+		if (!cut.started)
+		{
+			if (!(pkt->flags & AV_PKT_FLAG_KEY) || (cut.start != AV_NOPTS_VALUE && (ts == AV_NOPTS_VALUE || ts < cut.start)))
+				return false;
+			cut.started = true;
+		}
+
+		if (cut.end_key_seen)
+		{
+			if (!cut.passed && ts != AV_NOPTS_VALUE && ts < cut.end)
+				return true;
+			pass(cut);
+			return false;
+		}
+
+		if (cut.end != AV_NOPTS_VALUE && (pkt->flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE && ts >= cut.end)
+		{
+			cut.end_key_seen = true;
+			if (!decode_tail)
+			{
+				pass(cut);
+				return false;
+			}
+			return true; //the decoder needs it for the leading pictures that follow
+		}
+		return true;
+	}
+
+	//packets without any timestamp go wherever their neighbours went
+	if (ts == AV_NOPTS_VALUE)
+		return cut.started && !cut.passed;
+
+	if (cut.start != AV_NOPTS_VALUE && ts < cut.start)
+		return false;
+	if (cut.end != AV_NOPTS_VALUE && ts >= cut.end)
+	{
+		pass(cut);
+		return false;
+	}
+	cut.started = true;
+	return true;
+}
+
+bool PacketRange::InRange(int streamIndex, int64_t pts) const
+{
+	if (streamIndex < 0 || streamIndex >= (int)cuts.size() || pts == AV_NOPTS_VALUE)
+		return true;
+
+	//frames go by the requested start, not the keyframe the video had to start decoding from
+	AVRational time_base = fmt_ctx->streams[streamIndex]->time_base;
+	if (start_time != AV_NOPTS_VALUE && pts < av_rescale_q(start_time, AV_TIME_BASE_Q, time_base))
+		return false;
+	return cuts[streamIndex].end == AV_NOPTS_VALUE || pts < cuts[streamIndex].end;
+}
+
+void PacketRange::pass(StreamCut& cut)
+{
+	if (cut.passed)
+		return;
+	cut.passed = true;
+
+	done = true;
+	for (const StreamCut& other : cuts)
+	{
+		if (other.tracked && !other.passed)
+			done = false;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+#include <vector>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+/*
+* picks the demuxed packets that belong to a [start, end) cut of a file, times in AV_TIME_BASE units
+* (AV_NOPTS_VALUE leaves that side open). audio and other streams are cut on packet pts. the video stream
+* is cut in decode order on keyframes: it starts at the keyframe at or before start and stops before the
+* first keyframe at or after end, so back to back ranges split on keyframes copy every packet exactly once.
+* with decodeTail (transcoding) the packets after that last keyframe which still present before end are
+* let through too, the leading pictures of an open gop need them, and InRange says which frames to keep
+*/
+class MEDIACONVERTER_API PacketRange
+{
+public:
+	PacketRange(AVFormatContext* fmt_ctx, int64_t start, int64_t end, bool decodeTail = false);
+
+	int Seek(); //positions the demuxer for the cut, returns 0 or an AVERROR
+	bool Accept(const AVPacket* pkt);
+	bool Done() const { return done; } //every audio/video stream is past end, stop demuxing
+	bool InRange(int streamIndex, int64_t pts) const; //pts in the stream's time_base
+	int VideoStream() const { return video_stream; }
+	int64_t VideoStart() const { return video_start; } //pts of the keyframe the video starts on, once Seek found it
+
+private:
+	struct StreamCut
+	{
+		int64_t start = AV_NOPTS_VALUE;
+		int64_t end = AV_NOPTS_VALUE;
+		bool tracked = false; //audio/video, Done waits for these
+		bool started = false;
+		bool end_key_seen = false;
+		bool passed = false;
+	};
+
+	void pass(StreamCut& cut);
+
+	AVFormatContext* fmt_ctx;
+	int64_t start_time;
+	int64_t end_time;
+	bool decode_tail;
+	int video_stream = -1;
+	int64_t video_start = AV_NOPTS_VALUE;
+	std::vector<StreamCut> cuts;
+	bool done = false;
+};
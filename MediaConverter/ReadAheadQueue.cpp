@@ -0,0 +1,125 @@
+#include "pch.h"
+#include "framework.h"
+#include "ReadAheadQueue.h"
+
+ReadAheadQueue::ReadAheadQueue(Producer producer, size_t depth) : producer(producer), queue(depth), cancel(false), decoded(0)
+{
+}
+
+ReadAheadQueue::~ReadAheadQueue()
+{
+	Stop();
+}
+
+void ReadAheadQueue::Start()
+{
+	if (running)
+		return;
+
+	cancel = false;
+	finished = false;
+	final_result = 0;
+	queue.Reset();
+	worker = std::thread(&ReadAheadQueue::run, this);
+	running = true;
+}
+
+void ReadAheadQueue::Stop()
+{
+	halt();
+
+	for (auto& item : queue.Reset())
+	{
+		if (item.result == 0)
+			++discarded;
+	}
+	if (has_rejected && rejected.result == 0)
+		++discarded;
+	rejected = Item();
+	has_rejected = false;
+	finished = false;
+}
+
+void ReadAheadQueue::Pause()
+{
+	halt();
+	queue.Reopen();
+}
+
+//stops the producer, what it decoded stays in the queue
+void ReadAheadQueue::halt()
+{
+	if (!running)
+		return;
+
+	//the producer finishes the frame it is on, Abort makes sure it isn't left blocked on a full queue
+	cancel = true;
+	queue.Abort();
+	if (worker.joinable())
+		worker.join();
+	running = false;
+}
+
+int ReadAheadQueue::Pop(FrameHandle& frame)
+{
+	if (finished)
+		return final_result;
+
+	Item item;
+	if (!running)
+	{
+		//frames decoded before a pause go out before the producer starts again
+		if (queue.TryPop(item))
+			return take(item, frame);
+		if (has_rejected)
+		{
+			item = std::move(rejected);
+			rejected = Item();
+			has_rejected = false;
+			return take(item, frame);
+		}
+		Start();
+	}
+
+	if (queue.Size() == 0)
+		++underruns;
+
+	if (!queue.Pop(item))
+		return final_result;
+	return take(item, frame);
+}
+
+int ReadAheadQueue::take(Item& item, FrameHandle& frame)
+{
+	if (item.result != 0)
+	{
+		finished = true;
+		final_result = item.result;
+		return final_result;
+	}
+
+	frame = std::move(item.frame);
+	return 0;
+}
+
+void ReadAheadQueue::run()
+{
+	while (!cancel)
+	{
+		Item item;
+		item.result = producer(item.frame);
+		bool last = item.result != 0;
+		if (!last)
+			++decoded;
+
+		if (!queue.Offer(item))
+		{
+			//still ours when the queue was aborted, the consumer picks it up after the join
+			rejected = std::move(item);
+			has_rejected = true;
+			break;
+		}
+		if (last)
+			break;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "BoundedQueue.h"
+#include "FrameHandle.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+/*
+* background decode thread that keeps up to depth frames ready ahead of the consumer.
+* the producer returns 0 for a frame, anything else (eof, errors) ends the run once the consumer reaches it.
+* Start/Stop/Pause/Pop all belong to the consumer thread; Stop drops whatever was decoded ahead so a seek
+* never hands back stale frames, and the next Pop starts decoding again from the new position.
+* Pause only parks the decode thread, so someone else can use the demuxer, the frames already decoded
+* are still handed out first and the thread comes back once they are gone
+*/
+class MEDIACONVERTER_API ReadAheadQueue
+{
+public:
+	typedef std::function<int(FrameHandle& frame)> Producer;
+
+	ReadAheadQueue(Producer producer, size_t depth);
+	~ReadAheadQueue();
+	ReadAheadQueue(const ReadAheadQueue&) = delete;
+	ReadAheadQueue& operator=(const ReadAheadQueue&) = delete;
+
+	void Start();
+	void Stop();
+	void Pause();
+	bool IsRunning() const { return running; }
+
+	int Pop(FrameHandle& frame);
+
+	size_t Depth() const { return queue.Size(); }
+	size_t Capacity() const { return queue.Capacity(); }
+	size_t HighWater() const { return queue.HighWater(); }
+	int64_t Underruns() const { return underruns; } //pops that had to wait on the decoder
+	int64_t Decoded() const { return decoded; }
+	int64_t Discarded() const { return discarded; } //decoded ahead but dropped by a seek/stop
+
+private:
+	struct Item
+	{
+		FrameHandle frame;
+		int result = 0;
+	};
+
+	void run();
+	void halt();
+	int take(Item& item, FrameHandle& frame);
+
+	Producer producer;
+	BoundedQueue<Item> queue;
+	std::thread worker;
+	std::atomic<bool> cancel;
+	bool running = false;
+	bool finished = false;
+	int final_result = 0;
+	Item rejected; //what the producer was pushing when a pause aborted the queue, it comes after everything queued
+	bool has_rejected = false;
+
+	std::atomic<int64_t> decoded;
+	int64_t underruns = 0;
+	int64_t discarded = 0;
+};
@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "framework.h"
+#include "ScalerCache.h"
+extern "C"
+{
+#include <libavutil/pixdesc.h>
+}
+
+ScalerCache::ScalerCache(size_t capacity) : capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+ScalerCache::~ScalerCache()
+{
+	Clear();
+}
+
+SwsContext* ScalerCache::Get(const ScalerKey& key)
+{
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		if (it->key == key)
+		{
+			++hits;
+			entries.splice(entries.begin(), entries, it);
+			return entries.front().ctx;
+		}
+	}
+
+	++misses;
+	SwsContext* ctx = sws_getContext(key.src_width, key.src_height, key.src_fmt, //input
+		key.dst_width, key.dst_height, key.dst_fmt, //output
+		key.flags, NULL, NULL, NULL); //options
+	if (!ctx)
+		return nullptr;
+
+	applyColorspace(ctx, key);
+
+	if (entries.size() >= capacity)
+	{
+		sws_freeContext(entries.back().ctx);
+		entries.pop_back();
+	}
+
+	Entry entry = { key, ctx };
+	entries.push_front(entry);
+	return ctx;
+}
+
+//swscale assumes bt601 unless told otherwise, forward the frame's tags so yuv sources match the fast converter
+void ScalerCache::applyColorspace(SwsContext* ctx, const ScalerKey& key)
+{
+	if (key.colorspace == AVCOL_SPC_UNSPECIFIED && key.color_range == AVCOL_RANGE_UNSPECIFIED)
+		return;
+
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(key.src_fmt);
+	if (!desc || (desc->flags & AV_PIX_FMT_FLAG_RGB))
+		return;
+
+	bool jpeg_fmt = key.src_fmt == AV_PIX_FMT_YUVJ420P || key.src_fmt == AV_PIX_FMT_YUVJ422P || key.src_fmt == AV_PIX_FMT_YUVJ444P;
+	int src_range = key.color_range == AVCOL_RANGE_JPEG || jpeg_fmt ? 1 : 0;
+	const int* coefficients = sws_getCoefficients(key.colorspace == AVCOL_SPC_UNSPECIFIED ? SWS_CS_DEFAULT : key.colorspace);
+	sws_setColorspaceDetails(ctx, coefficients, src_range, coefficients, 1, 0, 1 << 16, 1 << 16);
+}
+
+void ScalerCache::Clear()
+{
+	for (auto& entry : entries)
+		sws_freeContext(entry.ctx);
+	entries.clear();
+}
@@ -0,0 +1,67 @@
+#pragma once
+extern "C"
+{
+#include <libswscale/swscale.h>
+}
+#include <list>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+struct ScalerKey
+{
+	int src_width = 0;
+	int src_height = 0;
+	AVPixelFormat src_fmt = AV_PIX_FMT_NONE;
+	int dst_width = 0;
+	int dst_height = 0;
+	AVPixelFormat dst_fmt = AV_PIX_FMT_NONE;
+	int flags = 0;
+	AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED; //source matrix/range tags, passed on to swscale
+	AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+
+	bool operator==(const ScalerKey& other) const
+	{
+		return src_width == other.src_width && src_height == other.src_height && src_fmt == other.src_fmt &&
+			dst_width == other.dst_width && dst_height == other.dst_height && dst_fmt == other.dst_fmt &&
+			flags == other.flags && colorspace == other.colorspace && color_range == other.color_range;
+	}
+};
+
+/*
+* small least recently used cache of SwsContexts keyed on source/destination format, size and flags.
+* alternating between a few output targets (full size + preview for example) never rebuilds a context
+*/
+class MEDIACONVERTER_API ScalerCache
+{
+public:
+	explicit ScalerCache(size_t capacity = 4);
+	~ScalerCache();
+	ScalerCache(const ScalerCache&) = delete;
+	ScalerCache& operator=(const ScalerCache&) = delete;
+
+	SwsContext* Get(const ScalerKey& key);
+	void Clear();
+
+	size_t Size() const { return entries.size(); }
+	size_t Capacity() const { return capacity; }
+	int64_t Hits() const { return hits; }
+	int64_t Misses() const { return misses; }
+
+private:
+	struct Entry
+	{
+		ScalerKey key;
+		SwsContext* ctx;
+	};
+
+	static void applyColorspace(SwsContext* ctx, const ScalerKey& key);
+
+	std::list<Entry> entries; //most recently used first
+	size_t capacity;
+	int64_t hits = 0;
+	int64_t misses = 0;
+};
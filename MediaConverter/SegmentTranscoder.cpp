@@ -0,0 +1,391 @@
+#include "pch.h"
+#include "framework.h"
+#include "SegmentTranscoder.h"
+#include "FrameIndex.h"
+#include "WorkerPool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	//one per packet in a spool file, followed by size bytes of data. side data isn't kept
+	struct SpoolRecord
+	{
+		int32_t stream_index = 0;
+		int32_t flags = 0;
+		int64_t pts = AV_NOPTS_VALUE;
+		int64_t dts = AV_NOPTS_VALUE;
+		int64_t duration = 0;
+		int32_t size = 0;
+		int32_t reserved = 0;
+	};
+
+	//every segment opened its own encoder, the output only gets the first one's parameters and global headers
+	bool sameStream(const AVCodecParameters* a, const AVCodecParameters* b)
+	{
+		if (a->codec_type != b->codec_type || a->codec_id != b->codec_id || a->format != b->format ||
+			a->width != b->width || a->height != b->height ||
+			a->sample_rate != b->sample_rate || a->channels != b->channels || a->channel_layout != b->channel_layout)
+			return false;
+		if (a->extradata_size != b->extradata_size)
+			return false;
+		return a->extradata_size == 0 || memcmp(a->extradata, b->extradata, a->extradata_size) == 0;
+	}
+}
+
+//[start, end) of the input plus the spool its packets went to
+struct SegmentTranscoder::Segment : public PacketSink
+{
+	~Segment()
+	{
+		for (AVCodecParameters*& par : params)
+			avcodec_parameters_free(&par);
+		out.close();
+		if (!path.empty())
+			std::remove(path.c_str());
+	}
+
+	ErrorCode Open(const AVFormatContext* layout) override
+	{
+		for (unsigned int i = 0; i < layout->nb_streams; ++i)
+		{
+			AVCodecParameters* par = avcodec_parameters_alloc();
+			if (!par || avcodec_parameters_copy(par, layout->streams[i]->codecpar) < 0)
+			{
+				avcodec_parameters_free(&par);
+				return ErrorCode::NO_CODEC_CTX;
+			}
+			params.push_back(par);
+			time_bases.push_back(layout->streams[i]->time_base);
+		}
+
+		out.open(path, std::ios::binary | std::ios::trunc);
+		return out ? ErrorCode::SUCCESS : ErrorCode::NO_OUTPUT_FILE;
+	}
+
+	ErrorCode Write(AVPacket* pkt) override
+	{
+		SpoolRecord record;
+		record.stream_index = pkt->stream_index;
+		record.flags = pkt->flags;
+		record.pts = pkt->pts;
+		record.dts = pkt->dts;
+		record.duration = pkt->duration;
+		record.size = pkt->size;
+		out.write((const char*)&record, sizeof(record));
+		out.write((const char*)pkt->data, pkt->size);
+		++packets;
+		return out ? ErrorCode::SUCCESS : ErrorCode::NO_OUTPUT_FILE;
+	}
+
+	int64_t start = AV_NOPTS_VALUE;
+	int64_t end = AV_NOPTS_VALUE;
+	std::string path;
+	std::ofstream out;
+	std::vector<AVCodecParameters*> params;
+	std::vector<AVRational> time_bases;
+	ErrorCode result = ErrorCode::SUCCESS;
+	int64_t packets = 0;
+};
+
+SegmentTranscoder::SegmentTranscoder(const SegmentOptions& options) : options(options)
+{
+}
+
+SegmentTranscoder::~SegmentTranscoder()
+{
+}
+
+ErrorCode SegmentTranscoder::Run(const char* inFile, const char* outFile)
+{
+	auto start = Clock::now();
+	stats = SegmentStats();
+	segments.clear();
+
+	WorkerPool pool(options.threads);
+	stats.threads = pool.ThreadCount();
+
+	size_t count = options.segments > 0 ? (size_t)options.segments : pool.ThreadCount();
+	ErrorCode ret = findSegments(inFile, outFile, count);
+	stats.index_ms = elapsedMs(start);
+	if (ret != ErrorCode::SUCCESS)
+		return ret;
+	stats.segments = (int)segments.size();
+
+	auto encodeStart = Clock::now();
+	for (auto& segment : segments)
+	{
+		Segment* seg = segment.get();
+		pool.Submit([this, seg, inFile, outFile](size_t)
+		{
+			if (!options.transcode)
+			{
+				seg->result = remuxSegment(inFile, outFile, *seg);
+				return;
+			}
+
+			TranscodeOptions transcode = options.transcode_options;
+			transcode.start_time = seg->start;
+			transcode.end_time = seg->end;
+			Transcoder transcoder(transcode);
+			seg->result = transcoder.Run(inFile, outFile, seg);
+		});
+	}
+	pool.WaitIdle();
+	stats.encode_ms = elapsedMs(encodeStart);
+
+	for (auto& segment : segments)
+	{
+		segment->out.close();
+		if (segment->result != ErrorCode::SUCCESS)
+		{
+			segments.clear();
+			return segment->result;
+		}
+	}
+
+	auto concatStart = Clock::now();
+	ret = concat(outFile);
+	stats.concat_ms = elapsedMs(concatStart);
+	stats.wall_ms = elapsedMs(start);
+
+	segments.clear();
+	return ret;
+}
+
+ErrorCode SegmentTranscoder::findSegments(const char* inFile, const char* outFile, size_t count)
+{
+	AVFormatContext* fmt_ctx = nullptr;
+	if (avformat_open_input(&fmt_ctx, inFile, nullptr, nullptr) < 0)
+		return ErrorCode::FMT_UNOPENED;
+
+	if (avformat_find_stream_info(fmt_ctx, nullptr) < 0)
+	{
+		avformat_close_input(&fmt_ctx);
+		return ErrorCode::NO_STREAMS;
+	}
+
+	//boundaries are keyframe pts spread evenly over the video, audio only files stay in one piece
+	std::vector<int64_t> bounds;
+	int video = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (video >= 0 && count > 1)
+	{
+		FrameIndex index;
+		if (!options.index_path || !index.Load(options.index_path, inFile, video))
+		{
+			if (index.Build(fmt_ctx, video) < 0)
+			{
+				avformat_close_input(&fmt_ctx);
+				return ErrorCode::NO_DATA_AVAIL;
+			}
+			if (options.index_path)
+				index.Save(options.index_path, inFile);
+		}
+
+		if (!index.IsEmpty())
+		{
+			AVRational time_base = fmt_ctx->streams[video]->time_base;
+			int64_t first = index.Entries().front().pts;
+			int64_t last = index.Entries().back().pts;
+			for (size_t i = 1; i < count; ++i)
+			{
+				const FrameIndexEntry* key = index.KeyFrameAtOrBefore(first + (last - first) * (int64_t)i / (int64_t)count);
+				int64_t bound = av_rescale_q(key->pts, time_base, AV_TIME_BASE_Q);
+				if (key->pts > first && (bounds.empty() || bound > bounds.back()))
+					bounds.push_back(bound);
+			}
+		}
+	}
+	avformat_close_input(&fmt_ctx);
+
+	for (size_t i = 0; i <= bounds.size(); ++i)
+	{
+		std::unique_ptr<Segment> segment(new Segment());
+		segment->start = i > 0 ? bounds[i - 1] : AV_NOPTS_VALUE;
+		segment->end = i < bounds.size() ? bounds[i] : AV_NOPTS_VALUE;
+		segment->path = std::string(outFile) + ".seg" + std::to_string(i) + ".tmp";
+		segments.push_back(std::move(segment));
+	}
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode SegmentTranscoder::remuxSegment(const char* inFile, const char* outFile, Segment& segment)
+{
+	AVFormatContext* in_ctx = nullptr;
+	AVFormatContext* layout = nullptr;
+	AVPacket* pkt = nullptr;
+	std::vector<int> stream_map;
+	ErrorCode ret = ErrorCode::SUCCESS;
+
+	//same stream selection as encodeMedia, only the layout context is never written
+	if (avformat_open_input(&in_ctx, inFile, nullptr, nullptr) < 0)
+		return ErrorCode::FMT_UNOPENED;
+	if (avformat_find_stream_info(in_ctx, nullptr) < 0)
+		ret = ErrorCode::NO_STREAMS;
+
+	if (ret == ErrorCode::SUCCESS)
+	{
+		avformat_alloc_output_context2(&layout, nullptr, nullptr, outFile);
+		if (!layout)
+			ret = ErrorCode::NO_CODEC_CTX;
+	}
+
+	for (unsigned int i = 0; ret == ErrorCode::SUCCESS && i < in_ctx->nb_streams; ++i)
+	{
+		AVStream* in_stream = in_ctx->streams[i];
+		AVMediaType type = in_stream->codecpar->codec_type;
+		if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO)
+		{
+			in_stream->discard = AVDISCARD_ALL;
+			stream_map.push_back(-1);
+			continue;
+		}
+
+		AVStream* out_stream = avformat_new_stream(layout, nullptr);
+		if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) < 0)
+			ret = ErrorCode::NO_CODEC_CTX;
+		else
+		{
+			out_stream->time_base = in_stream->time_base;
+			stream_map.push_back(out_stream->index);
+		}
+	}
+
+	if (ret == ErrorCode::SUCCESS)
+		ret = segment.Open(layout);
+
+	PacketRange range(in_ctx, segment.start, segment.end);
+	if (ret == ErrorCode::SUCCESS && range.Seek() < 0)
+		ret = ErrorCode::SEEK_FAILED;
+
+	pkt = av_packet_alloc();
+	while (ret == ErrorCode::SUCCESS && pkt && av_read_frame(in_ctx, pkt) >= 0)
+	{
+		if (stream_map[pkt->stream_index] >= 0 && range.Accept(pkt))
+		{
+			pkt->stream_index = stream_map[pkt->stream_index];
+			ret = segment.Write(pkt);
+		}
+		av_packet_unref(pkt);
+		if (range.Done())
+			break;
+	}
+
+	av_packet_free(&pkt);
+	avformat_free_context(layout);
+	avformat_close_input(&in_ctx);
+	return ret;
+}
+
+ErrorCode SegmentTranscoder::concat(const char* outFile)
+{
+	const Segment& first = *segments.front();
+	for (auto& segment : segments)
+	{
+		if (segment->params.size() != first.params.size())
+			return ErrorCode::NO_STREAMS;
+		for (size_t i = 0; i < first.params.size(); ++i)
+		{
+			if (!sameStream(first.params[i], segment->params[i]))
+				return ErrorCode::STREAM_MISMATCH;
+		}
+	}
+
+	AVFormatContext* out_ctx = nullptr;
+	avformat_alloc_output_context2(&out_ctx, nullptr, nullptr, outFile);
+	if (!out_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+
+	ErrorCode ret = ErrorCode::SUCCESS;
+	for (size_t i = 0; ret == ErrorCode::SUCCESS && i < first.params.size(); ++i)
+	{
+		AVStream* out_stream = avformat_new_stream(out_ctx, nullptr);
+		if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, first.params[i]) < 0)
+			ret = ErrorCode::NO_CODEC_CTX;
+		else
+		{
+			out_stream->codecpar->codec_tag = 0;
+			out_stream->time_base = first.time_bases[i];
+		}
+	}
+
+	if (ret == ErrorCode::SUCCESS && !(out_ctx->oformat->flags & AVFMT_NOFILE) && avio_open(&out_ctx->pb, outFile, AVIO_FLAG_WRITE) < 0)
+		ret = ErrorCode::NO_OUTPUT_FILE;
+	if (ret == ErrorCode::SUCCESS && avformat_write_header(out_ctx, nullptr) < 0)
+		ret = ErrorCode::NO_OUTPUT_FILE;
+
+	std::vector<int64_t> last_dts(first.params.size(), AV_NOPTS_VALUE);
+	AVPacket* pkt = av_packet_alloc();
+	for (size_t s = 0; ret == ErrorCode::SUCCESS && s < segments.size(); ++s)
+	{
+		const Segment& segment = *segments[s];
+		std::ifstream in(segment.path, std::ios::binary);
+		if (!in)
+		{
+			ret = ErrorCode::NO_DATA_AVAIL;
+			break;
+		}
+
+		SpoolRecord record;
+		while (ret == ErrorCode::SUCCESS && in.read((char*)&record, sizeof(record)))
+		{
+			if (record.stream_index < 0 || record.stream_index >= (int)last_dts.size() || av_new_packet(pkt, record.size) < 0)
+			{
+				ret = ErrorCode::NO_PACKET;
+				break;
+			}
+			in.read((char*)pkt->data, record.size);
+
+			AVStream* out_stream = out_ctx->streams[record.stream_index];
+			AVRational time_base = segment.time_bases[record.stream_index];
+			pkt->stream_index = record.stream_index;
+			pkt->flags = record.flags;
+			pkt->pts = av_rescale_q_rnd(record.pts, time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+			pkt->dts = av_rescale_q_rnd(record.dts, time_base, out_stream->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+			pkt->duration = av_rescale_q(record.duration, time_base, out_stream->time_base);
+
+			//each segment's audio encoder starts with its priming delay, which overlaps the end of the segment
+			//before. drop the overlap rather than push dts backwards
+			int64_t& last = last_dts[record.stream_index];
+			if (pkt->dts != AV_NOPTS_VALUE && last != AV_NOPTS_VALUE && pkt->dts <= last)
+			{
+				if (out_stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+				{
+					av_packet_unref(pkt);
+					++stats.packets_dropped;
+					continue;
+				}
+				pkt->dts = last + 1;
+				if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+					pkt->pts = pkt->dts;
+			}
+			if (pkt->dts != AV_NOPTS_VALUE)
+				last = pkt->dts;
+
+			if (av_interleaved_write_frame(out_ctx, pkt) < 0)
+				ret = ErrorCode::NO_OUTPUT_FILE;
+			else
+				++stats.packets_written;
+			av_packet_unref(pkt);
+		}
+	}
+	av_packet_free(&pkt);
+
+	if (ret == ErrorCode::SUCCESS)
+		av_write_trailer(out_ctx);
+
+	if (!(out_ctx->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&out_ctx->pb);
+	avformat_free_context(out_ctx);
+	return ret;
+}
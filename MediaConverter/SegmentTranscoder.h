@@ -0,0 +1,56 @@
+#pragma once
+#include "Transcoder.h"
+#include <memory>
+#include <vector>
+
+struct SegmentOptions
+{
+	int segments = 0; //0 makes one segment per worker thread
+	size_t threads = 0; //segments processed at once, 0 uses every hardware thread
+	bool transcode = true; //false copies each segment's packets instead of re-encoding them
+	TranscodeOptions transcode_options; //start/end are filled in per segment
+	const char* index_path = nullptr; //FrameIndex sidecar for the keyframe scan, reused when it matches the input
+};
+
+struct SegmentStats
+{
+	int segments = 0;
+	size_t threads = 0;
+	int64_t packets_written = 0;
+	int64_t packets_dropped = 0; //audio overlapping the previous segment, encoder priming
+	double index_ms = 0.0; //finding the keyframes to split on
+	double encode_ms = 0.0; //every segment, in parallel
+	double concat_ms = 0.0; //joining the segments into the output
+	double wall_ms = 0.0;
+};
+
+/*
+* splits the input on video keyframes into segments and transcodes (or remuxes) them in parallel, each with
+* its own demuxer, decoders and encoders. every segment spools its packets to a temp file next to the output,
+* then the spools are written back to back into the output. segments keep the source timeline, so the
+* timestamps line up across the joins without any offsetting. the encoders of every segment are opened with
+* the same settings and the first segment's codec parameters describe the output streams. if any segment's
+* encoder came up with different parameters or global headers Run fails with STREAM_MISMATCH instead of muxing
+*/
+class MEDIACONVERTER_API SegmentTranscoder
+{
+public:
+	explicit SegmentTranscoder(const SegmentOptions& options = SegmentOptions());
+	~SegmentTranscoder();
+	SegmentTranscoder(const SegmentTranscoder&) = delete;
+	SegmentTranscoder& operator=(const SegmentTranscoder&) = delete;
+
+	ErrorCode Run(const char* inFile, const char* outFile);
+	const SegmentStats& Stats() const { return stats; }
+
+private:
+	struct Segment;
+
+	ErrorCode findSegments(const char* inFile, const char* outFile, size_t count);
+	ErrorCode remuxSegment(const char* inFile, const char* outFile, Segment& segment);
+	ErrorCode concat(const char* outFile);
+
+	SegmentOptions options;
+	SegmentStats stats;
+	std::vector<std::unique_ptr<Segment>> segments;
+};
@@ -0,0 +1,166 @@
+#include "pch.h"
+#include "framework.h"
+#include "SessionManager.h"
+#include <condition_variable>
+
+SessionManager::SessionManager(size_t threads) : pool(threads)
+{
+}
+
+SessionManager::~SessionManager()
+{
+	pool.WaitIdle();
+	CloseAll();
+}
+
+ErrorCode SessionManager::Open(const char* filename, SessionHandle& handle)
+{
+	return Open(filename, OpenOptions(), handle);
+}
+
+ErrorCode SessionManager::Open(const char* filename, const OpenOptions& options, SessionHandle& handle)
+{
+	handle = INVALID_SESSION;
+
+	//opening is the slow part, do it before the session is visible to anyone else
+	auto session = std::make_shared<Session>();
+	ErrorCode ret = converter.openVideoReader(&session->state, filename, options);
+	if (ret != ErrorCode::SUCCESS)
+		return ret;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	handle = next_handle++;
+	sessions[handle] = session;
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode SessionManager::Close(SessionHandle handle)
+{
+	std::shared_ptr<Session> session;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = sessions.find(handle);
+		if (it == sessions.end())
+			return ErrorCode::FMT_UNOPENED;
+		session = it->second;
+		sessions.erase(it);
+	}
+
+	//waits on anything still running against this session
+	std::lock_guard<std::mutex> lock(session->mtx);
+	session->closed = true;
+	converter.closeVideoReader(&session->state);
+	return ErrorCode::SUCCESS;
+}
+
+void SessionManager::CloseAll()
+{
+	std::map<SessionHandle, std::shared_ptr<Session>> closing;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		closing.swap(sessions);
+	}
+
+	for (auto& entry : closing)
+	{
+		std::lock_guard<std::mutex> lock(entry.second->mtx);
+		entry.second->closed = true;
+		converter.closeVideoReader(&entry.second->state);
+	}
+}
+
+size_t SessionManager::Count() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return sessions.size();
+}
+
+bool SessionManager::IsValid(SessionHandle handle) const
+{
+	return find(handle) != nullptr;
+}
+
+std::shared_ptr<SessionManager::Session> SessionManager::find(SessionHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = sessions.find(handle);
+	return it != sessions.end() ? it->second : nullptr;
+}
+
+ErrorCode SessionManager::With(SessionHandle handle, const SessionCall& call)
+{
+	auto session = find(handle);
+	if (!session)
+		return ErrorCode::FMT_UNOPENED;
+
+	std::lock_guard<std::mutex> lock(session->mtx);
+	//closed between the lookup and getting the lock
+	if (session->closed)
+		return ErrorCode::FMT_UNOPENED;
+
+	return call(converter, session->state);
+}
+
+ErrorCode SessionManager::ReadVideoFrame(SessionHandle handle, FrameHandle& frame)
+{
+	return With(handle, [&frame](CMediaConverter& mc, MediaReaderState& state) { return mc.readVideoFrame(&state, frame); });
+}
+
+ErrorCode SessionManager::ReadVideoFrame(SessionHandle handle, std::vector<uint8_t>& buffer, const OutputOptions& options)
+{
+	return With(handle, [&buffer, &options](CMediaConverter& mc, MediaReaderState& state) { return mc.readVideoFrame(&state, buffer, options); });
+}
+
+ErrorCode SessionManager::ReadAudioFrame(SessionHandle handle, std::vector<uint8_t>& buffer)
+{
+	return With(handle, [&buffer](CMediaConverter& mc, MediaReaderState& state) { return mc.readAudioFrame(&state, buffer); });
+}
+
+ErrorCode SessionManager::SeekToFrame(SessionHandle handle, int64_t targetPts)
+{
+	return With(handle, [targetPts](CMediaConverter& mc, MediaReaderState& state) { return mc.seekToFrame(&state, targetPts); });
+}
+
+ErrorCode SessionManager::SeekToStart(SessionHandle handle)
+{
+	return With(handle, [](CMediaConverter& mc, MediaReaderState& state) { return mc.seekToStart(&state); });
+}
+
+ErrorCode SessionManager::run(SessionHandle handle, const SessionTask& task)
+{
+	return With(handle, [handle, &task](CMediaConverter& mc, MediaReaderState& state) { return task(handle, mc, state); });
+}
+
+std::vector<ErrorCode> SessionManager::RunAll(const std::vector<SessionHandle>& handles, const SessionTask& task)
+{
+	std::vector<ErrorCode> results(handles.size(), ErrorCode::SUCCESS);
+	std::mutex done_mtx;
+	std::condition_variable done;
+	size_t remaining = handles.size();
+
+	//counted per call rather than WaitIdle so several RunAll callers can share the pool
+	for (size_t i = 0; i < handles.size(); ++i)
+	{
+		pool.Submit([this, i, &handles, &task, &results, &done_mtx, &done, &remaining](size_t)
+		{
+			results[i] = run(handles[i], task);
+			std::lock_guard<std::mutex> lock(done_mtx);
+			if (--remaining == 0)
+				done.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(done_mtx);
+	done.wait(lock, [&remaining]() { return remaining == 0; });
+	return results;
+}
+
+void SessionManager::Submit(SessionHandle handle, SessionTask task, SessionCallback callback)
+{
+	pool.Submit([this, handle, task, callback](size_t)
+	{
+		ErrorCode ret = run(handle, task);
+		if (callback)
+			callback(handle, ret);
+	});
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "MediaConverter.h"
+#include "WorkerPool.h"
+#include <functional>
+#include <map>
+#include <mutex>
+
+typedef uint64_t SessionHandle;
+const SessionHandle INVALID_SESSION = 0;
+
+/*
+* owns any number of independent readers behind opaque handles. each session has its own MediaReaderState
+* and lock, so different sessions can be used from different threads at the same time while calls on the
+* same session are serialized. Close waits for whatever is running on that session to finish
+*/
+class MEDIACONVERTER_API SessionManager
+{
+public:
+	typedef std::function<ErrorCode(CMediaConverter& converter, MediaReaderState& state)> SessionCall;
+	typedef std::function<ErrorCode(SessionHandle handle, CMediaConverter& converter, MediaReaderState& state)> SessionTask;
+	typedef std::function<void(SessionHandle handle, ErrorCode result)> SessionCallback;
+
+	explicit SessionManager(size_t threads = 0); //threads for RunAll/Submit, 0 uses every hardware thread
+	~SessionManager();
+	SessionManager(const SessionManager&) = delete;
+	SessionManager& operator=(const SessionManager&) = delete;
+
+	ErrorCode Open(const char* filename, SessionHandle& handle);
+	ErrorCode Open(const char* filename, const OpenOptions& options, SessionHandle& handle);
+	ErrorCode Close(SessionHandle handle);
+	void CloseAll();
+	size_t Count() const;
+	bool IsValid(SessionHandle handle) const;
+
+	//runs call on the calling thread with the session locked
+	ErrorCode With(SessionHandle handle, const SessionCall& call);
+
+	ErrorCode ReadVideoFrame(SessionHandle handle, FrameHandle& frame);
+	ErrorCode ReadVideoFrame(SessionHandle handle, std::vector<uint8_t>& buffer, const OutputOptions& options);
+	ErrorCode ReadAudioFrame(SessionHandle handle, std::vector<uint8_t>& buffer);
+	ErrorCode SeekToFrame(SessionHandle handle, int64_t targetPts);
+	ErrorCode SeekToStart(SessionHandle handle);
+
+	//runs task once per handle on the shared pool and waits, results line up with handles.
+	//don't call it from inside a pool task, the waiting worker can't run its own share
+	std::vector<ErrorCode> RunAll(const std::vector<SessionHandle>& handles, const SessionTask& task);
+	//queues task on the shared pool, callback (optional) gets the result on the worker thread
+	void Submit(SessionHandle handle, SessionTask task, SessionCallback callback = SessionCallback());
+	void WaitIdle() { pool.WaitIdle(); }
+	size_t ThreadCount() const { return pool.ThreadCount(); }
+
+private:
+	struct Session
+	{
+		std::mutex mtx;
+		MediaReaderState state;
+		bool closed = false;
+	};
+
+	std::shared_ptr<Session> find(SessionHandle handle) const;
+	ErrorCode run(SessionHandle handle, const SessionTask& task);
+
+	CMediaConverter converter; //only the state taking overloads are used, which keep nothing in the converter
+	mutable std::mutex mtx;
+	std::map<SessionHandle, std::shared_ptr<Session>> sessions;
+	SessionHandle next_handle = 1;
+	WorkerPool pool; //last so queued tasks finish before the sessions go away
+};
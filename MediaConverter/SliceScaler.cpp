@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "framework.h"
+#include "SliceScaler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace
+{
+	//slice boundaries land on multiples of this so every chroma subsampling lines up with a whole chroma row
+	const int kSliceAlign = 16;
+	const int kMinSliceRows = 64;
+
+	//byte offset of row y (in luma rows) inside plane p of an image in the given format
+	void offsetPlanes(const AVPixFmtDescriptor* desc, uint8_t* const data[4], const int linesize[4], int y, uint8_t* out[4])
+	{
+		for (int p = 0; p < 4; ++p)
+		{
+			if (!data[p])
+			{
+				out[p] = nullptr;
+				continue;
+			}
+			//planes 1 and 2 are the chroma planes in every planar yuv layout
+			int shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+			out[p] = data[p] + (int64_t)(y >> shift) * linesize[p];
+		}
+	}
+
+	//source frame in the key's format and size with pseudo random bytes in every plane, the same every call
+	AVFrame* makeNoiseFrame(const ScalerKey& key)
+	{
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(key.src_fmt);
+		AVFrame* frame = av_frame_alloc();
+		if (!desc || !frame)
+		{
+			av_frame_free(&frame);
+			return nullptr;
+		}
+		frame->format = key.src_fmt;
+		frame->width = key.src_width;
+		frame->height = key.src_height;
+		frame->colorspace = key.colorspace;
+		frame->color_range = key.color_range;
+		if (av_frame_get_buffer(frame, 0) < 0)
+		{
+			av_frame_free(&frame);
+			return nullptr;
+		}
+
+		uint32_t seed = 0x9e3779b9u;
+		for (int p = 0; p < 4 && frame->data[p]; ++p)
+		{
+			int shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+			int rows = (frame->height + (1 << shift) - 1) >> shift;
+			for (int y = 0; y < rows; ++y)
+			{
+				uint8_t* row = frame->data[p] + (int64_t)y * frame->linesize[p];
+				for (int x = 0; x < frame->linesize[p]; ++x)
+				{
+					seed = seed * 1664525u + 1013904223u;
+					row[x] = (uint8_t)(seed >> 24);
+				}
+			}
+		}
+		return frame;
+	}
+}
+
+SliceScaler::SliceScaler(size_t threads) : pool(threads)
+{
+	for (size_t i = 0; i < pool.ThreadCount(); ++i)
+		slice_caches.emplace_back(new ScalerCache(2));
+}
+
+SliceScaler::~SliceScaler()
+{
+	pool.WaitIdle();
+}
+
+int SliceScaler::sliceCount(const ScalerKey& key) const
+{
+	if (key.src_width != key.dst_width || key.src_height != key.dst_height)
+		return 1;
+
+	//palettes and hardware surfaces don't have rows we can offset into
+	const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(key.src_fmt);
+	const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(key.dst_fmt);
+	const uint64_t unsliceable = AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL;
+	if (!src_desc || !dst_desc || (src_desc->flags & unsliceable) || (dst_desc->flags & unsliceable))
+		return 1;
+
+	int slices = (std::min)((int)pool.ThreadCount(), key.src_height / kMinSliceRows);
+	return (std::max)(slices, 1);
+}
+
+int SliceScaler::Scale(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key)
+{
+	int slices = sliceCount(key);
+	if (slices <= 1)
+		return scaleSerial(frame, dest, destLinesize, key);
+
+	auto verdict = std::find_if(verdicts.begin(), verdicts.end(), [&key](const Verdict& v) { return v.key == key; });
+	if (verdict == verdicts.end())
+	{
+		Verdict v = { key, verify(key, slices) };
+		verdicts.push_back(v);
+		verdict = verdicts.end() - 1;
+	}
+
+	if (!verdict->sliceable)
+		return scaleSerial(frame, dest, destLinesize, key);
+	int ret = scaleSliced(frame, dest, destLinesize, key, slices);
+	return ret == kSerialFallback ? 0 : ret;
+}
+
+int SliceScaler::scaleSerial(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key)
+{
+	SwsContext* ctx = serial_cache.Get(key);
+	if (!ctx)
+		return -1;
+	sws_scale(ctx, frame->data, frame->linesize, 0, frame->height, dest, destLinesize);
+	++serial_frames;
+	return 0;
+}
+
+int SliceScaler::scaleSliced(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key, int slices)
+{
+	const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(key.src_fmt);
+	const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(key.dst_fmt);
+	if (!src_desc || !dst_desc)
+		return serialFallback(frame, dest, destLinesize, key);
+
+	int rows = key.src_height / slices;
+	rows = (rows + kSliceAlign - 1) / kSliceAlign * kSliceAlign;
+
+	std::atomic<int> failures{ 0 };
+	for (int i = 0; i < slices; ++i)
+	{
+		int y0 = i * rows;
+		int y1 = (i == slices - 1) ? key.src_height : (std::min)(y0 + rows, key.src_height);
+		if (y0 >= y1)
+			break;
+
+		pool.Submit([&, i, y0, y1](size_t)
+		{
+			ScalerKey slice_key = key;
+			slice_key.src_height = y1 - y0;
+			slice_key.dst_height = y1 - y0;
+			SwsContext* ctx = slice_caches[i]->Get(slice_key);
+			if (!ctx)
+			{
+				++failures;
+				return;
+			}
+
+			uint8_t* src[4];
+			uint8_t* dst[4];
+			offsetPlanes(src_desc, frame->data, frame->linesize, y0, src);
+			offsetPlanes(dst_desc, dest, destLinesize, y0, dst);
+			sws_scale(ctx, src, frame->linesize, 0, y1 - y0, dst, destLinesize);
+		});
+	}
+	pool.WaitIdle();
+
+	if (failures > 0)
+		return serialFallback(frame, dest, destLinesize, key);
+	++sliced_frames;
+	return 0;
+}
+
+int SliceScaler::serialFallback(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key)
+{
+	int ret = scaleSerial(frame, dest, destLinesize, key);
+	return ret < 0 ? ret : kSerialFallback;
+}
+
+bool SliceScaler::verify(const ScalerKey& key, int slices)
+{
+	//a real frame can hide a seam, flat rows convert the same whichever filter taps cross the boundary.
+	//so the check runs on noise in every plane, which any row dependence between slices shows up in
+	AVFrame* probe = makeNoiseFrame(key);
+	if (!probe)
+		return false;
+
+	int size = av_image_get_buffer_size(key.dst_fmt, key.dst_width, key.dst_height, 1);
+	if (size <= 0)
+	{
+		av_frame_free(&probe);
+		return false;
+	}
+
+	std::vector<uint8_t> serial(size), sliced(size);
+	uint8_t* serial_planes[4] = { nullptr };
+	uint8_t* sliced_planes[4] = { nullptr };
+	int linesize[4] = { 0 };
+	av_image_fill_arrays(serial_planes, linesize, serial.data(), key.dst_fmt, key.dst_width, key.dst_height, 1);
+	av_image_fill_arrays(sliced_planes, linesize, sliced.data(), key.dst_fmt, key.dst_width, key.dst_height, 1);
+
+	bool same = false;
+	if (scaleSerial(probe, serial_planes, linesize, key) >= 0)
+	{
+		--serial_frames;
+		//a fallback compared serial with serial, that says nothing about slicing
+		int ret = scaleSliced(probe, sliced_planes, linesize, key, slices);
+		if (ret == 0)
+		{
+			--sliced_frames;
+			same = memcmp(serial.data(), sliced.data(), size) == 0;
+		}
+		else if (ret == kSerialFallback)
+			--serial_frames;
+	}
+	av_frame_free(&probe);
+	return same;
+}
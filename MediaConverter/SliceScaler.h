@@ -0,0 +1,55 @@
+#pragma once
+#include "ScalerCache.h"
+#include "WorkerPool.h"
+#include <memory>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+/*
+* runs a same-size conversion as horizontal slices on a worker pool, each slice with its own SwsContext.
+* whether slicing is exact depends on the swscale path picked for a format pair, so the first time a configuration
+* shows up a generated noise frame in its format is converted both ways and compared. configurations that don't
+* match byte for byte, and any resize, stay on a single sws_scale call
+*/
+class MEDIACONVERTER_API SliceScaler
+{
+public:
+	explicit SliceScaler(size_t threads = 0); //0 uses every hardware thread
+	~SliceScaler();
+	SliceScaler(const SliceScaler&) = delete;
+	SliceScaler& operator=(const SliceScaler&) = delete;
+
+	//returns 0 on success, negative if no scaler could be built
+	int Scale(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key);
+
+	size_t Threads() const { return pool.ThreadCount(); }
+	int64_t SlicedFrames() const { return sliced_frames; }
+	int64_t SerialFrames() const { return serial_frames; }
+
+private:
+	static const int kSerialFallback = 1;
+
+	struct Verdict
+	{
+		ScalerKey key;
+		bool sliceable;
+	};
+
+	int sliceCount(const ScalerKey& key) const;
+	int scaleSerial(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key);
+	//0 when sliced, kSerialFallback when a slice scaler couldn't be built and the frame went through scaleSerial
+	int scaleSliced(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key, int slices);
+	int serialFallback(const AVFrame* frame, uint8_t* const dest[4], const int destLinesize[4], const ScalerKey& key);
+	bool verify(const ScalerKey& key, int slices);
+
+	WorkerPool pool;
+	ScalerCache serial_cache;
+	std::vector<std::unique_ptr<ScalerCache>> slice_caches; //one per slice, a context is never shared between threads
+	std::vector<Verdict> verdicts;
+	int64_t sliced_frames = 0;
+	int64_t serial_frames = 0;
+};
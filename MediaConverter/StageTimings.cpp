@@ -0,0 +1,151 @@
+#include "pch.h"
+#include "framework.h"
+#include "StageTimings.h"
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	//index of the highest set bit, value has to be non zero
+	int highestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return (int)index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+}
+
+StageTimings::StageTimings()
+{
+	Reset();
+}
+
+StageTimings& StageTimings::Process()
+{
+	static StageTimings timings;
+	return timings;
+}
+
+bool StageTimings::Enabled()
+{
+	return MEDIACONVERTER_STAGE_TIMING != 0;
+}
+
+const char* StageTimings::Name(Stage stage)
+{
+	switch (stage)
+	{
+	case Stage::ReadFrame: return "read_frame";
+	case Stage::VideoSendPacket: return "video_send_packet";
+	case Stage::VideoReceiveFrame: return "video_receive_frame";
+	case Stage::AudioSendPacket: return "audio_send_packet";
+	case Stage::AudioReceiveFrame: return "audio_receive_frame";
+	case Stage::VideoOutput: return "video_output";
+	case Stage::AudioOutput: return "audio_output";
+	default: return "unknown";
+	}
+}
+
+//values under kSubBuckets get a bucket each, above that every power of two is split into kSubBuckets
+int StageTimings::bucketOf(uint64_t ns)
+{
+	if (ns < kSubBuckets)
+		return (int)ns;
+	int msb = highestBit(ns);
+	int sub = (int)((ns >> (msb - 3)) & (kSubBuckets - 1));
+	return (msb - 2) * kSubBuckets + sub;
+}
+
+int64_t StageTimings::bucketValue(int bucket)
+{
+	if (bucket < kSubBuckets)
+		return bucket;
+	int msb = bucket / kSubBuckets + 2;
+	uint64_t sub = (uint64_t)(bucket % kSubBuckets);
+	if (msb >= 62)
+		return INT64_MAX;
+	uint64_t width = (uint64_t)1 << (msb - 3);
+	return (int64_t)((kSubBuckets + sub) * width + width / 2);
+}
+
+void StageTimings::Record(Stage stage, int64_t ns)
+{
+	if (stage >= Stage::Count)
+		return;
+	if (ns < 0)
+		ns = 0;
+
+	Histogram& histogram = stages[(int)stage];
+	histogram.total_ns.fetch_add(ns, std::memory_order_relaxed);
+	histogram.buckets[bucketOf((uint64_t)ns)].fetch_add(1, std::memory_order_relaxed);
+
+	int64_t max = histogram.max_ns.load(std::memory_order_relaxed);
+	while (ns > max && !histogram.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+	{
+	}
+}
+
+StageStats StageTimings::Stats(Stage stage) const
+{
+	StageStats stats;
+	if (stage >= Stage::Count)
+		return stats;
+
+	const Histogram& histogram = stages[(int)stage];
+	stats.total_ns = histogram.total_ns.load(std::memory_order_relaxed);
+	stats.max_ns = histogram.max_ns.load(std::memory_order_relaxed);
+
+	//the count is summed from the buckets so the percentiles agree with it while recording goes on
+	int64_t counts[kBuckets];
+	for (int i = 0; i < kBuckets; ++i)
+	{
+		counts[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+		stats.count += counts[i];
+	}
+	if (stats.count == 0)
+		return stats;
+
+	int64_t* targets[] = { &stats.p50_ns, &stats.p95_ns, &stats.p99_ns };
+	const double ranks[] = { 0.50, 0.95, 0.99 };
+	int next = 0;
+	int64_t seen = 0;
+	for (int i = 0; i < kBuckets && next < 3; ++i)
+	{
+		seen += counts[i];
+		while (next < 3 && seen >= (int64_t)(ranks[next] * stats.count + 0.5))
+		{
+			*targets[next] = (std::min)(bucketValue(i), stats.max_ns);
+			++next;
+		}
+	}
+	return stats;
+}
+
+void StageTimings::Reset()
+{
+	for (Histogram& histogram : stages)
+	{
+		histogram.total_ns.store(0, std::memory_order_relaxed);
+		histogram.max_ns.store(0, std::memory_order_relaxed);
+		for (auto& bucket : histogram.buckets)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+ScopedStageTimer::ScopedStageTimer(StageTimings* timings, Stage stage) : timings(timings), stage(stage), start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedStageTimer::~ScopedStageTimer()
+{
+	int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	if (timings)
+		timings->Record(stage, ns);
+	StageTimings::Process().Record(stage, ns);
+}
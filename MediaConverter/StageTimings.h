@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+/*
+* per stage timing of the decode path. define MEDIACONVERTER_STAGE_TIMING=1 for the dll build to turn it on,
+* without it TIME_STAGE expands to nothing, readers don't allocate timings and every query reports zeros.
+* the classes stay either way so the dll and its users agree on the layout whatever the flag was
+*/
+#ifndef MEDIACONVERTER_STAGE_TIMING
+#define MEDIACONVERTER_STAGE_TIMING 0
+#endif
+
+enum class Stage : int
+{
+	ReadFrame, //av_read_frame
+	VideoSendPacket, //avcodec_send_packet/avcodec_receive_frame, video decoder
+	VideoReceiveFrame,
+	AudioSendPacket, //same, audio decoder
+	AudioReceiveFrame,
+	VideoOutput, //outputToBuffer/convertVideoFrame, sws_scale or the fast converter or a plain copy
+	AudioOutput, //outputToAudioBuffer, swr_convert
+	Count
+};
+
+struct StageStats
+{
+	int64_t count = 0;
+	int64_t total_ns = 0;
+	int64_t max_ns = 0;
+	//from the histogram, within ~6% of the real value
+	int64_t p50_ns = 0;
+	int64_t p95_ns = 0;
+	int64_t p99_ns = 0;
+
+	double MeanNs() const { return count > 0 ? total_ns / (double)count : 0.0; }
+};
+
+/*
+* count, total and a log-linear latency histogram per stage: 8 buckets per power of two, so recording is
+* a few relaxed atomic adds and no locks. a reader's timings can be written from its read ahead thread and
+* read from anywhere while it runs
+*/
+class MEDIACONVERTER_API StageTimings
+{
+public:
+	StageTimings();
+	StageTimings(const StageTimings&) = delete;
+	StageTimings& operator=(const StageTimings&) = delete;
+
+	static StageTimings& Process(); //every reader's stages added together
+	static bool Enabled(); //how the dll was built, not what the includer defined
+	static const char* Name(Stage stage);
+
+	void Record(Stage stage, int64_t ns);
+	StageStats Stats(Stage stage) const;
+	void Reset();
+
+private:
+	static const int kSubBuckets = 8; //per power of two
+	static const int kBuckets = 64 * kSubBuckets;
+
+	static int bucketOf(uint64_t ns);
+	static int64_t bucketValue(int bucket); //middle of the bucket
+
+	struct Histogram
+	{
+		std::atomic<int64_t> total_ns;
+		std::atomic<int64_t> max_ns;
+		std::atomic<int64_t> buckets[kBuckets];
+	};
+
+	Histogram stages[(int)Stage::Count];
+};
+
+//times the rest of the scope into a reader's timings (when it has any) and the process wide ones
+class MEDIACONVERTER_API ScopedStageTimer
+{
+public:
+	ScopedStageTimer(StageTimings* timings, Stage stage);
+	~ScopedStageTimer();
+	ScopedStageTimer(const ScopedStageTimer&) = delete;
+	ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+	StageTimings* timings;
+	Stage stage;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define STAGE_TIMER_NAME2(line) stage_timer_##line
+#define STAGE_TIMER_NAME(line) STAGE_TIMER_NAME2(line)
+#if MEDIACONVERTER_STAGE_TIMING
+#define TIME_STAGE(timings, stage) ScopedStageTimer STAGE_TIMER_NAME(__LINE__)(timings, stage)
+#else
+#define TIME_STAGE(timings, stage) ((void)0)
+#endif
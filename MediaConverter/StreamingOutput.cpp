@@ -0,0 +1,165 @@
+#include "pch.h"
+#include "framework.h"
+#include "StreamingOutput.h"
+
+StreamingOutput::StreamingOutput(const StreamingOptions& options) : options(options)
+{
+}
+
+StreamingOutput::~StreamingOutput()
+{
+	if (io_ctx)
+	{
+		av_freep(&io_ctx->buffer);
+		avio_context_free(&io_ctx);
+	}
+	if (out_ctx)
+	{
+		out_ctx->pb = nullptr; //ours, freed above
+		avformat_free_context(out_ctx);
+	}
+}
+
+ErrorCode StreamingOutput::Open()
+{
+	const char* format = options.format == StreamFormat::MPEGTS ? "mpegts" : "mp4";
+	avformat_alloc_output_context2(&out_ctx, nullptr, format, nullptr);
+	if (!out_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+
+	int size = options.io_buffer_size > 0 ? options.io_buffer_size : 64 * 1024;
+	uint8_t* buffer = (uint8_t*)av_malloc(size);
+	if (!buffer)
+		return ErrorCode::NO_DATA_AVAIL;
+
+	//write only and not seekable, the mp4 muxer has to stick to fragments then
+	io_ctx = avio_alloc_context(buffer, size, 1, this, nullptr, &StreamingOutput::writeCallback, nullptr);
+	if (!io_ctx)
+	{
+		av_free(buffer);
+		return ErrorCode::NO_OUTPUT_FILE;
+	}
+	io_ctx->seekable = 0;
+	out_ctx->pb = io_ctx;
+	out_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode StreamingOutput::WriteHeader()
+{
+	for (unsigned int i = 0; i < out_ctx->nb_streams; ++i)
+	{
+		if (out_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+			has_video = true;
+	}
+
+	AVDictionary* opts = nullptr;
+	if (options.format == StreamFormat::FragmentedMP4)
+	{
+		//frag_custom: a fragment is only closed when we flush the muxer, see cut
+		av_dict_set(&opts, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+	}
+
+	int ret = avformat_write_header(out_ctx, &opts);
+	av_dict_free(&opts);
+	if (ret < 0)
+		return ErrorCode::NO_OUTPUT_FILE;
+
+	avio_flush(out_ctx->pb);
+	FragmentInfo info;
+	info.init = true;
+	bytes_written += pending.size();
+	if (!pending.empty() && options.on_fragment && !options.on_fragment(pending.data(), pending.size(), info))
+		aborted = true;
+	pending.clear();
+	fragment_index = 1;
+	return aborted ? ErrorCode::NO_OUTPUT_FILE : ErrorCode::SUCCESS;
+}
+
+ErrorCode StreamingOutput::Write(AVPacket* pkt)
+{
+	if (aborted)
+	{
+		av_packet_unref(pkt);
+		return ErrorCode::NO_OUTPUT_FILE;
+	}
+
+	AVStream* stream = out_ctx->streams[pkt->stream_index];
+	int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+	int64_t time = ts != AV_NOPTS_VALUE ? av_rescale_q(ts, stream->time_base, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+
+	bool boundary = has_video ? stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && (pkt->flags & AV_PKT_FLAG_KEY) : true;
+	if (boundary && packets_in_fragment > 0 && time != AV_NOPTS_VALUE && fragment_start != AV_NOPTS_VALUE &&
+		time - fragment_start >= options.fragment_duration)
+	{
+		ErrorCode ret = cut(false);
+		if (ret != ErrorCode::SUCCESS)
+		{
+			av_packet_unref(pkt);
+			return ret;
+		}
+	}
+
+	if (time != AV_NOPTS_VALUE)
+	{
+		if (fragment_start == AV_NOPTS_VALUE || (packets_in_fragment == 0 && boundary))
+			fragment_start = time;
+		if (fragment_end == AV_NOPTS_VALUE || time > fragment_end)
+			fragment_end = time;
+	}
+	++packets_in_fragment;
+
+	return av_interleaved_write_frame(out_ctx, pkt) < 0 ? ErrorCode::NO_OUTPUT_FILE : ErrorCode::SUCCESS;
+}
+
+ErrorCode StreamingOutput::Finish()
+{
+	if (aborted)
+		return ErrorCode::NO_OUTPUT_FILE;
+	if (packets_in_fragment > 0)
+	{
+		ErrorCode ret = cut(false);
+		if (ret != ErrorCode::SUCCESS)
+			return ret;
+	}
+
+	if (av_write_trailer(out_ctx) < 0)
+		return ErrorCode::NO_OUTPUT_FILE;
+	return cut(true);
+}
+
+ErrorCode StreamingOutput::cut(bool last)
+{
+	if (!last)
+	{
+		//drain the interleaving queue into the muxer, then make the muxer close the fragment
+		av_interleaved_write_frame(out_ctx, nullptr);
+		av_write_frame(out_ctx, nullptr);
+	}
+	avio_flush(out_ctx->pb);
+
+	FragmentInfo info;
+	info.index = fragment_index++;
+	info.last = last;
+	info.start_time = fragment_start;
+	info.duration = fragment_start != AV_NOPTS_VALUE && fragment_end != AV_NOPTS_VALUE ? fragment_end - fragment_start : 0;
+
+	bytes_written += pending.size();
+	if (options.on_fragment && !options.on_fragment(pending.data(), pending.size(), info))
+		aborted = true;
+
+	pending.clear();
+	packets_in_fragment = 0;
+	fragment_start = AV_NOPTS_VALUE;
+	fragment_end = AV_NOPTS_VALUE;
+	return aborted ? ErrorCode::NO_OUTPUT_FILE : ErrorCode::SUCCESS;
+}
+
+int StreamingOutput::writeCallback(void* opaque, uint8_t* buf, int size)
+{
+	StreamingOutput* output = (StreamingOutput*)opaque;
+	if (output->aborted)
+		return AVERROR_EXIT;
+	output->pending.insert(output->pending.end(), buf, buf + size);
+	return size;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "MediaConverter.h"
+#include <functional>
+#include <vector>
+
+enum class MEDIACONVERTER_API StreamFormat : int
+{
+	FragmentedMP4, //init segment (ftyp + empty moov) then one moof + mdat per fragment
+	MPEGTS
+};
+
+struct FragmentInfo
+{
+	int index = 0; //0 is the init segment, fragments count up from 1
+	bool init = false;
+	bool last = false; //the tail written by the trailer, may be empty
+	int64_t start_time = AV_NOPTS_VALUE; //AV_TIME_BASE units, first packet of the fragment
+	int64_t duration = 0;
+};
+
+//gets each piece as soon as the muxer has finished it. the data is only valid during the call, return false to abort
+typedef std::function<bool(const uint8_t* data, size_t size, const FragmentInfo& info)> FragmentCallback;
+
+struct StreamingOptions
+{
+	StreamFormat format = StreamFormat::FragmentedMP4;
+	FragmentCallback on_fragment;
+	int64_t fragment_duration = 2 * AV_TIME_BASE; //minimum length, fragments always start on a video keyframe
+	int io_buffer_size = 64 * 1024;
+};
+
+/*
+* muxes into memory through a custom AVIO write callback instead of a file and hands the output to the caller
+* one fragment at a time. the fragment boundaries are ours: in front of a video keyframe (any packet for audio
+* only output) once fragment_duration has passed, the interleaving queue and the muxer are flushed and
+* everything written since the last boundary goes out as one fragment
+*/
+class MEDIACONVERTER_API StreamingOutput
+{
+public:
+	explicit StreamingOutput(const StreamingOptions& options);
+	~StreamingOutput();
+	StreamingOutput(const StreamingOutput&) = delete;
+	StreamingOutput& operator=(const StreamingOutput&) = delete;
+
+	ErrorCode Open(); //output context and AVIO, add the streams to Context() before WriteHeader
+	AVFormatContext* Context() const { return out_ctx; }
+	ErrorCode WriteHeader(); //the init segment goes out here
+	ErrorCode Write(AVPacket* pkt); //timestamps in the output stream's time_base, takes the packet's reference
+	ErrorCode Finish(); //trailer and the last fragment
+
+	int Fragments() const { return fragment_index; }
+	int64_t BytesWritten() const { return bytes_written; }
+
+private:
+	static int writeCallback(void* opaque, uint8_t* buf, int size);
+	ErrorCode cut(bool last);
+
+	StreamingOptions options;
+	AVFormatContext* out_ctx = nullptr;
+	AVIOContext* io_ctx = nullptr;
+	std::vector<uint8_t> pending; //written by the muxer since the last fragment
+	int fragment_index = 0;
+	int64_t fragment_start = AV_NOPTS_VALUE;
+	int64_t fragment_end = AV_NOPTS_VALUE;
+	int64_t packets_in_fragment = 0;
+	int64_t bytes_written = 0;
+	bool has_video = false;
+	bool aborted = false;
+};
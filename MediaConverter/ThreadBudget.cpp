@@ -0,0 +1,91 @@
+#include "pch.h"
+#include "framework.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+	int hardwareThreads()
+	{
+		return (std::max)(1, (int)std::thread::hardware_concurrency());
+	}
+}
+
+//never destroyed for the same reason as DecoderPool::Instance, Close gives grants back from static destructors
+ThreadBudget& ThreadBudget::Instance()
+{
+	static ThreadBudget* budget = new ThreadBudget();
+	return *budget;
+}
+
+ThreadBudget::ThreadBudget(int totalThreads) : total(totalThreads > 0 ? totalThreads : hardwareThreads())
+{
+}
+
+int ThreadBudget::Acquire(int requested)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	int share = total / (std::max)(expected_decoders, decoders + 1);
+	int left = total - in_use;
+	//past the expected count nobody planned for the next reader, so leave it half of what is still free
+	if (decoders + 1 > expected_decoders)
+		left = (left + 1) / 2;
+	int granted = (std::min)((std::min)(share, left), maxGrantLocked());
+	if (requested > 0)
+		granted = (std::min)(granted, requested);
+	granted = (std::max)(1, granted);
+
+	if (requested > 0 && granted < requested)
+		++reduced;
+	++grants;
+	++decoders;
+	in_use += granted;
+	return granted;
+}
+
+void ThreadBudget::Release(int threads)
+{
+	if (threads <= 0)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	in_use = (std::max)(0, in_use - threads);
+	decoders = (std::max)(0, decoders - 1);
+}
+
+void ThreadBudget::SetTotal(int totalThreads)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	total = totalThreads > 0 ? totalThreads : hardwareThreads();
+}
+
+void ThreadBudget::SetMaxGrant(int threads)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	max_grant = (std::max)(0, threads);
+}
+
+int ThreadBudget::maxGrantLocked() const
+{
+	return max_grant > 0 ? max_grant : (std::max)(1, total / 2);
+}
+
+void ThreadBudget::SetExpectedDecoders(int expected)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	expected_decoders = (std::max)(1, expected);
+}
+
+ThreadBudgetStats ThreadBudget::Stats() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	ThreadBudgetStats stats;
+	stats.total = total;
+	stats.in_use = in_use;
+	stats.decoders = decoders;
+	stats.expected_decoders = expected_decoders;
+	stats.max_grant = maxGrantLocked();
+	stats.grants = grants;
+	stats.reduced = reduced;
+	return stats;
+}
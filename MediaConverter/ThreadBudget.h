@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+struct ThreadBudgetStats
+{
+	int total = 0;
+	int in_use = 0; //can go over total, every decoder gets at least one thread
+	int decoders = 0; //holding a grant right now
+	int expected_decoders = 1;
+	int max_grant = 0; //what a single decoder can get at most
+	int64_t grants = 0;
+	int64_t reduced = 0; //grants smaller than what was asked for
+};
+
+/*
+* process wide count of decoder threads. a decoder's thread_count is fixed once it's opened, so the budget
+* is split when the grant is made: a decoder gets at most total / max(expected, holders + 1) threads, never
+* more than the max grant (half of total unless SetMaxGrant says otherwise) and never more than is left, with
+* a floor of one. once more decoders hold grants than expected each new one only takes half of what is left,
+* so readers opened later still get some threads. nothing is rebalanced when readers come and go, callers that
+* open N readers together should call SetExpectedDecoders(N) before openVideoReader to split the cores evenly.
+* grants go back on close
+*/
+class MEDIACONVERTER_API ThreadBudget
+{
+public:
+	static ThreadBudget& Instance();
+
+	explicit ThreadBudget(int totalThreads = 0); //0 uses every hardware thread
+	ThreadBudget(const ThreadBudget&) = delete;
+	ThreadBudget& operator=(const ThreadBudget&) = delete;
+
+	//requested <= 0 asks for the fair share, anything else is capped by it
+	int Acquire(int requested = 0);
+	void Release(int threads);
+
+	void SetTotal(int totalThreads); //0 uses every hardware thread
+	//how many decoders are expected to run at once, so the first ones don't take the cores the later ones need
+	void SetExpectedDecoders(int decoders);
+	void SetMaxGrant(int threads); //0 goes back to half of total
+	ThreadBudgetStats Stats() const;
+
+private:
+	mutable std::mutex mtx;
+	int total = 1;
+	int in_use = 0;
+	int decoders = 0;
+	int expected_decoders = 1;
+	int max_grant = 0;
+	int64_t grants = 0;
+	int64_t reduced = 0;
+
+	int maxGrantLocked() const;
+};
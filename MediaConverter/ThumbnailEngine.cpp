@@ -0,0 +1,306 @@
+#include "pch.h"
+#include "framework.h"
+#include "ThumbnailEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+struct ThumbnailEngine::WorkerContext
+{
+	AVCodecContext* codec_ctx = nullptr;
+	AVCodecID codec_id = AV_CODEC_ID_NONE;
+	int width = 0;
+	int height = 0;
+	int format = -1;
+	std::vector<uint8_t> extradata;
+
+	SwsContext* sws_ctx = nullptr;
+	AVFrame* frame = nullptr;
+	AVPacket* packet = nullptr;
+
+	std::vector<double> file_ms;
+	size_t thumbnails = 0;
+	size_t failed_files = 0;
+
+	~WorkerContext()
+	{
+		avcodec_free_context(&codec_ctx);
+		sws_freeContext(sws_ctx);
+		av_frame_free(&frame);
+		av_packet_free(&packet);
+	}
+};
+
+ThumbnailEngine::ThumbnailEngine(const ThumbnailOptions& options) : options(options), pool(options.threads)
+{
+	for (size_t i = 0; i < pool.ThreadCount(); ++i)
+		workers.push_back(new WorkerContext());
+}
+
+ThumbnailEngine::~ThumbnailEngine()
+{
+	pool.WaitIdle();
+	for (auto worker : workers)
+		delete worker;
+}
+
+ThumbnailStats ThumbnailEngine::Run(const std::vector<std::string>& files, const std::vector<double>& seconds, ThumbnailCallback callback)
+{
+	for (auto worker : workers)
+	{
+		worker->file_ms.clear();
+		worker->thumbnails = 0;
+		worker->failed_files = 0;
+	}
+
+	//seeking forward through a file is cheaper than jumping back and forth
+	std::vector<double> sorted = seconds;
+	std::sort(sorted.begin(), sorted.end());
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		pool.Submit([this, i, &files, &sorted, &callback](size_t workerIndex)
+		{
+			WorkerContext& worker = *workers[workerIndex];
+			auto fileStart = std::chrono::steady_clock::now();
+			if (processFile(worker, i, files[i], sorted, callback) != ErrorCode::SUCCESS)
+				++worker.failed_files;
+			worker.file_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fileStart).count());
+		});
+	}
+	pool.WaitIdle();
+
+	ThumbnailStats stats;
+	stats.files = files.size();
+	stats.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<double> latencies;
+	for (auto worker : workers)
+	{
+		stats.thumbnails += worker->thumbnails;
+		stats.failed_files += worker->failed_files;
+		latencies.insert(latencies.end(), worker->file_ms.begin(), worker->file_ms.end());
+	}
+
+	if (stats.wall_ms > 0)
+		stats.thumbnails_per_sec = stats.thumbnails * 1000.0 / stats.wall_ms;
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		stats.avg_file_ms = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+		stats.max_file_ms = latencies.back();
+		stats.p95_file_ms = latencies[(std::min)(latencies.size() - 1, (size_t)(latencies.size() * 0.95))];
+	}
+	return stats;
+}
+
+ErrorCode ThumbnailEngine::processFile(WorkerContext& worker, size_t fileIndex, const std::string& path,
+	const std::vector<double>& seconds, ThumbnailCallback& callback)
+{
+	AVFormatContext* fmt_ctx = nullptr;
+	if (avformat_open_input(&fmt_ctx, path.c_str(), nullptr, nullptr) < 0)
+		return ErrorCode::FMT_UNOPENED;
+
+	ErrorCode ret = ErrorCode::SUCCESS;
+	int streamIndex = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (streamIndex < 0)
+		ret = ErrorCode::NO_VID_STREAM;
+	else
+		ret = prepareDecoder(worker, fmt_ctx->streams[streamIndex]->codecpar);
+
+	if (ret == ErrorCode::SUCCESS)
+	{
+		//nothing but the video packets are of interest
+		for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i)
+		{
+			if ((int)i != streamIndex)
+				fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+		}
+
+		for (size_t t = 0; t < seconds.size(); ++t)
+		{
+			ThumbnailResult result;
+			result.file_index = fileIndex;
+			result.timestamp_index = t;
+			result.path = path;
+			result.requested_seconds = seconds[t];
+			result.error = extractAt(worker, fmt_ctx, streamIndex, seconds[t], result);
+			if (result.error == ErrorCode::SUCCESS)
+				++worker.thumbnails;
+			if (callback)
+				callback(result);
+		}
+	}
+	else if (callback)
+	{
+		ThumbnailResult result;
+		result.file_index = fileIndex;
+		result.path = path;
+		result.error = ret;
+		callback(result);
+	}
+
+	avformat_close_input(&fmt_ctx);
+	return ret;
+}
+
+ErrorCode ThumbnailEngine::prepareDecoder(WorkerContext& worker, AVCodecParameters* params)
+{
+	if (!worker.frame)
+		worker.frame = av_frame_alloc();
+	if (!worker.packet)
+		worker.packet = av_packet_alloc();
+	if (!worker.frame || !worker.packet)
+		return ErrorCode::NO_FRAME;
+
+	bool sameExtradata = params->extradata_size == (int)worker.extradata.size() &&
+		(params->extradata_size == 0 || memcmp(params->extradata, worker.extradata.data(), params->extradata_size) == 0);
+
+	//same stream setup as the last file, reuse the open decoder
+	if (worker.codec_ctx && worker.codec_id == params->codec_id && worker.width == params->width &&
+		worker.height == params->height && worker.format == params->format && sameExtradata)
+	{
+		avcodec_flush_buffers(worker.codec_ctx);
+		worker.codec_ctx->skip_frame = options.keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+		return ErrorCode::SUCCESS;
+	}
+
+	avcodec_free_context(&worker.codec_ctx);
+	worker.codec_id = AV_CODEC_ID_NONE;
+
+	AVCodec* codec = avcodec_find_decoder(params->codec_id);
+	if (!codec)
+		return ErrorCode::NO_CODEC;
+
+	worker.codec_ctx = avcodec_alloc_context3(codec);
+	if (!worker.codec_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+
+	if (avcodec_parameters_to_context(worker.codec_ctx, params) < 0)
+		return ErrorCode::CODEC_CTX_UNINIT;
+
+	//parallelism comes from the worker pool, frame threads would only add latency per thumbnail
+	worker.codec_ctx->thread_count = 1;
+	worker.codec_ctx->skip_frame = options.keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+
+	if (avcodec_open2(worker.codec_ctx, codec, nullptr) < 0)
+	{
+		avcodec_free_context(&worker.codec_ctx);
+		return ErrorCode::CODEC_UNOPENED;
+	}
+
+	worker.codec_id = params->codec_id;
+	worker.width = params->width;
+	worker.height = params->height;
+	worker.format = params->format;
+	worker.extradata.assign(params->extradata, params->extradata + params->extradata_size);
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode ThumbnailEngine::extractAt(WorkerContext& worker, AVFormatContext* fmt_ctx, int streamIndex, double seconds, ThumbnailResult& result)
+{
+	AVStream* stream = fmt_ctx->streams[streamIndex];
+	int64_t target = av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+	if (stream->start_time != AV_NOPTS_VALUE)
+		target += stream->start_time;
+
+	if (av_seek_frame(fmt_ctx, streamIndex, target, AVSEEK_FLAG_BACKWARD) < 0)
+		return ErrorCode::SEEK_FAILED;
+	avcodec_flush_buffers(worker.codec_ctx);
+
+	AVFrame* frame = worker.frame;
+	AVPacket* packet = worker.packet;
+	bool gotFrame = false;
+	bool draining = false;
+	while (!gotFrame)
+	{
+		if (!draining)
+		{
+			if (av_read_frame(fmt_ctx, packet) < 0)
+			{
+				//end of file, whatever the decoder still holds is the closest we get
+				draining = true;
+				avcodec_send_packet(worker.codec_ctx, nullptr);
+			}
+			else if (packet->stream_index != streamIndex)
+			{
+				av_packet_unref(packet);
+				continue;
+			}
+			else
+			{
+				int response = avcodec_send_packet(worker.codec_ctx, packet);
+				av_packet_unref(packet);
+				if (response < 0 && response != AVERROR(EAGAIN))
+					return ErrorCode::PKT_NOT_DECODED;
+			}
+		}
+
+		while (!gotFrame)
+		{
+			int response = avcodec_receive_frame(worker.codec_ctx, frame);
+			if (response == AVERROR(EAGAIN))
+				break;
+			if (response == AVERROR_EOF)
+				return ErrorCode::FILE_EOF;
+			if (response < 0)
+				return ErrorCode::PKT_NOT_RECEIVED;
+
+			if (options.keyframes_only || frame->best_effort_timestamp >= target || frame->pts >= target)
+				gotFrame = true;
+			else
+				av_frame_unref(frame);
+		}
+	}
+
+	int dstW = options.width;
+	int dstH = options.height;
+	if (dstW <= 0 && dstH <= 0)
+	{
+		dstW = frame->width;
+		dstH = frame->height;
+	}
+	else if (dstW <= 0)
+		dstW = (int)av_rescale(frame->width, dstH, frame->height);
+	else if (dstH <= 0)
+		dstH = (int)av_rescale(frame->height, dstW, frame->width);
+	dstW = (std::max)(dstW, 2) & ~1;
+	dstH = (std::max)(dstH, 2) & ~1;
+
+	worker.sws_ctx = sws_getCachedContext(worker.sws_ctx, frame->width, frame->height, (AVPixelFormat)frame->format,
+		dstW, dstH, options.pix_fmt, options.sws_flags, nullptr, nullptr, nullptr);
+	if (!worker.sws_ctx)
+	{
+		av_frame_unref(frame);
+		return ErrorCode::NO_SCALER;
+	}
+
+	int size = av_image_get_buffer_size(options.pix_fmt, dstW, dstH, 1);
+	result.pixels.resize(size);
+	uint8_t* dst[4] = { nullptr };
+	int dst_linesize[4] = { 0 };
+	av_image_fill_arrays(dst, dst_linesize, result.pixels.data(), options.pix_fmt, dstW, dstH, 1);
+	sws_scale(worker.sws_ctx, frame->data, frame->linesize, 0, frame->height, dst, dst_linesize);
+
+	int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+	if (pts != AV_NOPTS_VALUE)
+	{
+		if (stream->start_time != AV_NOPTS_VALUE)
+			pts -= stream->start_time;
+		result.frame_seconds = pts * av_q2d(stream->time_base);
+	}
+	result.width = dstW;
+	result.height = dstH;
+	result.stride = dst_linesize[0];
+	result.pix_fmt = options.pix_fmt;
+
+	av_frame_unref(frame);
+	return ErrorCode::SUCCESS;
+}
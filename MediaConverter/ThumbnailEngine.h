@@ -0,0 +1,72 @@
+#pragma once
+#include "MediaConverter.h"
+#include "WorkerPool.h"
+#include <atomic>
+#include <functional>
+#include <string>
+
+struct ThumbnailOptions
+{
+	int width = 320; //target size, a dimension <= 0 is derived from the other one keeping the aspect ratio
+	int height = 0;
+	AVPixelFormat pix_fmt = AV_PIX_FMT_RGB0;
+	int sws_flags = SWS_BILINEAR;
+	bool keyframes_only = true; //take the keyframe at or before each timestamp instead of decoding up to it
+	size_t threads = 0; //0 uses every hardware thread
+};
+
+struct ThumbnailResult
+{
+	ErrorCode error = ErrorCode::SUCCESS;
+	size_t file_index = 0;
+	size_t timestamp_index = 0;
+	std::string path;
+	double requested_seconds = 0.0;
+	double frame_seconds = 0.0;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+	AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+	std::vector<uint8_t> pixels;
+};
+
+struct ThumbnailStats
+{
+	size_t files = 0;
+	size_t failed_files = 0;
+	size_t thumbnails = 0;
+	double wall_ms = 0.0;
+	double thumbnails_per_sec = 0.0;
+	double avg_file_ms = 0.0;
+	double max_file_ms = 0.0;
+	double p95_file_ms = 0.0;
+};
+
+/*
+* extracts thumbnails for N files x M timestamps on a worker pool. every worker keeps its decoder and
+* scaler and only reopens them when the next file's stream parameters differ, and frames are scaled
+* straight to the thumbnail size.
+* the callback is invoked from the worker threads, possibly from several at once
+*/
+class MEDIACONVERTER_API ThumbnailEngine
+{
+public:
+	typedef std::function<void(const ThumbnailResult&)> ThumbnailCallback;
+
+	explicit ThumbnailEngine(const ThumbnailOptions& options = ThumbnailOptions());
+	~ThumbnailEngine();
+
+	ThumbnailStats Run(const std::vector<std::string>& files, const std::vector<double>& seconds, ThumbnailCallback callback);
+
+private:
+	struct WorkerContext;
+
+	ErrorCode processFile(WorkerContext& worker, size_t fileIndex, const std::string& path,
+		const std::vector<double>& seconds, ThumbnailCallback& callback);
+	ErrorCode extractAt(WorkerContext& worker, AVFormatContext* fmt_ctx, int streamIndex, double seconds, ThumbnailResult& result);
+	ErrorCode prepareDecoder(WorkerContext& worker, AVCodecParameters* params);
+
+	ThumbnailOptions options;
+	WorkerPool pool;
+	std::vector<WorkerContext*> workers;
+};
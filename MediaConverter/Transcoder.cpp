@@ -0,0 +1,714 @@
+#include "pch.h"
+#include "framework.h"
+#include "Transcoder.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <chrono>
+
+extern "C"
+{
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+}
+
+struct Transcoder::StreamContext
+{
+	explicit StreamContext(size_t depth) : packets(depth), decoded(depth), filtered(depth) {}
+
+	~StreamContext()
+	{
+		for (AVPacket* pkt : packets.Reset())
+			av_packet_free(&pkt);
+		for (AVFrame* frame : decoded.Reset())
+			av_frame_free(&frame);
+		for (AVFrame* frame : filtered.Reset())
+			av_frame_free(&frame);
+		avcodec_free_context(&dec_ctx);
+		avcodec_free_context(&enc_ctx);
+		swr_free(&swr);
+		if (fifo)
+			av_audio_fifo_free(fifo);
+	}
+
+	int in_index = -1;
+	AVMediaType type = AVMEDIA_TYPE_UNKNOWN;
+	AVStream* in_stream = nullptr;
+	AVStream* out_stream = nullptr;
+	AVCodecContext* dec_ctx = nullptr;
+	AVCodecContext* enc_ctx = nullptr;
+	int budget_threads = 0; //held from ThreadBudget until cleanup
+
+	BoundedQueue<AVPacket*> packets; //demux -> decode
+	BoundedQueue<AVFrame*> decoded; //decode -> filter
+	BoundedQueue<AVFrame*> filtered; //filter -> encode
+	std::thread decode_thread;
+	std::thread filter_thread;
+	std::thread encode_thread;
+
+	//video
+	ScalerCache scalers;
+	int64_t last_pts = AV_NOPTS_VALUE;
+
+	//audio
+	SwrContext* swr = nullptr;
+	AVAudioFifo* fifo = nullptr;
+	int64_t next_pts = AV_NOPTS_VALUE;
+};
+
+namespace
+{
+	AVCodec* findEncoder(const char* name, const char* fallback, AVCodecID containerDefault)
+	{
+		AVCodec* codec = name ? avcodec_find_encoder_by_name(name) : nullptr;
+		if (!codec && fallback)
+			codec = avcodec_find_encoder_by_name(fallback);
+		if (!codec && containerDefault != AV_CODEC_ID_NONE)
+			codec = avcodec_find_encoder(containerDefault);
+		return codec;
+	}
+
+	bool hasOption(AVCodecContext* ctx, const char* name)
+	{
+		return ctx->priv_data && av_opt_find(ctx->priv_data, name, nullptr, 0, 0) != nullptr;
+	}
+}
+
+Transcoder::Transcoder(const TranscodeOptions& options) : options(options), error(0), video_frames(0), audio_frames(0), packets_written(0)
+{
+}
+
+Transcoder::~Transcoder()
+{
+	cleanup();
+}
+
+ErrorCode Transcoder::Run(const char* inFile, const char* outFile)
+{
+	return Run(inFile, outFile, nullptr);
+}
+
+ErrorCode Transcoder::Run(const char* inFile, const char* outFile, PacketSink* sink)
+{
+	return Run(MediaInput::FromFile(inFile), outFile, sink);
+}
+
+ErrorCode Transcoder::Run(const MediaInput& input, const char* outFile, PacketSink* sink)
+{
+	this->sink = sink;
+	auto start = std::chrono::steady_clock::now();
+	stats = TranscodeStats();
+	error = (int)ErrorCode::SUCCESS;
+	video_frames = 0;
+	audio_frames = 0;
+	packets_written = 0;
+
+	ErrorCode ret = openInput(input);
+	if (ret == ErrorCode::SUCCESS)
+		ret = openOutput(outFile);
+	if (ret != ErrorCode::SUCCESS)
+	{
+		cleanup();
+		return ret;
+	}
+
+	for (StreamContext* stream : streams)
+	{
+		if (!stream)
+			continue;
+		stream->decode_thread = std::thread(&Transcoder::decodeLoop, this, std::ref(*stream));
+		if (stream->type == AVMEDIA_TYPE_VIDEO)
+			stream->filter_thread = std::thread(&Transcoder::filterVideoLoop, this, std::ref(*stream));
+		else
+			stream->filter_thread = std::thread(&Transcoder::filterAudioLoop, this, std::ref(*stream));
+		stream->encode_thread = std::thread(&Transcoder::encodeLoop, this, std::ref(*stream));
+	}
+
+	//demux on the calling thread, a full queue blocks here until that stream's decoder catches up
+	AVPacket* pkt = av_packet_alloc();
+	while (pkt && error == (int)ErrorCode::SUCCESS && av_read_frame(in_ctx, pkt) >= 0)
+	{
+		StreamContext* stream = pkt->stream_index < (int)streams.size() ? streams[pkt->stream_index] : nullptr;
+		if (!stream || (range && !range->Accept(pkt)))
+		{
+			av_packet_unref(pkt);
+			if (range && range->Done())
+				break;
+			continue;
+		}
+
+		++stats.packets_read;
+		AVPacket* queued = av_packet_alloc();
+		av_packet_move_ref(queued, pkt);
+		if (!stream->packets.Push(queued))
+		{
+			av_packet_free(&queued);
+			break;
+		}
+	}
+	av_packet_free(&pkt);
+
+	for (StreamContext* stream : streams)
+	{
+		if (stream)
+			stream->packets.Close();
+	}
+
+	for (StreamContext* stream : streams)
+	{
+		if (!stream)
+			continue;
+		stream->decode_thread.join();
+		stream->filter_thread.join();
+		stream->encode_thread.join();
+	}
+
+	if (error == (int)ErrorCode::SUCCESS && !sink && av_write_trailer(out_ctx) < 0)
+		error = (int)ErrorCode::NO_OUTPUT_FILE;
+
+	stats.video_frames = video_frames;
+	stats.audio_frames = audio_frames;
+	stats.packets_written = packets_written;
+	stats.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	cleanup();
+	return (ErrorCode)error.load();
+}
+
+ErrorCode Transcoder::openInput(const MediaInput& input)
+{
+	if (input.Open(&in_ctx, &in_io) != ErrorCode::SUCCESS)
+		return ErrorCode::FMT_UNOPENED;
+
+	if (avformat_find_stream_info(in_ctx, nullptr) < 0)
+		return ErrorCode::NO_STREAMS;
+
+	streams.assign(in_ctx->nb_streams, nullptr);
+	bool any = false;
+	for (unsigned int i = 0; i < in_ctx->nb_streams; ++i)
+	{
+		AVMediaType type = in_ctx->streams[i]->codecpar->codec_type;
+		if (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO)
+			continue;
+
+		StreamContext* stream = new StreamContext(options.queue_depth);
+		streams[i] = stream;
+		stream->in_index = i;
+		stream->type = type;
+		stream->in_stream = in_ctx->streams[i];
+
+		ErrorCode ret = openDecoder(*stream);
+		if (ret != ErrorCode::SUCCESS)
+			return ret;
+		any = true;
+	}
+	if (!any)
+		return ErrorCode::NO_STREAMS;
+
+	if (options.start_time != AV_NOPTS_VALUE || options.end_time != AV_NOPTS_VALUE)
+	{
+		range.reset(new PacketRange(in_ctx, options.start_time, options.end_time, true));
+		if (range->Seek() < 0)
+			return ErrorCode::SEEK_FAILED;
+	}
+
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode Transcoder::openDecoder(StreamContext& stream)
+{
+	AVCodec* codec = avcodec_find_decoder(stream.in_stream->codecpar->codec_id);
+	if (!codec)
+		return ErrorCode::NO_CODEC;
+
+	stream.dec_ctx = avcodec_alloc_context3(codec);
+	if (!stream.dec_ctx)
+		return ErrorCode::NO_CODEC_CTX;
+
+	if (avcodec_parameters_to_context(stream.dec_ctx, stream.in_stream->codecpar) < 0)
+		return ErrorCode::CODEC_CTX_UNINIT;
+
+	//same rules as MediaReaderState::OpenDecoders, audio decoders don't thread
+	DecodeThreading threading;
+	threading.threads = 1;
+	if (stream.type == AVMEDIA_TYPE_VIDEO)
+	{
+		if (options.decoder_budget)
+			threading.threads = stream.budget_threads = ThreadBudget::Instance().Acquire(options.decoder_threads);
+		else
+			threading.threads = options.decoder_threads > 0 ? options.decoder_threads : (std::max)(1, (int)std::thread::hardware_concurrency());
+	}
+	threading.Apply(stream.dec_ctx);
+	stream.dec_ctx->pkt_timebase = stream.in_stream->time_base;
+	if (stream.type == AVMEDIA_TYPE_VIDEO)
+		stream.dec_ctx->framerate = av_guess_frame_rate(in_ctx, stream.in_stream, nullptr);
+
+	if (avcodec_open2(stream.dec_ctx, codec, nullptr) < 0)
+		return ErrorCode::CODEC_UNOPENED;
+
+	if (stream.type == AVMEDIA_TYPE_AUDIO && stream.dec_ctx->channel_layout == 0)
+		stream.dec_ctx->channel_layout = av_get_default_channel_layout(stream.dec_ctx->channels);
+
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode Transcoder::openOutput(const char* outFile)
+{
+	avformat_alloc_output_context2(&out_ctx, nullptr, nullptr, outFile);
+	if (!out_ctx)
+		return ErrorCode::NO_OUTPUT_FILE;
+
+	for (StreamContext* stream : streams)
+	{
+		if (!stream)
+			continue;
+
+		stream->out_stream = avformat_new_stream(out_ctx, nullptr);
+		if (!stream->out_stream)
+			return ErrorCode::NO_CODEC_CTX;
+
+		ErrorCode ret = stream->type == AVMEDIA_TYPE_VIDEO ? openVideoEncoder(*stream) : openAudioEncoder(*stream);
+		if (ret != ErrorCode::SUCCESS)
+			return ret;
+
+		if (avcodec_parameters_from_context(stream->out_stream->codecpar, stream->enc_ctx) < 0)
+			return ErrorCode::CODEC_CTX_UNINIT;
+		stream->out_stream->time_base = stream->enc_ctx->time_base;
+	}
+
+	if (sink)
+		return sink->Open(out_ctx);
+
+	av_dump_format(out_ctx, 0, outFile, 1);
+
+	if (!(out_ctx->oformat->flags & AVFMT_NOFILE))
+	{
+		if (avio_open(&out_ctx->pb, outFile, AVIO_FLAG_WRITE) < 0)
+			return ErrorCode::NO_OUTPUT_FILE;
+	}
+
+	if (avformat_write_header(out_ctx, nullptr) < 0)
+		return ErrorCode::NO_OUTPUT_FILE;
+
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode Transcoder::openVideoEncoder(StreamContext& stream)
+{
+	AVCodec* codec = findEncoder(options.video_encoder, options.video_fallback, out_ctx->oformat->video_codec);
+	if (!codec)
+		return ErrorCode::NO_CODEC;
+	stats.video_encoder = codec->name;
+
+	AVCodecContext* enc = avcodec_alloc_context3(codec);
+	stream.enc_ctx = enc;
+	if (!enc)
+		return ErrorCode::NO_CODEC_CTX;
+
+	//same rules as OutputOptions, encoders want even dimensions for 4:2:0
+	AVCodecContext* dec = stream.dec_ctx;
+	int width = options.width > 0 ? options.width : dec->width;
+	int height = options.height > 0 ? options.height : dec->height;
+	if (options.width > 0 && options.height <= 0 && dec->width > 0)
+		height = (int)av_rescale(options.width, dec->height, dec->width);
+	else if (options.height > 0 && options.width <= 0 && dec->height > 0)
+		width = (int)av_rescale(options.height, dec->width, dec->height);
+	enc->width = width & ~1;
+	enc->height = height & ~1;
+	enc->sample_aspect_ratio = dec->sample_aspect_ratio;
+
+	AVPixelFormat src_fmt = dec->pix_fmt != AV_PIX_FMT_NONE ? dec->pix_fmt : AV_PIX_FMT_YUV420P;
+	enc->pix_fmt = codec->pix_fmts ? avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, src_fmt, 0, nullptr) : src_fmt;
+
+	AVRational framerate = av_guess_frame_rate(in_ctx, stream.in_stream, nullptr);
+	if (framerate.num <= 0 || framerate.den <= 0)
+		framerate = AVRational{ 25, 1 };
+	enc->framerate = framerate;
+	enc->time_base = av_inv_q(framerate);
+
+	enc->thread_count = options.encoder_threads;
+	enc->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+	if (options.video_bit_rate > 0)
+		enc->bit_rate = options.video_bit_rate;
+	else if (hasOption(enc, "crf"))
+		av_opt_set_int(enc->priv_data, "crf", options.crf, 0);
+	else
+	{
+		//no crf (mpeg4 etc), a fixed quantizer is the closest constant quality mode
+		int quantizer = (std::max)(2, (std::min)(31, options.crf / 5));
+		enc->flags |= AV_CODEC_FLAG_QSCALE;
+		enc->global_quality = FF_QP2LAMBDA * quantizer;
+	}
+
+	if (options.preset && hasOption(enc, "preset"))
+		av_opt_set(enc->priv_data, "preset", options.preset, 0);
+
+	if (out_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+		enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	if (avcodec_open2(enc, codec, nullptr) < 0)
+		return ErrorCode::CODEC_UNOPENED;
+
+	return ErrorCode::SUCCESS;
+}
+
+ErrorCode Transcoder::openAudioEncoder(StreamContext& stream)
+{
+	AVCodec* codec = findEncoder(options.audio_encoder, options.audio_fallback, out_ctx->oformat->audio_codec);
+	if (!codec)
+		return ErrorCode::NO_CODEC;
+	stats.audio_encoder = codec->name;
+
+	AVCodecContext* enc = avcodec_alloc_context3(codec);
+	stream.enc_ctx = enc;
+	if (!enc)
+		return ErrorCode::NO_CODEC_CTX;
+
+	AVCodecContext* dec = stream.dec_ctx;
+	enc->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : dec->sample_fmt;
+
+	//keep the source rate/layout when the encoder takes them, opus for one only does 48k
+	enc->sample_rate = dec->sample_rate;
+	if (codec->supported_samplerates)
+	{
+		int chosen = 0;
+		for (const int* rate = codec->supported_samplerates; *rate; ++rate)
+		{
+			if (*rate == dec->sample_rate || (*rate == 48000 && chosen != dec->sample_rate) || chosen == 0)
+				chosen = *rate;
+		}
+		enc->sample_rate = chosen;
+	}
+
+	enc->channel_layout = dec->channel_layout;
+	if (codec->channel_layouts)
+	{
+		uint64_t chosen = 0;
+		for (const uint64_t* layout = codec->channel_layouts; *layout; ++layout)
+		{
+			if (*layout == dec->channel_layout || (*layout == AV_CH_LAYOUT_STEREO && chosen != dec->channel_layout) || chosen == 0)
+				chosen = *layout;
+		}
+		enc->channel_layout = chosen;
+	}
+	enc->channels = av_get_channel_layout_nb_channels(enc->channel_layout);
+
+	enc->bit_rate = options.audio_bit_rate;
+	enc->time_base = AVRational{ 1, enc->sample_rate };
+	enc->thread_count = options.encoder_threads;
+
+	if (out_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+		enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	if (avcodec_open2(enc, codec, nullptr) < 0)
+		return ErrorCode::CODEC_UNOPENED;
+
+	stream.fifo = av_audio_fifo_alloc(enc->sample_fmt, enc->channels, (std::max)(enc->frame_size, 1024));
+	if (!stream.fifo)
+		return ErrorCode::NO_DATA_AVAIL;
+
+	return ErrorCode::SUCCESS;
+}
+
+void Transcoder::decodeLoop(StreamContext& stream)
+{
+	auto receive = [this, &stream]()
+	{
+		while (true)
+		{
+			AVFrame* frame = av_frame_alloc();
+			int ret = avcodec_receive_frame(stream.dec_ctx, frame);
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			{
+				av_frame_free(&frame);
+				return true;
+			}
+			if (ret < 0)
+			{
+				av_frame_free(&frame);
+				fail(ErrorCode::PKT_NOT_RECEIVED);
+				return false;
+			}
+
+			frame->pts = frame->best_effort_timestamp;
+			if (!stream.decoded.Push(frame))
+			{
+				av_frame_free(&frame);
+				return false;
+			}
+		}
+	};
+
+	AVPacket* pkt = nullptr;
+	bool running = true;
+	while (running && stream.packets.Pop(pkt))
+	{
+		//a corrupt packet only costs its own frames, the decoder carries on with the next one
+		avcodec_send_packet(stream.dec_ctx, pkt);
+		av_packet_free(&pkt);
+		running = receive();
+	}
+
+	if (running && error == (int)ErrorCode::SUCCESS)
+	{
+		avcodec_send_packet(stream.dec_ctx, nullptr);
+		receive();
+	}
+	stream.decoded.Close();
+}
+
+void Transcoder::filterVideoLoop(StreamContext& stream)
+{
+	AVCodecContext* enc = stream.enc_ctx;
+	AVFrame* in = nullptr;
+	while (stream.decoded.Pop(in))
+	{
+		if (range && !range->InRange(stream.in_index, in->pts))
+		{
+			av_frame_free(&in);
+			continue;
+		}
+
+		AVFrame* out = in;
+		if (in->width != enc->width || in->height != enc->height || in->format != enc->pix_fmt)
+		{
+			ScalerKey key;
+			key.src_width = in->width;
+			key.src_height = in->height;
+			key.src_fmt = (AVPixelFormat)in->format;
+			key.dst_width = enc->width;
+			key.dst_height = enc->height;
+			key.dst_fmt = enc->pix_fmt;
+			key.flags = options.sws_flags;
+			key.colorspace = in->colorspace;
+			key.color_range = in->color_range;
+
+			SwsContext* sws = stream.scalers.Get(key);
+			out = av_frame_alloc();
+			out->format = enc->pix_fmt;
+			out->width = enc->width;
+			out->height = enc->height;
+			if (!sws || av_frame_get_buffer(out, 32) < 0)
+			{
+				av_frame_free(&out);
+				av_frame_free(&in);
+				fail(ErrorCode::NO_SCALER);
+				break;
+			}
+			sws_scale(sws, in->data, in->linesize, 0, in->height, out->data, out->linesize);
+			av_frame_copy_props(out, in);
+			av_frame_free(&in);
+		}
+
+		//encoder timebase is 1/fps, keep pts strictly increasing when variable frame rate input rounds onto the same tick
+		int64_t pts = out->pts != AV_NOPTS_VALUE ? av_rescale_q(out->pts, stream.in_stream->time_base, enc->time_base) : AV_NOPTS_VALUE;
+		if (stream.last_pts != AV_NOPTS_VALUE && (pts == AV_NOPTS_VALUE || pts <= stream.last_pts))
+			pts = stream.last_pts + 1;
+		else if (pts == AV_NOPTS_VALUE)
+			pts = 0;
+		stream.last_pts = pts;
+		out->pts = pts;
+		out->pict_type = AV_PICTURE_TYPE_NONE;
+		if (enc->flags & AV_CODEC_FLAG_QSCALE)
+			out->quality = enc->global_quality;
+
+		if (!stream.filtered.Push(out))
+		{
+			av_frame_free(&out);
+			break;
+		}
+	}
+	stream.filtered.Close();
+}
+
+void Transcoder::filterAudioLoop(StreamContext& stream)
+{
+	AVCodecContext* enc = stream.enc_ctx;
+	AVFrame* in = nullptr;
+	bool running = true;
+	while (running && stream.decoded.Pop(in))
+	{
+		if (in->channel_layout == 0)
+			in->channel_layout = av_get_default_channel_layout(in->channels);
+
+		if (!stream.swr)
+		{
+			stream.swr = swr_alloc_set_opts(nullptr, enc->channel_layout, enc->sample_fmt, enc->sample_rate,
+				in->channel_layout, (AVSampleFormat)in->format, in->sample_rate, 0, nullptr);
+			if (!stream.swr || swr_init(stream.swr) < 0)
+			{
+				av_frame_free(&in);
+				fail(ErrorCode::NO_SWR_CTX);
+				break;
+			}
+		}
+
+		//audio pts restart from the first frame and then count samples, which is what the encoder expects
+		if (stream.next_pts == AV_NOPTS_VALUE)
+			stream.next_pts = in->pts != AV_NOPTS_VALUE ? av_rescale_q(in->pts, stream.in_stream->time_base, enc->time_base) : 0;
+
+		AVFrame* out = av_frame_alloc();
+		out->channel_layout = enc->channel_layout;
+		out->sample_rate = enc->sample_rate;
+		out->format = enc->sample_fmt;
+		int ret = swr_convert_frame(stream.swr, out, in);
+		av_frame_free(&in);
+		if (ret < 0)
+		{
+			av_frame_free(&out);
+			fail(ErrorCode::NO_SWR_CONVERT);
+			break;
+		}
+
+		av_audio_fifo_write(stream.fifo, (void**)out->data, out->nb_samples);
+		av_frame_free(&out);
+		running = pushAudioFrames(stream, false);
+	}
+
+	if (running && stream.swr && error == (int)ErrorCode::SUCCESS)
+	{
+		//whatever the resampler is still holding, then the partial last frame
+		AVFrame* out = av_frame_alloc();
+		out->channel_layout = enc->channel_layout;
+		out->sample_rate = enc->sample_rate;
+		out->format = enc->sample_fmt;
+		if (swr_convert_frame(stream.swr, out, nullptr) >= 0 && out->nb_samples > 0)
+			av_audio_fifo_write(stream.fifo, (void**)out->data, out->nb_samples);
+		av_frame_free(&out);
+		pushAudioFrames(stream, true);
+	}
+	stream.filtered.Close();
+}
+
+//encoders without a variable frame size need exactly frame_size samples per frame except for the last one
+bool Transcoder::pushAudioFrames(StreamContext& stream, bool flush)
+{
+	AVCodecContext* enc = stream.enc_ctx;
+	int frame_size = enc->frame_size > 0 ? enc->frame_size : 1024;
+	while (av_audio_fifo_size(stream.fifo) >= frame_size || (flush && av_audio_fifo_size(stream.fifo) > 0))
+	{
+		int samples = (std::min)(frame_size, av_audio_fifo_size(stream.fifo));
+		AVFrame* frame = av_frame_alloc();
+		frame->nb_samples = samples;
+		frame->channel_layout = enc->channel_layout;
+		frame->sample_rate = enc->sample_rate;
+		frame->format = enc->sample_fmt;
+		if (av_frame_get_buffer(frame, 0) < 0)
+		{
+			av_frame_free(&frame);
+			fail(ErrorCode::NO_FRAME);
+			return false;
+		}
+
+		av_audio_fifo_read(stream.fifo, (void**)frame->data, samples);
+		frame->pts = stream.next_pts;
+		stream.next_pts += samples;
+
+		if (!stream.filtered.Push(frame))
+		{
+			av_frame_free(&frame);
+			return false;
+		}
+	}
+	return true;
+}
+
+void Transcoder::encodeLoop(StreamContext& stream)
+{
+	AVFrame* frame = nullptr;
+	bool running = true;
+	while (running && stream.filtered.Pop(frame))
+	{
+		int ret = avcodec_send_frame(stream.enc_ctx, frame);
+		av_frame_free(&frame);
+		if (ret < 0)
+		{
+			fail(ErrorCode::PKT_NOT_DECODED);
+			break;
+		}
+
+		if (stream.type == AVMEDIA_TYPE_VIDEO)
+			++video_frames;
+		else
+			++audio_frames;
+		running = drainEncoder(stream);
+	}
+
+	if (running && error == (int)ErrorCode::SUCCESS)
+	{
+		avcodec_send_frame(stream.enc_ctx, nullptr);
+		drainEncoder(stream);
+	}
+}
+
+bool Transcoder::drainEncoder(StreamContext& stream)
+{
+	AVPacket* pkt = av_packet_alloc();
+	bool ok = true;
+	while (true)
+	{
+		int ret = avcodec_receive_packet(stream.enc_ctx, pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			break;
+		if (ret < 0)
+		{
+			fail(ErrorCode::PKT_NOT_RECEIVED);
+			ok = false;
+			break;
+		}
+
+		pkt->stream_index = stream.out_stream->index;
+		av_packet_rescale_ts(pkt, stream.enc_ctx->time_base, stream.out_stream->time_base);
+
+		std::lock_guard<std::mutex> lock(mux_mtx);
+		bool written = sink ? sink->Write(pkt) == ErrorCode::SUCCESS : av_interleaved_write_frame(out_ctx, pkt) >= 0;
+		if (!written)
+		{
+			fail(ErrorCode::NO_OUTPUT_FILE);
+			ok = false;
+			break;
+		}
+		++packets_written;
+	}
+	av_packet_free(&pkt);
+	return ok;
+}
+
+void Transcoder::fail(ErrorCode code)
+{
+	int expected = (int)ErrorCode::SUCCESS;
+	error.compare_exchange_strong(expected, (int)code);
+	abortAll();
+}
+
+void Transcoder::abortAll()
+{
+	for (StreamContext* stream : streams)
+	{
+		if (!stream)
+			continue;
+		stream->packets.Abort();
+		stream->decoded.Abort();
+		stream->filtered.Abort();
+	}
+}
+
+void Transcoder::cleanup()
+{
+	for (StreamContext* stream : streams)
+	{
+		if (stream)
+			ThreadBudget::Instance().Release(stream->budget_threads);
+		delete stream;
+	}
+	streams.clear();
+
+	if (out_ctx && !(out_ctx->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&out_ctx->pb);
+	avformat_free_context(out_ctx);
+	out_ctx = nullptr;
+	range.reset();
+	MediaInput::Close(&in_ctx, &in_io);
+	sink = nullptr;
+}
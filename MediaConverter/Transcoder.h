@@ -0,0 +1,112 @@
+#pragma once
+#include "MediaConverter.h"
+#include "BoundedQueue.h"
+#include "MediaInput.h"
+#include "PacketRange.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TranscodeOptions
+{
+	//encoders are tried in order, the fallbacks are built into every ffmpeg build
+	const char* video_encoder = "libx264";
+	const char* video_fallback = "mpeg4";
+	const char* audio_encoder = "libopus";
+	const char* audio_fallback = "aac";
+
+	int64_t video_bit_rate = 0; //0 encodes at constant quality instead
+	int crf = 23; //for encoders with a crf option, the others get an equivalent fixed quantizer
+	const char* preset = nullptr; //passed through to encoders that have one ("veryfast" etc)
+	int64_t audio_bit_rate = 128000;
+
+	int width = 0; //0 keeps the source size, setting only one dimension keeps the aspect ratio
+	int height = 0;
+	int sws_flags = SWS_BICUBIC;
+
+	int encoder_threads = 0; //0 lets the codec pick
+	//video decoders thread like a reader's: 0 takes a share from ThreadBudget, anything else is an upper bound on it
+	int decoder_threads = 0;
+	bool decoder_budget = true; //false takes decoder_threads as given (0 = every hardware thread) without counting them
+	size_t queue_depth = 16; //packets/frames buffered between each pipeline stage
+
+	//[start, end) in AV_TIME_BASE units, AV_NOPTS_VALUE for the whole file. decoding starts on the keyframe
+	//before start, frames outside the range are dropped before the encoder. timestamps keep the source timeline
+	int64_t start_time = AV_NOPTS_VALUE;
+	int64_t end_time = AV_NOPTS_VALUE;
+};
+
+struct TranscodeStats
+{
+	int64_t packets_read = 0;
+	int64_t video_frames = 0; //frames handed to the video encoder
+	int64_t audio_frames = 0;
+	int64_t packets_written = 0;
+	const char* video_encoder = nullptr; //what was actually used after fallbacks
+	const char* audio_encoder = nullptr;
+	double wall_ms = 0.0;
+};
+
+//takes the encoded packets in place of the muxer, see SegmentTranscoder
+class MEDIACONVERTER_API PacketSink
+{
+public:
+	virtual ~PacketSink() {}
+	virtual ErrorCode Open(const AVFormatContext* layout) = 0; //output streams and codec parameters, nothing written yet
+	virtual ErrorCode Write(AVPacket* pkt) = 0; //timestamps in the output stream's time_base, called under the mux lock
+};
+
+/*
+* decode -> scale/resample -> encode for every audio and video stream. each stream gets its own decode,
+* filter and encode thread connected by bounded queues, the calling thread demuxes, and the encoders write
+* into a shared muxer. any stage failing aborts every queue so the whole pipeline unwinds
+*/
+class MEDIACONVERTER_API Transcoder
+{
+public:
+	explicit Transcoder(const TranscodeOptions& options = TranscodeOptions());
+	~Transcoder();
+	Transcoder(const Transcoder&) = delete;
+	Transcoder& operator=(const Transcoder&) = delete;
+
+	ErrorCode Run(const char* inFile, const char* outFile);
+	//encoders are set up for outFile's container but the packets go to sink, outFile isn't created
+	ErrorCode Run(const char* inFile, const char* outFile, PacketSink* sink);
+	ErrorCode Run(const MediaInput& input, const char* outFile, PacketSink* sink = nullptr);
+	const TranscodeStats& Stats() const { return stats; }
+
+private:
+	struct StreamContext;
+
+	ErrorCode openInput(const MediaInput& input);
+	ErrorCode openOutput(const char* outFile);
+	ErrorCode openDecoder(StreamContext& stream);
+	ErrorCode openVideoEncoder(StreamContext& stream);
+	ErrorCode openAudioEncoder(StreamContext& stream);
+
+	void decodeLoop(StreamContext& stream);
+	void filterVideoLoop(StreamContext& stream);
+	void filterAudioLoop(StreamContext& stream);
+	void encodeLoop(StreamContext& stream);
+	bool drainEncoder(StreamContext& stream);
+	bool pushAudioFrames(StreamContext& stream, bool flush);
+
+	void fail(ErrorCode error);
+	void abortAll();
+	void cleanup();
+
+	TranscodeOptions options;
+	TranscodeStats stats;
+	AVFormatContext* in_ctx = nullptr;
+	AVIOContext* in_io = nullptr; //non file input only
+	AVFormatContext* out_ctx = nullptr;
+	PacketSink* sink = nullptr;
+	std::unique_ptr<PacketRange> range;
+	std::vector<StreamContext*> streams; //indexed by input stream, null for streams that are dropped
+	std::mutex mux_mtx;
+	std::atomic<int> error;
+	std::atomic<int64_t> video_frames;
+	std::atomic<int64_t> audio_frames;
+	std::atomic<int64_t> packets_written;
+};
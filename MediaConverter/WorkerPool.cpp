@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "framework.h"
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(size_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+
+	for (size_t i = 0; i < threadCount; ++i)
+		workers.emplace_back(&WorkerPool::workerLoop, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	task_available.notify_all();
+	for (auto& worker : workers)
+	{
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+void WorkerPool::Submit(Task task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		tasks.push_back(std::move(task));
+	}
+	task_available.notify_one();
+}
+
+void WorkerPool::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	idle.wait(lock, [this]() { return tasks.empty() && running == 0; });
+}
+
+size_t WorkerPool::Pending() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return tasks.size() + running;
+}
+
+void WorkerPool::workerLoop(size_t workerIndex)
+{
+	while (1)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			task_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty())
+				return; //only reached when stopping
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			++running;
+		}
+
+		task(workerIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			--running;
+			if (tasks.empty() && running == 0)
+				idle.notify_all();
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef MEDIACONVERTER_EXPORTS
+#define MEDIACONVERTER_API __declspec(dllexport)
+#else
+#define MEDIACONVERTER_API __declspec(dllimport)
+#endif
+
+/*
+* fixed set of threads draining a FIFO of tasks. each task is told which worker runs it
+* so callers can keep per-worker state (decoders, scalers) without locking
+*/
+class MEDIACONVERTER_API WorkerPool
+{
+public:
+	typedef std::function<void(size_t workerIndex)> Task;
+
+	explicit WorkerPool(size_t threadCount = 0); //0 uses every hardware thread
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Submit(Task task);
+	void WaitIdle(); //blocks until the queue is empty and no task is running
+	size_t ThreadCount() const { return workers.size(); }
+	size_t Pending() const;
+
+private:
+	void workerLoop(size_t workerIndex);
+
+	std::vector<std::thread> workers;
+	std::deque<Task> tasks;
+	mutable std::mutex mtx;
+	std::condition_variable task_available;
+	std::condition_variable idle;
+	size_t running = 0;
+	bool stopping = false;
+};
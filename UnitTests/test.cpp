@@ -1,5 +1,16 @@
 #include "pch.h"
-//#include "../MediaConverter/MediaConverter.h"
+#include "../MediaConverter/MediaConverter.h"
+#include "../MediaConverter/ColorConverter.h"
+#include "../MediaConverter/FrameIndex.h"
+#include "../MediaConverter/MediaReaderState.h"
+#include "../MediaConverter/ScalerCache.h"
+#include "../MediaConverter/ThreadBudget.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
 
 TEST(TestCaseName, TestName) {
   EXPECT_EQ(1, 1);
@@ -9,4 +20,642 @@ TEST(TestCaseName, TestName) {
 TEST(MediaConverter, Test1)
 {
 	EXPECT_TRUE(true);
-}
\ No newline at end of file
+}
+
+//smooth gradients keep swscale's interpolated chroma close to the replicated chroma of the fast kernels
+static AVFrame* makeColorFrame(AVPixelFormat format, int width, int height, bool noise)
+{
+	AVFrame* frame = av_frame_alloc();
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	av_frame_get_buffer(frame, 32);
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+			frame->data[0][y * frame->linesize[0] + x] = noise ? (uint8_t)rand() : (uint8_t)(16 + (x + y) % 220);
+	}
+
+	for (int y = 0; y < (height + 1) / 2; ++y)
+	{
+		for (int x = 0; x < (width + 1) / 2; ++x)
+		{
+			uint8_t u = noise ? (uint8_t)rand() : (uint8_t)(64 + x / 2);
+			uint8_t v = noise ? (uint8_t)rand() : (uint8_t)(192 - y);
+			if (format == AV_PIX_FMT_NV12)
+			{
+				frame->data[1][y * frame->linesize[1] + x * 2] = u;
+				frame->data[1][y * frame->linesize[1] + x * 2 + 1] = v;
+			}
+			else
+			{
+				frame->data[1][y * frame->linesize[1] + x] = u;
+				frame->data[2][y * frame->linesize[2] + x] = v;
+			}
+		}
+	}
+	return frame;
+}
+
+TEST(ColorConverter, KernelsMatchScalar)
+{
+	const AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+	const ColorKernel kernels[] = { ColorKernel::SSE2, ColorKernel::AVX2 };
+
+	for (AVPixelFormat format : formats)
+	{
+		//odd width exercises the scalar tail after the vector loop
+		AVFrame* frame = makeColorFrame(format, 203, 17, true);
+		std::vector<uint8_t> expected(203 * 17 * 4);
+		ColorConverter::ToRGB0(frame, expected.data(), 203 * 4, ColorMatrix::BT709, ColorRange::Limited, ColorKernel::Scalar);
+
+		for (ColorKernel kernel : kernels)
+		{
+			if (!ColorConverter::KernelSupported(kernel))
+				continue;
+
+			std::vector<uint8_t> actual(expected.size());
+			ASSERT_EQ(0, ColorConverter::ToRGB0(frame, actual.data(), 203 * 4, ColorMatrix::BT709, ColorRange::Limited, kernel));
+			EXPECT_TRUE(expected == actual) << ColorConverter::KernelName(kernel);
+		}
+		av_frame_free(&frame);
+	}
+}
+
+TEST(ColorConverter, MatchesSwscale)
+{
+	const int width = 256;
+	const int height = 64;
+	const int tolerance = 3;
+	const AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+	const AVColorSpace colorspaces[] = { AVCOL_SPC_SMPTE170M, AVCOL_SPC_BT709 };
+	const AVColorRange ranges[] = { AVCOL_RANGE_MPEG, AVCOL_RANGE_JPEG };
+
+	for (AVPixelFormat format : formats)
+	{
+		AVFrame* frame = makeColorFrame(format, width, height, false);
+		for (AVColorSpace colorspace : colorspaces)
+		{
+			for (AVColorRange range : ranges)
+			{
+				frame->colorspace = colorspace;
+				frame->color_range = range;
+				ASSERT_TRUE(ColorConverter::Supports(frame, width, height, AV_PIX_FMT_RGB0));
+
+				std::vector<uint8_t> fast(width * height * 4);
+				ASSERT_EQ(0, ColorConverter::ToRGB0(frame, fast.data(), width * 4));
+
+				ScalerKey key;
+				key.src_width = key.dst_width = width;
+				key.src_height = key.dst_height = height;
+				key.src_fmt = format;
+				key.dst_fmt = AV_PIX_FMT_RGB0;
+				key.flags = SWS_BILINEAR;
+				key.colorspace = colorspace;
+				key.color_range = range;
+
+				ScalerCache cache;
+				SwsContext* ctx = cache.Get(key);
+				ASSERT_NE(nullptr, ctx);
+
+				std::vector<uint8_t> reference(fast.size());
+				uint8_t* dest[4] = { reference.data(), nullptr, nullptr, nullptr };
+				int linesize[4] = { width * 4, 0, 0, 0 };
+				sws_scale(ctx, frame->data, frame->linesize, 0, height, dest, linesize);
+
+				int max_diff = 0;
+				for (size_t i = 0; i < fast.size(); ++i)
+				{
+					if (i % 4 != 3)
+						max_diff = (std::max)(max_diff, std::abs(fast[i] - reference[i]));
+				}
+				EXPECT_LE(max_diff, tolerance) << "format " << format << " colorspace " << colorspace << " range " << range;
+			}
+		}
+		av_frame_free(&frame);
+	}
+}
+
+static const char* kIndexMedia = "frame_index_test.mkv";
+static const char* kIndexFile = "frame_index_test.idx";
+static const int kIndexFrames = 12; //three gops of I P B B in decode order
+static const int kIndexFrameMs = 40;
+
+/*
+* muxes packets that were never encoded, the demuxer doesn't look inside them. video is stream 0 with its
+* pts reordered like b frames, frame n shows at (n + 1) * 40ms and every fourth frame is a keyframe.
+* stream 1 is audio so there is something for Build to skip
+*/
+static bool writeIndexMedia(const char* path)
+{
+	AVFormatContext* ctx = nullptr;
+	if (avformat_alloc_output_context2(&ctx, nullptr, "matroska", path) < 0)
+		return false;
+
+	AVStream* video = avformat_new_stream(ctx, nullptr);
+	video->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	video->codecpar->codec_id = AV_CODEC_ID_MPEG4;
+	video->codecpar->width = 64;
+	video->codecpar->height = 64;
+	video->time_base = { 1, 1000 };
+
+	AVStream* audio = avformat_new_stream(ctx, nullptr);
+	audio->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+	audio->codecpar->codec_id = AV_CODEC_ID_PCM_S16LE;
+	audio->codecpar->sample_rate = 48000;
+	audio->codecpar->channels = 1;
+	audio->codecpar->channel_layout = AV_CH_LAYOUT_MONO;
+	audio->time_base = { 1, 1000 };
+
+	bool ok = avio_open(&ctx->pb, path, AVIO_FLAG_WRITE) >= 0 && avformat_write_header(ctx, nullptr) >= 0;
+
+	const int reorder[] = { 0, 3, 1, 2 };
+	AVPacket* pkt = av_packet_alloc();
+	for (int i = 0; ok && i < kIndexFrames; ++i)
+	{
+		for (int stream = 0; ok && stream < 2; ++stream)
+		{
+			ok = av_new_packet(pkt, 64) >= 0;
+			if (!ok)
+				break;
+			memset(pkt->data, i, pkt->size);
+			pkt->stream_index = stream;
+			pkt->dts = i * kIndexFrameMs;
+			pkt->pts = stream == 0 ? (i / 4 * 4 + reorder[i % 4] + 1) * kIndexFrameMs : pkt->dts;
+			pkt->duration = kIndexFrameMs;
+			if (stream == 1 || i % 4 == 0)
+				pkt->flags |= AV_PKT_FLAG_KEY;
+			av_packet_rescale_ts(pkt, { 1, 1000 }, ctx->streams[stream]->time_base);
+			ok = av_interleaved_write_frame(ctx, pkt) >= 0;
+			av_packet_unref(pkt);
+		}
+	}
+	av_packet_free(&pkt);
+
+	if (ok)
+		ok = av_write_trailer(ctx) >= 0;
+	avio_closep(&ctx->pb);
+	avformat_free_context(ctx);
+	return ok;
+}
+
+static bool buildIndex(FrameIndex& index)
+{
+	AVFormatContext* ctx = nullptr;
+	if (avformat_open_input(&ctx, kIndexMedia, nullptr, nullptr) < 0)
+		return false;
+	bool ok = index.Build(ctx, 0) == 0;
+	avformat_close_input(&ctx);
+	return ok;
+}
+
+class FrameIndexTest : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		ASSERT_TRUE(writeIndexMedia(kIndexMedia));
+	}
+
+	void TearDown() override
+	{
+		remove(kIndexMedia);
+		remove(kIndexFile);
+	}
+};
+
+TEST_F(FrameIndexTest, BuildSortsIntoPresentationOrder)
+{
+	FrameIndex index;
+	ASSERT_TRUE(buildIndex(index));
+	ASSERT_EQ(kIndexFrames, (int)index.FrameCount());
+	EXPECT_EQ(kIndexFrames / 4, (int)index.KeyFrameCount());
+	EXPECT_TRUE(index.IsConstantRate());
+
+	for (int i = 0; i < kIndexFrames; ++i)
+	{
+		const FrameIndexEntry& entry = index.Entries()[i];
+		EXPECT_EQ((i + 1) * kIndexFrameMs, entry.pts);
+		EXPECT_EQ(i % 4 == 0 ? 1 : 0, entry.key_frame);
+		EXPECT_EQ(i, index.FrameNumber(&entry));
+	}
+}
+
+TEST_F(FrameIndexTest, BuildRestoresDiscardFlags)
+{
+	AVFormatContext* ctx = nullptr;
+	ASSERT_GE(avformat_open_input(&ctx, kIndexMedia, nullptr, nullptr), 0);
+	ctx->streams[0]->discard = AVDISCARD_NONREF;
+	ctx->streams[1]->discard = AVDISCARD_DEFAULT;
+
+	FrameIndex index;
+	EXPECT_EQ(0, index.Build(ctx, 0));
+	EXPECT_EQ(AVDISCARD_NONREF, ctx->streams[0]->discard);
+	EXPECT_EQ(AVDISCARD_DEFAULT, ctx->streams[1]->discard);
+
+	EXPECT_EQ(AVERROR(EINVAL), index.Build(ctx, 2));
+	EXPECT_EQ(AVDISCARD_DEFAULT, ctx->streams[1]->discard);
+	avformat_close_input(&ctx);
+}
+
+TEST_F(FrameIndexTest, Lookups)
+{
+	FrameIndex index;
+	ASSERT_TRUE(buildIndex(index));
+
+	//before the first frame clamps to it
+	EXPECT_EQ(0, index.FrameNumberAt(0));
+	EXPECT_EQ(0, index.FrameNumber(index.KeyFrameAtOrBefore(0)));
+
+	for (int i = 0; i < kIndexFrames; ++i)
+	{
+		int64_t pts = (i + 1) * kIndexFrameMs;
+		EXPECT_EQ(pts, index.FramePts(i));
+		EXPECT_EQ(i, index.FrameNumberAt(pts));
+		EXPECT_EQ(i, index.FrameNumberAt(pts + kIndexFrameMs - 1));
+		EXPECT_EQ(i, index.FrameNumber(index.FrameAtOrBefore(pts)));
+		EXPECT_EQ(i / 4 * 4, index.FrameNumber(index.KeyFrameAtOrBefore(pts)));
+		EXPECT_EQ(i / 4 * 4, index.FrameNumber(index.KeyFrameAtOrBefore(pts + kIndexFrameMs - 1)));
+	}
+
+	EXPECT_EQ(kIndexFrames - 1, index.FrameNumberAt(INT64_MAX));
+	EXPECT_EQ(AV_NOPTS_VALUE, index.FramePts(-1));
+	EXPECT_EQ(AV_NOPTS_VALUE, index.FramePts(kIndexFrames));
+
+	FrameIndex empty;
+	EXPECT_EQ(nullptr, empty.FrameAtOrBefore(0));
+	EXPECT_EQ(nullptr, empty.KeyFrameAtOrBefore(0));
+	EXPECT_EQ(-1, empty.FrameNumberAt(0));
+}
+
+TEST_F(FrameIndexTest, SaveLoadRoundTrip)
+{
+	FrameIndex built;
+	ASSERT_TRUE(buildIndex(built));
+	ASSERT_TRUE(built.Save(kIndexFile, kIndexMedia));
+
+	FrameIndex loaded;
+	ASSERT_TRUE(loaded.Load(kIndexFile, kIndexMedia, 0));
+	EXPECT_EQ(0, loaded.StreamIndex());
+	ASSERT_EQ(built.FrameCount(), loaded.FrameCount());
+	EXPECT_EQ(built.KeyFrameCount(), loaded.KeyFrameCount());
+	for (size_t i = 0; i < built.FrameCount(); ++i)
+	{
+		const FrameIndexEntry& a = built.Entries()[i];
+		const FrameIndexEntry& b = loaded.Entries()[i];
+		EXPECT_EQ(a.pts, b.pts);
+		EXPECT_EQ(a.dts, b.dts);
+		EXPECT_EQ(a.pos, b.pos);
+		EXPECT_EQ(a.size, b.size);
+		EXPECT_EQ(a.key_frame, b.key_frame);
+	}
+
+	FrameIndex other;
+	EXPECT_FALSE(other.Load(kIndexFile, kIndexMedia, 1));
+	EXPECT_FALSE(other.Load("frame_index_missing.idx", kIndexMedia, 0));
+}
+
+TEST_F(FrameIndexTest, LoadRejectsTruncatedAndCorruptFiles)
+{
+	FrameIndex built;
+	ASSERT_TRUE(buildIndex(built));
+	ASSERT_TRUE(built.Save(kIndexFile, kIndexMedia));
+
+	std::vector<char> bytes;
+	{
+		std::ifstream in(kIndexFile, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	size_t header = bytes.size() - built.FrameCount() * sizeof(FrameIndexEntry);
+
+	//last entry cut short
+	{
+		std::ofstream out(kIndexFile, std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), bytes.size() - sizeof(FrameIndexEntry) / 2);
+	}
+	FrameIndex truncated;
+	EXPECT_FALSE(truncated.Load(kIndexFile, kIndexMedia, 0));
+
+	//a count far past the end of the file, the last field of the header
+	uint64_t count = UINT64_MAX / sizeof(FrameIndexEntry);
+	memcpy(&bytes[header - sizeof(count)], &count, sizeof(count));
+	{
+		std::ofstream out(kIndexFile, std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), bytes.size());
+	}
+	FrameIndex corrupt;
+	EXPECT_FALSE(corrupt.Load(kIndexFile, kIndexMedia, 0));
+	EXPECT_TRUE(corrupt.IsEmpty());
+}
+
+/*
+* a state with a single 29.97 video stream and no file behind it, enough for the frame number <-> pts math.
+* the state owns the context and frees it on Close
+*/
+static void setTimingStream(MediaReaderState& state, AVRational timeBase, int64_t startTime)
+{
+	state.av_format_ctx = avformat_alloc_context();
+	AVStream* stream = avformat_new_stream(state.av_format_ctx, nullptr);
+	stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	stream->time_base = timeBase;
+	stream->avg_frame_rate = { 30000, 1001 };
+	stream->r_frame_rate = { 30000, 1001 };
+	stream->start_time = startTime;
+	state.video_stream_index = 0;
+}
+
+//what a muxer that truncates to its time base writes for frame n
+static int64_t truncatedPts(int64_t n, AVRational timeBase, int64_t startTime)
+{
+	return startTime + av_rescale_q_rnd(n, { 1001, 30000 }, timeBase, AV_ROUND_DOWN);
+}
+
+static void checkFrameTiming(AVRational timeBase, int64_t startTime, int64_t interval)
+{
+	MediaReaderState state;
+	setTimingStream(state, timeBase, startTime);
+	ASSERT_EQ(30000, state.VideoFrameRate().num);
+	ASSERT_EQ(1001, state.VideoFrameRate().den);
+	EXPECT_EQ(interval, state.VideoFrameInterval());
+	EXPECT_FALSE(state.IsVariableFrameRate());
+
+	//the tolerance trackToFrame accepts a frame with, it has to take a rounded timestamp but not the next frame
+	int64_t tolerance = state.VideoFrameInterval() / 2 + 1;
+
+	EXPECT_EQ(startTime, state.FramePts(0));
+	EXPECT_LE(state.FrameStartPts(0), state.FramePts(0));
+	for (int64_t n = 0; n < 10000; ++n)
+	{
+		int64_t pts = state.FramePts(n);
+		int64_t truncated = truncatedPts(n, timeBase, startTime);
+		EXPECT_EQ(n, state.FrameNumberAt(pts));
+		EXPECT_EQ(n, state.FrameNumberAt(truncated));
+		EXPECT_LE(std::abs(truncated - pts), tolerance);
+		if (n == 0)
+			continue;
+
+		int64_t previous = state.FramePts(n - 1);
+		EXPECT_LT(previous, state.FrameStartPts(n));
+		EXPECT_LE(state.FrameStartPts(n), pts);
+		EXPECT_LE(state.FrameStartPts(n), truncated);
+		EXPECT_GT(pts - previous, tolerance);
+	}
+
+	//anything before the first frame still shows the first frame
+	EXPECT_EQ(0, state.FrameNumberAt(startTime - 1));
+	EXPECT_EQ(0, state.FrameNumberAt(startTime - 10 * interval));
+	EXPECT_EQ(-1, state.FrameNumberAt(AV_NOPTS_VALUE));
+	EXPECT_EQ(AV_NOPTS_VALUE, state.FramePts(-1));
+	EXPECT_EQ(AV_NOPTS_VALUE, state.FrameStartPts(-1));
+}
+
+TEST(MediaReaderState, FrameTimingNtscMilliseconds)
+{
+	checkFrameTiming({ 1, 1000 }, 0, 33);
+}
+
+TEST(MediaReaderState, FrameTimingNtscExactTimebase)
+{
+	MediaReaderState state;
+	setTimingStream(state, { 1, 30000 }, 0);
+	for (int64_t n = 0; n < 100; ++n)
+		EXPECT_EQ(n * 1001, state.FramePts(n));
+
+	checkFrameTiming({ 1, 30000 }, 0, 1001);
+}
+
+TEST(MediaReaderState, FrameTimingStartOffset)
+{
+	checkFrameTiming({ 1, 1000 }, 1400, 33);
+	checkFrameTiming({ 1, 90000 }, 126000, 3003);
+}
+
+TEST(ThreadBudget, FirstGrantLeavesHeadroom)
+{
+	ThreadBudget budget(8);
+	EXPECT_EQ(4, budget.Acquire());
+	EXPECT_EQ(2, budget.Acquire());
+	EXPECT_EQ(1, budget.Acquire());
+	EXPECT_EQ(1, budget.Acquire());
+	//nothing left, the floor still gives a thread
+	EXPECT_EQ(1, budget.Acquire());
+
+	ThreadBudgetStats stats = budget.Stats();
+	EXPECT_EQ(8, stats.total);
+	EXPECT_EQ(9, stats.in_use);
+	EXPECT_EQ(5, stats.decoders);
+	EXPECT_EQ(5, stats.grants);
+	EXPECT_EQ(4, stats.max_grant);
+}
+
+TEST(ThreadBudget, ReleaseGivesThreadsBack)
+{
+	ThreadBudget budget(8);
+	int first = budget.Acquire();
+	int second = budget.Acquire();
+	budget.Release(first);
+	EXPECT_EQ(second, budget.Stats().in_use);
+	EXPECT_EQ(1, budget.Stats().decoders);
+
+	//one holder is already past the expected count, so the new grant is half of the 6 still free
+	EXPECT_EQ(3, budget.Acquire());
+	budget.Release(3);
+	budget.Release(second);
+	EXPECT_EQ(0, budget.Stats().in_use);
+	EXPECT_EQ(0, budget.Stats().decoders);
+
+	//nothing held, releasing again doesn't go negative
+	budget.Release(2);
+	budget.Release(0);
+	EXPECT_EQ(0, budget.Stats().in_use);
+	EXPECT_EQ(0, budget.Stats().decoders);
+}
+
+TEST(ThreadBudget, ExpectedDecodersSplitEvenly)
+{
+	ThreadBudget budget(8);
+	budget.SetExpectedDecoders(4);
+	for (int i = 0; i < 4; ++i)
+		EXPECT_EQ(2, budget.Acquire());
+	EXPECT_EQ(8, budget.Stats().in_use);
+	EXPECT_EQ(1, budget.Acquire());
+}
+
+TEST(ThreadBudget, RequestsAndMaxGrant)
+{
+	ThreadBudget budget(8);
+	EXPECT_EQ(2, budget.Acquire(2));
+	EXPECT_EQ(0, budget.Stats().reduced);
+	budget.Release(2);
+
+	EXPECT_EQ(4, budget.Acquire(16));
+	EXPECT_EQ(1, budget.Stats().reduced);
+	budget.Release(4);
+
+	budget.SetMaxGrant(8);
+	EXPECT_EQ(8, budget.Acquire());
+	budget.Release(8);
+
+	budget.SetMaxGrant(0);
+	EXPECT_EQ(4, budget.Stats().max_grant);
+}
+
+static const char* kInterleavedMedia = "demux_pipeline_test.nut";
+static const int kInterleavedFrames = 25;
+static const int kInterleavedSize = 32;
+static const int kInterleavedSamples = 320; //40ms of 8kHz mono, one audio packet per video frame
+
+/*
+* raw yuv420p video and s16 mono pcm, interleaved one packet of each per 40ms. the luma of video frame n and
+* every sample of audio packet n are n, so the decoded frames can be told apart
+*/
+static bool writeInterleavedMedia(const char* path)
+{
+	AVFormatContext* ctx = nullptr;
+	if (avformat_alloc_output_context2(&ctx, nullptr, "nut", path) < 0)
+		return false;
+
+	AVStream* video = avformat_new_stream(ctx, nullptr);
+	video->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	video->codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+	video->codecpar->format = AV_PIX_FMT_YUV420P;
+	video->codecpar->width = kInterleavedSize;
+	video->codecpar->height = kInterleavedSize;
+	video->time_base = { 1, 25 };
+
+	AVStream* audio = avformat_new_stream(ctx, nullptr);
+	audio->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+	audio->codecpar->codec_id = AV_CODEC_ID_PCM_S16LE;
+	audio->codecpar->format = AV_SAMPLE_FMT_S16;
+	audio->codecpar->sample_rate = 8000;
+	audio->codecpar->channels = 1;
+	audio->codecpar->channel_layout = AV_CH_LAYOUT_MONO;
+	audio->time_base = { 1, 8000 };
+
+	bool ok = avio_open(&ctx->pb, path, AVIO_FLAG_WRITE) >= 0 && avformat_write_header(ctx, nullptr) >= 0;
+
+	const int lumaSize = kInterleavedSize * kInterleavedSize;
+	AVPacket* pkt = av_packet_alloc();
+	for (int i = 0; ok && i < kInterleavedFrames; ++i)
+	{
+		ok = av_new_packet(pkt, lumaSize * 3 / 2) >= 0;
+		if (!ok)
+			break;
+		memset(pkt->data, i, lumaSize);
+		memset(pkt->data + lumaSize, 128, lumaSize / 2);
+		pkt->stream_index = 0;
+		pkt->pts = pkt->dts = i;
+		pkt->duration = 1;
+		pkt->flags |= AV_PKT_FLAG_KEY;
+		av_packet_rescale_ts(pkt, { 1, 25 }, ctx->streams[0]->time_base);
+		ok = av_interleaved_write_frame(ctx, pkt) >= 0;
+		av_packet_unref(pkt);
+		if (!ok)
+			break;
+
+		ok = av_new_packet(pkt, kInterleavedSamples * 2) >= 0;
+		if (!ok)
+			break;
+		int16_t* samples = (int16_t*)pkt->data;
+		for (int n = 0; n < kInterleavedSamples; ++n)
+			samples[n] = (int16_t)i;
+		pkt->stream_index = 1;
+		pkt->pts = pkt->dts = (int64_t)i * kInterleavedSamples;
+		pkt->duration = kInterleavedSamples;
+		pkt->flags |= AV_PKT_FLAG_KEY;
+		av_packet_rescale_ts(pkt, { 1, 8000 }, ctx->streams[1]->time_base);
+		ok = av_interleaved_write_frame(ctx, pkt) >= 0;
+		av_packet_unref(pkt);
+	}
+	av_packet_free(&pkt);
+
+	if (ok)
+		ok = av_write_trailer(ctx) >= 0;
+	avio_closep(&ctx->pb);
+	avformat_free_context(ctx);
+	return ok;
+}
+
+class DemuxPipelineTest : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		ASSERT_TRUE(writeInterleavedMedia(kInterleavedMedia));
+	}
+
+	void TearDown() override
+	{
+		remove(kInterleavedMedia);
+	}
+};
+
+TEST_F(DemuxPipelineTest, ReadsInterleavedStreamsInOnePass)
+{
+	CMediaConverter converter;
+	MediaReaderState state;
+	ASSERT_EQ(ErrorCode::SUCCESS, converter.openVideoReader(&state, kInterleavedMedia));
+	ASSERT_EQ(ErrorCode::SUCCESS, converter.startDemuxPipeline(&state, DemuxPipelineOptions()));
+
+	int videoFrames = 0, audioFrames = 0, samples = 0;
+	int64_t videoPts = AV_NOPTS_VALUE, audioPts = AV_NOPTS_VALUE;
+	bool videoDone = false, audioDone = false;
+	//alternating reads, the way a player pulls both streams
+	for (int step = 0; step < 10 * kInterleavedFrames && !(videoDone && audioDone); ++step)
+	{
+		FrameHandle frame;
+		if (!videoDone)
+		{
+			ErrorCode ret = converter.readVideoFrame(&state, frame);
+			if (ret == ErrorCode::SUCCESS)
+			{
+				EXPECT_EQ(videoFrames, frame.Data(0)[0]);
+				EXPECT_GT(frame.Pts(), videoPts);
+				videoPts = frame.Pts();
+				++videoFrames;
+			}
+			else if (ret == ErrorCode::FILE_EOF)
+				videoDone = true;
+			else
+				ASSERT_EQ(ErrorCode::AGAIN, ret);
+		}
+
+		if (!audioDone)
+		{
+			ErrorCode ret = converter.readAudioFrame(&state, frame);
+			if (ret == ErrorCode::SUCCESS)
+			{
+				int16_t sample = 0;
+				memcpy(&sample, frame.Data(0), sizeof(sample));
+				EXPECT_EQ(audioFrames, sample);
+				EXPECT_GT(frame.Pts(), audioPts);
+				audioPts = frame.Pts();
+				samples += frame.Get()->nb_samples;
+				++audioFrames;
+			}
+			else if (ret == ErrorCode::FILE_EOF)
+				audioDone = true;
+			else
+				ASSERT_EQ(ErrorCode::AGAIN, ret);
+		}
+	}
+
+	EXPECT_TRUE(videoDone);
+	EXPECT_TRUE(audioDone);
+	EXPECT_EQ(kInterleavedFrames, videoFrames);
+	EXPECT_EQ(kInterleavedFrames * kInterleavedSamples, samples);
+
+	//every packet went through av_read_frame once, for both streams
+	DemuxPipelineStats stats;
+	ASSERT_EQ(ErrorCode::SUCCESS, converter.getDemuxPipelineStats(&state, stats));
+	EXPECT_EQ(2 * kInterleavedFrames, stats.packets_read);
+	EXPECT_EQ(kInterleavedFrames, stats.video_frames);
+	EXPECT_EQ(kInterleavedFrames, stats.audio_frames);
+
+	//a seek drops the finished run and the next read starts the pipeline over from the new position
+	ASSERT_EQ(ErrorCode::SUCCESS, converter.seekToStart(&state));
+	FrameHandle first;
+	ASSERT_EQ(ErrorCode::SUCCESS, converter.readVideoFrame(&state, first));
+	EXPECT_EQ(0, first.Data(0)[0]);
+}